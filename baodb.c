@@ -0,0 +1,217 @@
+/******************************************************************************
+ *	baodb.c: Command line front end to the game database (gamedb.c)
+ *
+ *		Moves are written hole then '+' (clockwise, MXD_RIGHT) or '-'
+ *		(anticlockwise), with an 'n' after a haulted move that went on to
+ *		sow nyumba: "5+ 12- 4+n". Games are read one per line.
+ *****************************************************************************/
+
+#include "gamedb.h"
+#include "move_io.h"
+#include "error.h"
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+enum {
+	RANDOM_MAX_PLIES = 400,	/* Random games stop unfinished after this */
+	LOOKUPS = 100000		/* Lookups "query" times */
+};
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-d dir] [-r rules] command\n"
+			"commands:\n"
+			"  add                   archive the games on stdin\n"
+			"  random ngames [seed]  archive random games\n"
+			"  build [-j nthreads]   (re)build the position index\n"
+			"  query [move ...]      look up the position after moves\n",
+			program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+
+static int add_games(const char *dir, const char *variant)
+{
+	Move moves[GAMEDB_MAX_PLIES];
+	char *line, *tok;
+	size_t size;
+	int n, lineno, ngames;
+
+	line = NULL;
+	size = 0;
+	ngames = 0;
+	for(lineno = 1; getline(&line, &size, stdin) != -1; lineno++) {
+		n = 0;
+		for(tok = strtok(line, " \t\n"); tok != NULL;
+				tok = strtok(NULL, " \t\n")) {
+			if(n == GAMEDB_MAX_PLIES || parse_move(&moves[n++], tok) == -1) {
+				fprintf(stderr, "line %d: bad move '%s'\n", lineno, tok);
+				free(line);
+				return -1;
+			}
+		}
+		if(n == 0)
+			continue;
+		if(gamedb_append(dir, variant, moves, n) == -1)
+			choke("Could not archive game");
+		ngames++;
+	}
+	free(line);
+	printf("%d games archived\n", ngames);
+	return 0;
+}
+
+
+/* Plays ngames games of uniformly random moves, for trying the index out */
+static void random_games(const char *dir, int variant, int ngames)
+{
+	Move moves[RANDOM_MAX_PLIES], alias[MAXMOVES];
+	BaoTree *root;
+	BaoState start, next;
+	int g, n, path, nalias;
+
+	if((root = new_tree(&rules[variant])) == NULL)
+		choke("Could not initialise a new game");
+	start = root->state;
+	for(g = 0; g < ngames; g++) {
+		root->state = start;
+		for(n = 0; n < RANDOM_MAX_PLIES; n++) {
+			if(grow_tree(root, &rules[variant]) == -1)
+				choke("Could not update tree");
+			if(root->nchildren == 0)
+				break;
+			path = rand() % root->nchildren;
+			nalias = branch_moves(root, path, alias, MAXMOVES);
+			moves[n] = alias[rand() % nalias];
+			next = root->children[path].state;
+			prune_tree(root);
+			root->state = next;
+		}
+		prune_tree(root);
+		if(gamedb_append(dir, rules_names[variant], moves, n) == -1)
+			choke("Could not archive game");
+	}
+	free_tree(root);
+	printf("%d games archived\n", ngames);
+}
+
+
+static double elapsed(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+
+static int query(const char *dir, int variant, char **argv, int argc)
+{
+	GameDBMove moves[MAXTRANS];
+	struct timespec t0;
+	GameDBInfo info;
+	BaoTree *root;
+	BaoState next;
+	GameDB *db;
+	Move move;
+	uint32_t count;
+	char text[8];
+	int i, n, path;
+
+	if((db = gamedb_open(dir, rules_names[variant])) == NULL)
+		choke("Could not open index");
+	if((root = new_tree(&rules[variant])) == NULL)
+		choke("Could not initialise a new game");
+	for(i = 0; i < argc; i++) {
+		if(parse_move(&move, argv[i]) == -1) {
+			fprintf(stderr, "bad move '%s'\n", argv[i]);
+			return -1;
+		}
+		if(grow_tree(root, &rules[variant]) == -1)
+			choke("Could not update tree");
+		if((path = find_branch(root, &move)) == -1) {
+			fprintf(stderr, "illegal move '%s'\n", argv[i]);
+			return -1;
+		}
+		next = root->children[path].state;
+		prune_tree(root);
+		root->state = next;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < LOOKUPS; i++)
+		n = gamedb_lookup(db, &root->state, &count, moves, MAXTRANS);
+	gamedb_info(db, &info);
+	printf("%llu games, %llu positions (%llu games with illegal moves)\n",
+			(unsigned long long) info.games,
+			(unsigned long long) info.positions,
+			(unsigned long long) info.bad_games);
+	printf("reached %u times, lookup %.2f us\n", count,
+			elapsed(&t0) * 1e6 / LOOKUPS);
+	for(i = 0; i < n; i++) {
+		format_move(text, sizeof(text), &moves[i].move);
+		printf("  %s\t%u played, %u won (%.1f%%)\n", text, moves[i].count,
+				moves[i].wins, 100.0 * moves[i].wins / moves[i].count);
+	}
+	free_tree(root);
+	gamedb_close(db);
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *dir = ".";
+	struct timespec t0;
+	int opt, variant, nthreads;
+
+	variant = RULES_kiswahili;
+	while((opt = getopt(argc, argv, "+d:r:")) != -1) {
+		switch(opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'r':
+			for(variant = 0; variant < NRULES; variant++)
+				if(strcmp(rules_names[variant], optarg) == 0)
+					break;
+			if(variant == NRULES)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if(optind >= argc)
+		usage();
+
+	if(strcmp(argv[optind], "add") == 0) {
+		return add_games(dir, rules_names[variant]) == -1
+			? EXIT_FAILURE : EXIT_SUCCESS;
+	} else if(strcmp(argv[optind], "random") == 0 && optind + 1 < argc) {
+		srand(optind + 2 < argc ? atoi(argv[optind + 2]) : time(NULL));
+		random_games(dir, variant, atoi(argv[optind + 1]));
+	} else if(strcmp(argv[optind], "build") == 0) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(optind + 2 < argc && strcmp(argv[optind + 1], "-j") == 0)
+			nthreads = atoi(argv[optind + 2]);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if(gamedb_build(dir, rules_names[variant], &rules[variant],
+					nthreads) == -1)
+			choke("Could not build index");
+		printf("index built in %.2f s\n", elapsed(&t0));
+	} else if(strcmp(argv[optind], "query") == 0) {
+		return query(dir, variant, argv + optind + 1, argc - optind - 1) == -1
+			? EXIT_FAILURE : EXIT_SUCCESS;
+	} else {
+		usage();
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+/******************************************************************************
+ *	baotrace.c: Where move execution time goes, per rule variant
+ *
+ *		Plays random games with move tracing on (see trace.c), expanding
+ *		every position on the way so all moves get executed, and prints
+ *		histograms of steps, captures and time per traced move.
+ *****************************************************************************/
+
+#include "trace.h"
+#include "error.h"
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+enum {
+	MAX_PLIES = 400,	/* Games stop unfinished after this */
+	NBUCKETS  = 32,		/* Histogram buckets, powers of 2 */
+	NSLOWEST  = 5		/* Slowest moves listed */
+};
+
+
+struct Summary {
+	unsigned long long steps[NBUCKETS];
+	unsigned long long captures[NBUCKETS];
+	unsigned long long ns[NBUCKETS];
+	unsigned long long status[MXS_PERPETUAL + 1];
+	unsigned long long nmoves, nsteps, total_ns, lost;
+	unsigned long long *times;	/* ns of every move, for the tail share */
+	size_t ntimes, size;
+	MoveTrace slowest[NSLOWEST];
+};
+
+
+typedef struct Summary Summary;
+
+
+static const char *status_names[] = {
+	"error", "haulted", "done", "not done", "perpetual"
+};
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-r rules] [-p period] [-s seed] ngames\n"
+			"  -p period  trace one move in period (default 1)\n",
+			program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+
+/* 0 for 0, else 1 + floor(log2(n)) */
+static int bucket(unsigned long long n)
+{
+	int b = n ? 64 - __builtin_clzll(n) : 0;
+
+	return b < NBUCKETS ? b : NBUCKETS - 1;
+}
+
+
+static void add_trace(const MoveTrace *trace, void *arg)
+{
+	Summary *sum = (Summary *) arg;
+	unsigned long long *p;
+	int i;
+
+	sum->steps[bucket(trace->steps)]++;
+	sum->captures[bucket(trace->captures)]++;
+	sum->ns[bucket(trace->ns)]++;
+	if(trace->status <= MXS_PERPETUAL)
+		sum->status[trace->status]++;
+	sum->nmoves++;
+	sum->nsteps += trace->steps;
+	sum->total_ns += trace->ns;
+	if(sum->ntimes == sum->size) {
+		sum->size = sum->size ? 2 * sum->size : 4096;
+		p = (unsigned long long *) realloc(sum->times,
+				sum->size * sizeof(*p));
+		if(p == NULL)
+			choke("Could not keep move times");
+		sum->times = p;
+	}
+	sum->times[sum->ntimes++] = trace->ns;
+	for(i = NSLOWEST; i > 0 && trace->ns > sum->slowest[i - 1].ns; i--)
+		if(i < NSLOWEST)
+			sum->slowest[i] = sum->slowest[i - 1];
+	if(i < NSLOWEST)
+		sum->slowest[i] = *trace;
+}
+
+
+/* Random games of ngames, with every position on them grown */
+static void play(const BaoRules *r, int ngames, Summary *sum)
+{
+	BaoTree *root;
+	BaoState start, next;
+	int g, n;
+
+	if((root = new_tree(r)) == NULL)
+		choke("Could not initialise a new game");
+	start = root->state;
+	for(g = 0; g < ngames; g++) {
+		root->state = start;
+		for(n = 0; n < MAX_PLIES; n++) {
+			if(grow_tree(root, r) == -1)
+				choke("Could not update tree");
+			if(root->nchildren == 0)
+				break;
+			next = root->children[rand() % root->nchildren].state;
+			prune_tree(root);
+			root->state = next;
+		}
+		prune_tree(root);
+		/* Often enough that the rings do not wrap */
+		trace_drain(add_trace, sum, &sum->lost);
+	}
+	free_tree(root);
+}
+
+
+static void print_histogram(const char *title, const char *unit,
+		const unsigned long long *h, unsigned long long total)
+{
+	unsigned long long max;
+	int b, lo, hi;
+
+	printf("%s:\n", title);
+	max = 0;
+	for(b = 0; b < NBUCKETS; b++)
+		if(h[b] > max)
+			max = h[b];
+	for(lo = 0; lo < NBUCKETS && h[lo] == 0; lo++)
+		;
+	for(hi = NBUCKETS - 1; hi > lo && h[hi] == 0; hi--)
+		;
+	for(b = lo; b <= hi; b++) {
+		if(b <= 1)
+			printf("  %21d %-5s", b, unit);
+		else
+			printf("  %10llu-%-10llu %-5s", 1ULL << (b - 1),
+					(1ULL << b) - 1, unit);
+		printf(" %10llu %6.2f%% %.*s\n", h[b], 100.0 * h[b] / total,
+				(int) (40 * h[b] / max), "########################################");
+	}
+}
+
+
+static int cmp_desc(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *) a;
+	unsigned long long y = *(const unsigned long long *) b;
+
+	return (x < y) - (x > y);
+}
+
+
+static void print_summary(const char *name, Summary *sum)
+{
+	unsigned long long top;
+	size_t i, n;
+	int s;
+
+	printf("== %s: %llu moves traced, %llu lost, %.2f steps and %.0f ns "
+			"per move\n", name, sum->nmoves, sum->lost,
+			(double) sum->nsteps / sum->nmoves,
+			(double) sum->total_ns / sum->nmoves);
+	for(s = 0; s <= MXS_PERPETUAL; s++)
+		if(sum->status[s])
+			printf("  %-10s %llu\n", status_names[s], sum->status[s]);
+	print_histogram("steps per move", "steps", sum->steps, sum->nmoves);
+	print_histogram("captures per move", "caps", sum->captures, sum->nmoves);
+	print_histogram("time per move", "ns", sum->ns, sum->nmoves);
+	qsort(sum->times, sum->ntimes, sizeof(*sum->times), cmp_desc);
+	n = (sum->ntimes + 99) / 100;
+	for(top = 0, i = 0; i < n; i++)
+		top += sum->times[i];
+	printf("slowest 1%% of moves: %.1f%% of the time\n",
+			100.0 * top / sum->total_ns);
+	printf("slowest moves:\n");
+	for(i = 0; i < NSLOWEST && sum->slowest[i].engine != NULL; i++)
+		printf("  %8llu ns %8u steps %6u lifts %6u captures  %s from %s "
+				"%d (%s engine)\n", (unsigned long long) sum->slowest[i].ns,
+				sum->slowest[i].steps, sum->slowest[i].lifts,
+				sum->slowest[i].captures,
+				status_names[sum->slowest[i].status],
+				sum->slowest[i].side == P_NORTH ? "north" : "south",
+				sum->slowest[i].hole, sum->slowest[i].engine);
+}
+
+
+int main(int argc, char *argv[])
+{
+	Summary sum;
+	unsigned int period, seed;
+	int opt, variant, first, last, ngames;
+
+	period = 1;
+	seed = 1;
+	first = 0;
+	last = NRULES - 1;
+	while((opt = getopt(argc, argv, "r:p:s:")) != -1) {
+		switch(opt) {
+		case 'r':
+			for(variant = 0; variant < NRULES; variant++)
+				if(strcmp(rules_names[variant], optarg) == 0)
+					break;
+			if(variant == NRULES)
+				usage();
+			first = last = variant;
+			break;
+		case 'p':
+			period = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(optind >= argc || (ngames = atoi(argv[optind])) <= 0 || period == 0)
+		usage();
+	if(!trace_enabled()) {
+		fprintf(stderr, "%s: tracing compiled out (BAO_NO_TRACE)\n",
+				program_invocation_short_name);
+		return EXIT_FAILURE;
+	}
+
+	for(variant = first; variant <= last; variant++) {
+		memset(&sum, 0, sizeof(sum));
+		srand(seed);
+		trace_set_period(period);
+		play(&rules[variant], ngames, &sum);
+		trace_set_period(0);
+		trace_drain(add_trace, &sum, &sum.lost);
+		if(sum.nmoves)
+			print_summary(rules_names[variant], &sum);
+		free(sum.times);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+ *	baotrain.c: Command line front end to the evaluation tuner (train.c)
+ *
+ *		Makes training sets from self-play or the game archive (see baodb)
+ *		and fits eval_weights.h to them. A fitted eval_weights.h takes
+ *		effect once the programs are built again.
+ *****************************************************************************/
+
+#include "train.h"
+#include "error.h"
+#include "eval_weights.h"
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: %s [-r rules] [-j nthreads] [options] command\n"
+			"commands:\n"
+			"  selfplay ngames set   play games, -s seed -d depth "
+			"-e explore%% -k skip\n"
+			"  replay dir set        replay the games archived in dir, "
+			"-k skip\n"
+			"  tune set              fit weights to set, -n epochs -l rate "
+			"-o file\n",
+			program_invocation_short_name);
+	exit(EXIT_FAILURE);
+}
+
+
+static double elapsed(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+
+/* Called after each epoch of "tune" */
+static void print_epoch(int epoch, double loss, void *arg)
+{
+	if(epoch % 25 == 0)
+		printf("epoch %d: loss %.6f\n", epoch, loss);
+}
+
+
+static void print_set(const TrainSet *set, const char *path,
+		const struct timespec *t0)
+{
+	size_t i, won, drawn;
+
+	won = drawn = 0;
+	for(i = 0; i < set->n; i++) {
+		won += set->records[i * TRAIN_RECORD_SIZE + EVAL_NFEATURES] == TR_WIN;
+		drawn += set->records[i * TRAIN_RECORD_SIZE + EVAL_NFEATURES]
+			== TR_DRAW;
+	}
+	printf("%s: %zu positions (%zu won, %zu drawn) in %.2f s, %.0f/s\n",
+			path, set->n, won, drawn, elapsed(t0), set->n / elapsed(t0));
+}
+
+
+static void tune(const char *path, const char *out, const TrainConfig *cfg)
+{
+	char note[128];
+	struct timespec t0;
+	TrainSet set;
+	double weights[EVAL_NFEATURES], scale, loss;
+	int i;
+
+	if(train_load(&set, path) == -1)
+		choke("Could not load training set");
+	for(i = 0; i < EVAL_NFEATURES; i++)
+		weights[i] = (double) eval_weights[i] / EVAL_WEIGHT_SCALE;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(train_tune(&set, cfg, weights, &scale, &loss) == -1)
+		choke("Could not tune");
+	printf("%zu positions, %d epochs in %.2f s, scale %.3f, loss %.6f\n",
+			set.n, cfg->epochs, elapsed(&t0), scale, loss);
+	snprintf(note, sizeof(note), "%zu positions, loss %.6f", set.n, loss);
+	train_free(&set);
+	if(train_emit(out, weights, note) == -1)
+		choke("Could not write weights");
+	printf("weights written to %s\n", out);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *out = "eval_weights.h";
+	struct timespec t0;
+	TrainConfig cfg;
+	TrainSet set;
+	int opt, variant, ret;
+
+	variant = RULES_kiswahili;
+	cfg = default_train_config;
+	cfg.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	cfg.report = print_epoch;
+	while((opt = getopt(argc, argv, "+r:j:s:d:e:k:n:l:o:")) != -1) {
+		switch(opt) {
+		case 'r':
+			for(variant = 0; variant < NRULES; variant++)
+				if(strcmp(rules_names[variant], optarg) == 0)
+					break;
+			if(variant == NRULES)
+				usage();
+			break;
+		case 'j':
+			cfg.nthreads = atoi(optarg);
+			break;
+		case 's':
+			cfg.seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'd':
+			cfg.depth = atoi(optarg);
+			break;
+		case 'e':
+			cfg.explore = atoi(optarg);
+			break;
+		case 'k':
+			cfg.skip_plies = atoi(optarg);
+			break;
+		case 'n':
+			cfg.epochs = atoi(optarg);
+			break;
+		case 'l':
+			cfg.rate = atof(optarg);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if(optind >= argc)
+		usage();
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(strcmp(argv[optind], "selfplay") == 0 && optind + 2 < argc) {
+		ret = train_selfplay(&set, &rules[variant], atoi(argv[optind + 1]),
+				&cfg);
+	} else if(strcmp(argv[optind], "replay") == 0 && optind + 2 < argc) {
+		ret = train_replay(&set, argv[optind + 1], rules_names[variant],
+				&rules[variant], &cfg);
+	} else if(strcmp(argv[optind], "tune") == 0 && optind + 1 < argc) {
+		tune(argv[optind + 1], out, &cfg);
+		return EXIT_SUCCESS;
+	} else {
+		usage();
+	}
+	if(ret == -1)
+		choke("Could not make training set");
+	if(train_save(&set, argv[optind + 2]) == -1)
+		choke("Could not save training set");
+	print_set(&set, argv[optind + 2], &t0);
+	train_free(&set);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,430 @@
+/******************************************************************************
+ *	bench.c: Microbenchmarks for the move generation and search hot paths
+ *
+ *		Each benchmark runs over a fixed corpus of namua and mtaji positions
+ *		per rules[] variant. The corpus is collected by playing out
+ *		pseudo-random games from a fixed seed so every run (and every
+ *		commit) sees the same positions.
+ *
+ *		Output is one CSV line per benchmark:
+ *			bench,variant,stage,depth,ops,ns_per_op,ops_per_sec,allocs_per_op,
+ *			nodes_per_op
+ *
+ *		nodes_per_op comes from the search statistics, it stays 0 when
+ *		they are compiled out.
+ *
+ *		Allocations are counted by linking with -Wl,--wrap=malloc (see the
+ *		bench target in the Makefile).
+ *****************************************************************************/
+
+#include "eval.h"
+#include "playout.h"
+#include "rules.h"
+#include "stats.h"
+#include "tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+enum {
+	CORPUS_SIZE  = 8,		/* Positions per (variant, stage) */
+	CORPUS_GAMES = 64,		/* Games tried while filling the corpus */
+	CORPUS_PLIES = 120,		/* Max plies played per corpus game */
+	MAX_DEPTH    = 4,		/* Deepest best_branch() benchmarked */
+	PLAYOUTS     = 64,		/* Playouts per position */
+	PLAYOUT_PLIES = 100		/* Plies a playout may last */
+};
+
+
+enum Stage {
+	S_NAMUA,
+	S_MTAJI,
+	NSTAGES
+};
+
+
+struct Corpus {
+	BaoState pos[NSTAGES][CORPUS_SIZE];
+	int npos[NSTAGES];
+};
+
+
+typedef struct Corpus Corpus;
+
+
+static const char *stage_names[NSTAGES] = {"namua", "mtaji"};
+
+static unsigned long long min_ns = 200000000ULL;
+
+static const char *filter;
+
+static unsigned long long nallocs;
+
+
+void *__real_malloc(size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	nallocs++;
+	return __real_malloc(size);
+}
+
+
+static unsigned int lcg(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+
+static void add_position(Corpus *c, const BaoState *s)
+{
+	int stage = s->board[s->player][H_STORE] ? S_NAMUA : S_MTAJI;
+
+	if(c->npos[stage] < CORPUS_SIZE)
+		c->pos[stage][c->npos[stage]++] = *s;
+}
+
+
+/* Positions are sampled every few plies to spread them over the game */
+static void build_corpus(Corpus *c, const BaoRules *r)
+{
+	BaoTree *tree, *node;
+	unsigned int seed, game, ply;
+
+	memset(c, 0, sizeof(Corpus));
+	seed = 0xBA0;
+	for(game = 0; game < CORPUS_GAMES; game++) {
+		if(c->npos[S_NAMUA] == CORPUS_SIZE && c->npos[S_MTAJI] == CORPUS_SIZE)
+			break;
+		if((tree = new_tree(r)) == NULL)
+			return;
+		node = tree;
+		for(ply = 0; ply < CORPUS_PLIES; ply++) {
+			if(grow_tree(node, r) <= 0)
+				break;
+			if(ply % 7 == game % 7)
+				add_position(c, &node->state);
+			node = &node->children[lcg(&seed) % node->nchildren];
+		}
+		free_tree(tree);
+	}
+}
+
+
+static BaoTree *node_from_state(const BaoState *s, const BaoRules *r)
+{
+	BaoTree *node;
+
+	if((node = new_tree(r)) == NULL) {
+		perror("bench: new_tree");
+		exit(EXIT_FAILURE);
+	}
+	node->state = *s;
+	return node;
+}
+
+
+struct BenchCtx {
+	const BaoState *pos;
+	int npos;
+	const BaoRules *rules;
+	int depth;
+	const SearchParams *params;
+	BaoTree *grown[CORPUS_SIZE];	/* pos[] already run through grow_tree */
+};
+
+
+typedef struct BenchCtx BenchCtx;
+
+
+static unsigned long long run_get_moves(BenchCtx *c)
+{
+	Move buf[MAXMOVES];
+	BaoState s;
+	int i;
+
+	for(i = 0; i < c->npos; i++) {
+		s = c->pos[i];
+		get_moves(buf, MAXMOVES, &s, c->rules);
+	}
+	return c->npos;
+}
+
+
+static unsigned long long run_run_move(BenchCtx *c)
+{
+	Move buf[MAXMOVES];
+	BaoState base, s;
+	Hand *hand;
+	int i, j, nmoves;
+	unsigned long long ops = 0;
+
+	for(i = 0; i < c->npos; i++) {
+		base = c->pos[i];
+		/* get_moves() sets the takata flag the moves are executed with */
+		nmoves = get_moves(buf, MAXMOVES, &base, c->rules);
+		for(j = 0; j < nmoves; j++) {
+			s = base;
+			if((hand = start_move(&s, c->rules, &buf[j])) == NULL)
+				continue;
+			run_move(hand, c->rules);
+			end_move(hand);
+			ops++;
+		}
+	}
+	return ops;
+}
+
+
+static unsigned long long run_grow_tree(BenchCtx *c)
+{
+	BaoTree *node;
+	int i;
+
+	for(i = 0; i < c->npos; i++) {
+		node = node_from_state(&c->pos[i], c->rules);
+		grow_tree(node, c->rules);
+		free_tree(node);
+	}
+	return c->npos;
+}
+
+
+/* grow_tree() on the generic engine, to compare with the specialised one */
+static unsigned long long run_grow_tree_generic(BenchCtx *c)
+{
+	const BaoEngine *generic = get_engine(NULL);
+	BaoTree *node;
+	int i;
+
+	for(i = 0; i < c->npos; i++) {
+		node = node_from_state(&c->pos[i], c->rules);
+		generic->grow_tree(node, c->rules);
+		free_tree(node);
+	}
+	return c->npos;
+}
+
+
+static unsigned long long run_eval_branch(BenchCtx *c)
+{
+	volatile int sink = 0;
+	int i;
+
+	for(i = 0; i < c->npos; i++)
+		sink += eval_branch(c->grown[i], c->pos[i].player);
+	return c->npos;
+}
+
+
+static unsigned long long run_best_branch(BenchCtx *c)
+{
+	BaoTree *node;
+	int i;
+
+	for(i = 0; i < c->npos; i++) {
+		node = node_from_state(&c->pos[i], c->rules);
+		best_branch_with(node, c->rules, c->depth, c->params);
+		free_tree(node);
+	}
+	return c->npos;
+}
+
+
+static unsigned long long run_playout(BenchCtx *c)
+{
+	PlayoutResult res;
+	int i, g;
+
+	for(i = 0; i < c->npos; i++)
+		for(g = 0; g < PLAYOUTS; g++)
+			playout(&c->pos[i], c->rules, g, PLAYOUT_PLIES, &res);
+	return c->npos * PLAYOUTS;
+}
+
+
+static unsigned long long run_playouts(BenchCtx *c)
+{
+	PlayoutResult res[PLAYOUTS];
+	int i;
+
+	for(i = 0; i < c->npos; i++)
+		playouts(&c->pos[i], c->rules, 0, PLAYOUTS, PLAYOUT_PLIES, res);
+	return c->npos * PLAYOUTS;
+}
+
+
+typedef unsigned long long (*BenchFunc)(BenchCtx *);
+
+
+struct Bench {
+	const char *name;
+	BenchFunc run;
+	int min_depth;
+	int max_depth;
+	const SearchParams *params;		/* best_branch_with() params if any */
+};
+
+
+/* Plain alpha-beta, for comparing against the default search */
+static const SearchParams plain_params = {
+	0,		/* quiescence */
+	0,		/* max_qdepth */
+	0,		/* pvs */
+	0,		/* lmr */
+	0,		/* lmr_min_depth */
+	0,		/* lmr_min_move */
+	0,		/* lmr_reduction */
+	0,		/* tt */
+	0,		/* keep_tree */
+	0		/* lazy */
+};
+
+
+/* Quiescence without the pvs/lmr shortcuts */
+static const SearchParams qsearch_params = {
+	1,		/* quiescence */
+	8,		/* max_qdepth */
+	0,		/* pvs */
+	0,		/* lmr */
+	0,		/* lmr_min_depth */
+	0,		/* lmr_min_move */
+	0,		/* lmr_reduction */
+	0,		/* tt */
+	0,		/* keep_tree */
+	0		/* lazy */
+};
+
+
+/* The default search growing every node it visits */
+static const SearchParams eager_params = {
+	1,		/* quiescence */
+	8,		/* max_qdepth */
+	1,		/* pvs */
+	1,		/* lmr */
+	3,		/* lmr_min_depth */
+	3,		/* lmr_min_move */
+	1,		/* lmr_reduction */
+	1,		/* tt */
+	0,		/* keep_tree */
+	0		/* lazy */
+};
+
+
+static const struct Bench benches[] = {
+	{"get_moves",   run_get_moves,   0, 0},
+	{"run_move",    run_run_move,    0, 0},
+	{"grow_tree",   run_grow_tree,   0, 0},
+	{"grow_tree_generic", run_grow_tree_generic, 0, 0},
+	{"eval_branch", run_eval_branch, 0, 0},
+	{"playout",     run_playout,     0, 0},
+	{"playouts",    run_playouts,    0, 0},
+	{"best_branch", run_best_branch, 1, MAX_DEPTH, &default_search_params},
+	{"best_branch_eager", run_best_branch, 1, MAX_DEPTH, &eager_params},
+	{"best_branch_qsearch", run_best_branch, 1, MAX_DEPTH, &qsearch_params},
+	{"best_branch_plain", run_best_branch, 1, MAX_DEPTH, &plain_params}
+};
+
+
+static void run_bench(const struct Bench *b, const char *variant,
+		const char *stage, BenchCtx *c)
+{
+	unsigned long long start, elapsed, ops, allocs, reps, i;
+	BaoStats before, after;
+
+	/* Warm up, then double the repetitions until min_ns is reached */
+	c->params = b->params;
+	b->run(c);
+	reps = 1;
+	for(;;) {
+		ops = 0;
+		allocs = nallocs;
+		stats_collect(&before);
+		start = stats_now_ns();
+		for(i = 0; i < reps; i++)
+			ops += b->run(c);
+		elapsed = stats_now_ns() - start;
+		stats_collect(&after);
+		allocs = nallocs - allocs;
+		if(elapsed >= min_ns || reps >= (1ULL << 30))
+			break;
+		reps *= 2;
+	}
+	if(ops == 0)
+		return;
+	printf("%s,%s,%s,%d,%llu,%.1f,%.1f,%.2f,%.1f\n", b->name, variant,
+			stage, c->depth, ops, (double) elapsed / ops,
+			ops * 1e9 / (elapsed ? elapsed : 1), (double) allocs / ops,
+			(double) (after.nodes - before.nodes) / ops);
+	fflush(stdout);
+}
+
+
+static void run_stage(const char *variant, const char *stage,
+		const BaoState *pos, int npos, const BaoRules *r)
+{
+	BenchCtx ctx;
+	size_t b;
+	int i;
+
+	ctx.pos = pos;
+	ctx.npos = npos;
+	ctx.rules = r;
+	for(i = 0; i < npos; i++) {
+		ctx.grown[i] = node_from_state(&pos[i], r);
+		grow_tree(ctx.grown[i], r);
+	}
+	for(b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+		if(filter != NULL && strstr(benches[b].name, filter) == NULL)
+			continue;
+		for(ctx.depth = benches[b].min_depth;
+				ctx.depth <= benches[b].max_depth; ctx.depth++)
+			run_bench(&benches[b], variant, stage, &ctx);
+	}
+	for(i = 0; i < npos; i++)
+		free_tree(ctx.grown[i]);
+}
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t min_ms_per_bench] [-f name_filter]\n",
+			prog);
+	exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+	Corpus corpus;
+	int opt, v, stage;
+
+	while((opt = getopt(argc, argv, "t:f:")) != -1) {
+		switch(opt) {
+			case 't':
+				min_ns = strtoull(optarg, NULL, 10) * 1000000ULL;
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	srand(1);
+	printf("bench,variant,stage,depth,ops,ns_per_op,ops_per_sec,"
+			"allocs_per_op,nodes_per_op\n");
+	for(v = 0; v < NRULES; v++) {
+		build_corpus(&corpus, &rules[v]);
+		for(stage = 0; stage < NSTAGES; stage++)
+			if(corpus.npos[stage])
+				run_stage(rules_names[v], stage_names[stage],
+						corpus.pos[stage], corpus.npos[stage], &rules[v]);
+	}
+	exit(EXIT_SUCCESS);
+}
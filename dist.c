@@ -0,0 +1,560 @@
+/******************************************************************************
+ *	dist.c: Search split over worker processes
+ *
+ *		The coordinator (dist_best_branch) grows the tree split_depth plies
+ *		itself and hands each position at that depth to a worker as a work
+ *		unit. Workers (dist_worker) search their unit with search_score()
+ *		and send the score back, the coordinator then backs the scores up
+ *		to the root with plain negamax.
+ *
+ *		There is one Unix socket pair per worker. Workers are either forked
+ *		or started through a shell command, so they can just as well run on
+ *		another host (over ssh) as long as it runs the same build. A worker
+ *		that dies or talks garbage is replaced and its unit handed out
+ *		again.
+ *
+ *		Messages, integers are little endian:
+ *			hello	coordinator -> worker, once: "BAOD", version (4), the
+ *					BaoRules (board_setting NHOLES x 1, then the other
+ *					fields 4 each) and the SearchParams fields (4 each),
+ *					all in declaration order. DIST_VERSION goes up
+ *					whenever this changes.
+ *			unit	coordinator -> worker: id (4), depth (1), pack_state()
+ *			result	worker -> coordinator: id (4), score (4), nodes (8)
+ *****************************************************************************/
+
+#include "dist.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define DIST_MAGIC "BAOD"
+
+
+enum {
+	DIST_VERSION = 2,
+	NRULE_INTS   = 4,	/* BaoRules fields after board_setting */
+	NPARAM_INTS  = 10,	/* SearchParams fields */
+	HELLO_SIZE   = 8 + NHOLES + 4 * (NRULE_INTS + NPARAM_INTS),
+	UNIT_SIZE    = 5 + PACKED_STATE_SIZE,
+	RESULT_SIZE  = 16
+};
+
+
+struct DistHello {
+	uint32_t version;
+	BaoRules rules;
+	SearchParams params;
+};
+
+
+struct DistUnit {
+	unsigned char state[PACKED_STATE_SIZE];	/* Position to search */
+	int depth;			/* Plies left to search it to */
+	int score;			/* For node's side to move, once done */
+	int tries;			/* Workers lost while searching it */
+};
+
+
+struct DistWorker {
+	pid_t pid;			/* 0 for an empty slot */
+	int fd;
+	int unit;			/* Unit being searched, -1 if idle */
+};
+
+
+struct Dist {
+	/* Everything one dist_best_branch() call works on */
+	const BaoRules *rules;
+	const SearchParams *params;
+	const DistConfig *cfg;
+	int split;
+	struct DistUnit *unit;
+	int nunits;
+	int *pending;		/* Stack of units not handed out (again) yet */
+	int npending;
+	int restarts;
+	int failed;			/* back_up() could not grow the tree */
+	struct DistWorker worker[DIST_MAX_WORKERS];
+};
+
+
+typedef struct DistHello DistHello;
+
+typedef struct DistUnit DistUnit;
+
+typedef struct DistWorker DistWorker;
+
+typedef struct Dist Dist;
+
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+	put_u32(p, v);
+	put_u32(p + 4, v >> 32);
+}
+
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return get_u32(p) | (uint64_t) get_u32(p + 4) << 32;
+}
+
+
+/* A new field has to go into the hello too, and DIST_VERSION up */
+_Static_assert(sizeof(SearchParams) == NPARAM_INTS * sizeof(int)
+		&& sizeof(BaoRules) == sizeof(unsigned int) * NHOLES
+		+ NRULE_INTS * sizeof(int), "hello out of date");
+
+
+/* Writes hello as it goes over the wire, HELLO_SIZE bytes */
+static void put_hello(unsigned char *p, const DistHello *hello)
+{
+	const BaoRules *r = &hello->rules;
+	const SearchParams *sp = &hello->params;
+	const int ints[NRULE_INTS + NPARAM_INTS] = {
+		r->has_nyumba, r->has_mtaji_moja_trap,
+		r->max_nkhomo_for_mtaji_capture, r->min_nkhomo_for_namua_special,
+		sp->quiescence, sp->max_qdepth, sp->pvs, sp->lmr, sp->lmr_min_depth,
+		sp->lmr_min_move, sp->lmr_reduction, sp->tt, sp->keep_tree,
+		sp->lazy
+	};
+	int i;
+
+	memcpy(p, DIST_MAGIC, 4);
+	put_u32(p + 4, hello->version);
+	p += 8;
+	for(i = 0; i < NHOLES; i++)
+		*p++ = r->board_setting[i];
+	for(i = 0; i < NRULE_INTS + NPARAM_INTS; i++, p += 4)
+		put_u32(p, ints[i]);
+}
+
+
+/* Reads what put_hello() wrote. Returns: 0, or -1 if it is not a hello */
+static int get_hello(DistHello *hello, const unsigned char *p)
+{
+	BaoRules *r = &hello->rules;
+	SearchParams *sp = &hello->params;
+	int *ints[NRULE_INTS + NPARAM_INTS] = {
+		&r->has_nyumba, &r->has_mtaji_moja_trap,
+		&r->max_nkhomo_for_mtaji_capture, &r->min_nkhomo_for_namua_special,
+		&sp->quiescence, &sp->max_qdepth, &sp->pvs, &sp->lmr,
+		&sp->lmr_min_depth, &sp->lmr_min_move, &sp->lmr_reduction, &sp->tt,
+		&sp->keep_tree, &sp->lazy
+	};
+	int i;
+
+	if(memcmp(p, DIST_MAGIC, 4) != 0)
+		return -1;
+	memset(hello, 0, sizeof(DistHello));
+	hello->version = get_u32(p + 4);
+	p += 8;
+	for(i = 0; i < NHOLES; i++)
+		r->board_setting[i] = *p++;
+	for(i = 0; i < NRULE_INTS + NPARAM_INTS; i++, p += 4)
+		*ints[i] = (int32_t) get_u32(p);
+	return 0;
+}
+
+
+/* Returns: 1 once all of buf is read, 0 on end of file before the first
+ * byte, else -1 */
+static int read_full(int fd, void *buf, size_t n)
+{
+	unsigned char *p = (unsigned char *) buf;
+	ssize_t k;
+
+	while(n) {
+		k = read(fd, p, n);
+		if(k == -1 && errno == EINTR)
+			continue;
+		if(k <= 0)
+			return k == 0 && p == (unsigned char *) buf ? 0 : -1;
+		p += k;
+		n -= k;
+	}
+	return 1;
+}
+
+
+/* Sockets are written with MSG_NOSIGNAL so a dead worker can't SIGPIPE us */
+static int write_full(int fd, const void *buf, size_t n)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+	ssize_t k;
+
+	while(n) {
+		k = send(fd, p, n, MSG_NOSIGNAL);
+		if(k == -1 && errno == ENOTSOCK)
+			k = write(fd, p, n);
+		if(k == -1 && errno == EINTR)
+			continue;
+		if(k <= 0)
+			return -1;
+		p += k;
+		n -= k;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * spawn_worker: Starts a worker in slot and sends it the hello.
+ *
+ * Returns: 0 on success else -1 (slot stays empty)
+ *****************************************************************************/
+static int spawn_worker(Dist *d, int slot)
+{
+	DistWorker *w = &d->worker[slot];
+	DistHello hello;
+	unsigned char buf[HELLO_SIZE];
+	char num[16];
+	int sv[2], i;
+	pid_t pid;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		return -1;
+	fflush(NULL);
+	if((pid = fork()) == -1) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if(pid == 0) {
+		close(sv[0]);
+		for(i = 0; i < d->cfg->nworkers; i++)
+			if(d->worker[i].pid)
+				close(d->worker[i].fd);
+		if(d->cfg->worker_cmd == NULL)
+			_exit(dist_worker(sv[1], sv[1]) == 0 ? EXIT_SUCCESS
+					: EXIT_FAILURE);
+		if(dup2(sv[1], STDIN_FILENO) == -1
+		|| dup2(sv[1], STDOUT_FILENO) == -1)
+			_exit(EXIT_FAILURE);
+		close(sv[1]);
+		snprintf(num, sizeof(num), "%d", slot);
+		setenv("BAO_WORKER", num, 1);
+		execl("/bin/sh", "sh", "-c", d->cfg->worker_cmd, (char *) NULL);
+		_exit(127);
+	}
+	close(sv[1]);
+	hello.version = DIST_VERSION;
+	hello.rules = *d->rules;
+	hello.params = *d->params;
+	put_hello(buf, &hello);
+	if(write_full(sv[0], buf, HELLO_SIZE) == -1) {
+		close(sv[0]);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	w->pid = pid;
+	w->fd = sv[0];
+	w->unit = -1;
+	return 0;
+}
+
+
+/* Ends the worker in slot, closing its socket is all a healthy one needs */
+static void stop_worker(Dist *d, int slot, int force)
+{
+	DistWorker *w = &d->worker[slot];
+
+	close(w->fd);
+	if(force)
+		kill(w->pid, SIGKILL);
+	waitpid(w->pid, NULL, 0);
+	w->pid = 0;
+}
+
+
+/*****************************************************************************
+ * lose_worker: Gets rid of a worker that died or misbehaved.
+ *
+ *		Its unit goes back on the pending stack and another worker takes
+ *		the slot, as long as cfg->max_restarts allows.
+ *
+ * Returns: 0, or -1 if the unit has now taken down DIST_MAX_TRIES workers
+ *****************************************************************************/
+static int lose_worker(Dist *d, int slot)
+{
+	DistWorker *w = &d->worker[slot];
+	int unit = w->unit;
+
+	stop_worker(d, slot, 1);
+	if(unit >= 0) {
+		if(++d->unit[unit].tries >= DIST_MAX_TRIES)
+			return -1;
+		d->pending[d->npending++] = unit;
+	}
+	if(d->restarts < d->cfg->max_restarts) {
+		d->restarts++;
+		spawn_worker(d, slot);
+	}
+	return 0;
+}
+
+
+/* Grows node down to split_depth, every node there becomes a unit */
+static int add_units(Dist *d, BaoTree *node, int ply, int depth)
+{
+	DistUnit *grown;
+	unsigned int i;
+
+	if(ply == d->split) {
+		if((d->nunits & (d->nunits + 1)) == 0) {	/* 0, 1, 3, 7... */
+			grown = (DistUnit *) realloc(d->unit,
+					2 * (d->nunits + 1) * sizeof(DistUnit));
+			if(grown == NULL)
+				return -1;
+			d->unit = grown;
+		}
+		pack_state(d->unit[d->nunits].state, &node->state);
+		d->unit[d->nunits].depth = depth - ply;
+		d->unit[d->nunits].tries = 0;
+		d->nunits++;
+		return 0;
+	}
+	if(grow_tree(node, d->rules) == -1)
+		return -1;
+	for(i = 0; i < node->nchildren; i++)
+		if(add_units(d, &node->children[i], ply + 1, depth) == -1)
+			return -1;
+	return 0;
+}
+
+
+static int run_units(Dist *d)
+{
+	struct pollfd pfd[DIST_MAX_WORKERS];
+	int slot_of[DIST_MAX_WORKERS];
+	unsigned char buf[UNIT_SIZE > RESULT_SIZE ? UNIT_SIZE : RESULT_SIZE];
+	DistWorker *w;
+	int i, n, alive, ndone, unit;
+
+	ndone = 0;
+	while(ndone < d->nunits) {
+		alive = 0;
+		n = 0;
+		for(i = 0; i < d->cfg->nworkers; i++) {
+			w = &d->worker[i];
+			if(w->pid && w->unit == -1 && d->npending) {
+				unit = d->pending[--d->npending];
+				put_u32(buf, unit);
+				buf[4] = d->unit[unit].depth;
+				memcpy(buf + 5, d->unit[unit].state, PACKED_STATE_SIZE);
+				w->unit = unit;
+				if(write_full(w->fd, buf, UNIT_SIZE) == -1
+				&& lose_worker(d, i) == -1)
+					return -1;
+			}
+			if(w->pid == 0)
+				continue;
+			alive++;
+			if(w->unit >= 0) {
+				pfd[n].fd = w->fd;
+				pfd[n].events = POLLIN;
+				slot_of[n++] = i;
+			}
+		}
+		if(alive == 0 || n == 0) {
+			errno = ECHILD;
+			return -1;
+		}
+		if(poll(pfd, n, -1) == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		for(i = 0; i < n; i++) {
+			if(pfd[i].revents == 0)
+				continue;
+			w = &d->worker[slot_of[i]];
+			if(read_full(w->fd, buf, RESULT_SIZE) != 1
+			|| get_u32(buf) != (uint32_t) w->unit) {
+				if(lose_worker(d, slot_of[i]) == -1)
+					return -1;
+				continue;
+			}
+			d->unit[w->unit].score = (int32_t) get_u32(buf + 4);
+			STATS_ADD(nodes, get_u64(buf + 8));
+			w->unit = -1;
+			ndone++;
+		}
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * back_up: Negamax over the coordinator's part of the tree.
+ *
+ *		Units are consumed in the order add_units() made them. Nodes are
+ *		grown again in case the tree budget evicted them meanwhile, which
+ *		gives back the same children in the same order.
+ *
+ * Returns: node's score, sets d->failed if node could not be grown
+ *****************************************************************************/
+static int back_up(Dist *d, BaoTree *node, int ply, int *next)
+{
+	unsigned int i;
+	int score, best;
+
+	if(ply == d->split)
+		return d->unit[(*next)++].score;
+	if(grow_tree(node, d->rules) == -1) {
+		d->failed = 1;
+		return 0;
+	}
+	if(node->nchildren == 0)
+		return eval_branch(node, node->state.player);
+	best = -back_up(d, &node->children[0], ply + 1, next);
+	for(i = 1; i < node->nchildren; i++) {
+		score = -back_up(d, &node->children[i], ply + 1, next);
+		if(score > best)
+			best = score;
+	}
+	return best;
+}
+
+
+/*****************************************************************************
+ * dist_best_branch: best_branch_with() run on cfg->nworkers processes.
+ *
+ *		The search below each unit is the same as in best_branch_with() but
+ *		units do not share alpha-beta bounds, so far more nodes get searched
+ *		in all. Pays off at depths where the serial search takes minutes.
+ *
+ * Returns: Path of the best child of node, or -1 on error (errno set).
+ *****************************************************************************/
+int dist_best_branch(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params, const DistConfig *cfg)
+{
+	Dist d;
+	unsigned long long start;
+	unsigned int i;
+	int slot, next, score, best, best_path, err;
+
+	if(cfg->nworkers < 1 || cfg->nworkers > DIST_MAX_WORKERS || depth < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	start = stats_now_ns();
+	memset(&d, 0, sizeof(d));
+	d.rules = rules;
+	d.params = params;
+	d.cfg = cfg;
+	/* Like best_branch_with(), depth is counted from node's children */
+	d.split = cfg->split_depth < 1 ? 1 : cfg->split_depth;
+	if(d.split > depth + 1)
+		d.split = depth + 1;
+	best_path = -1;
+	err = 0;
+	if(add_units(&d, node, 0, depth + 1) == -1
+	|| (d.pending = (int *) malloc((d.nunits + 1) * sizeof(int))) == NULL) {
+		err = errno;
+		goto out;
+	}
+	for(i = 0; i < d.nunits; i++)
+		d.pending[i] = d.nunits - 1 - i;	/* First unit on top */
+	d.npending = d.nunits;
+	for(slot = 0; slot < cfg->nworkers; slot++)
+		spawn_worker(&d, slot);
+	if(run_units(&d) == -1) {
+		err = errno;
+	} else {
+		next = 0;
+		best = 0;
+		if(grow_tree(node, rules) == -1)
+			d.failed = 1;
+		for(i = 0; i < node->nchildren && !d.failed; i++) {
+			score = -back_up(&d, &node->children[i], 1, &next);
+			if(best_path == -1 || score > best) {
+				best = score;
+				best_path = i;
+			}
+		}
+		if(d.failed)
+			err = errno ? errno : ENOMEM;
+	}
+	for(slot = 0; slot < cfg->nworkers; slot++)
+		if(d.worker[slot].pid)
+			stop_worker(&d, slot, err != 0);
+out:
+	for(i = 0; i < node->nchildren; i++)
+		prune_tree(&node->children[i]);
+	free(d.unit);
+	free(d.pending);
+	STATS_ADD(search_ns, stats_now_ns() - start);
+	errno = err;
+	return err ? -1 : best_path;
+}
+
+
+/*****************************************************************************
+ * dist_worker: Serves work units read from in_fd until end of file.
+ *
+ * Returns: 0 once the coordinator hangs up, -1 on error.
+ *****************************************************************************/
+int dist_worker(int in_fd, int out_fd)
+{
+	DistHello hello;
+	BaoTree *node;
+	BaoStats before, after;
+	unsigned char unit[UNIT_SIZE], result[RESULT_SIZE], buf[HELLO_SIZE];
+	int r, score;
+
+	if(read_full(in_fd, buf, HELLO_SIZE) != 1 || get_hello(&hello, buf) == -1
+	|| hello.version != DIST_VERSION) {
+		errno = EPROTO;
+		return -1;
+	}
+	if((node = new_tree(&hello.rules)) == NULL)
+		return -1;
+	while((r = read_full(in_fd, unit, UNIT_SIZE)) == 1) {
+		/* Whatever the last unit grew is of another position */
+		prune_tree(node);
+		node->best = NO_PATH;
+		node->score = 0;
+		unpack_state(&node->state, unit + 5);
+		stats_collect(&before);
+		score = search_score(node, &hello.rules, unit[4], &hello.params);
+		stats_collect(&after);
+		memcpy(result, unit, 4);
+		put_u32(result + 4, score);
+		put_u64(result + 8, after.nodes - before.nodes);
+		if(write_full(out_fd, result, RESULT_SIZE) == -1) {
+			r = -1;
+			break;
+		}
+	}
+	free_tree(node);
+	return r;
+}
@@ -0,0 +1,44 @@
+#ifndef BAODIST_H
+#define BAODIST_H
+
+#include "eval.h"
+#include "tree.h"
+
+
+enum {
+	DIST_MAX_WORKERS = 64,	/* Workers a single search may run */
+	DIST_MAX_TRIES   = 3	/* Workers a work unit may take down with it */
+};
+
+
+struct DistConfig {
+	/* How dist_best_branch() splits up its search */
+
+	int nworkers;
+	/* Worker processes to run, at most DIST_MAX_WORKERS. */
+
+	int split_depth;
+	/* Plies the coordinator expands itself, every position at this depth
+	 * becomes one work unit. */
+
+	int max_restarts;
+	/* Workers that may be started to replace ones that died. */
+
+	const char *worker_cmd;
+	/* NULL to fork() the workers, else a sh -c command that runs a worker
+	 * on its stdin and stdout (e.g. "ssh host bao/main --worker"). The
+	 * worker's slot number is passed on in $BAO_WORKER. */
+};
+
+
+typedef struct DistConfig DistConfig;
+
+
+int dist_best_branch(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params, const DistConfig *cfg);
+
+
+int dist_worker(int in_fd, int out_fd);
+
+
+#endif /* BAODIST_H */
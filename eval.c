@@ -1,71 +1,826 @@
 #include "eval.h"
+#include "eval_weights.h"
 #include "error.h"
+#include "stats.h"
 #include "tree.h"
+#include "tt.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 
-static int get_best_score(Player, BaoTree*, const BaoRules*, int);
+enum {
+	INF_SCORE   = 1000,	/* Bigger than any score eval_branch() can give */
+	SEARCH_TICK = 1024,	/* Nodes between looks at the clock (power of 2) */
+	REPORT_MS   = 100	/* Least time between two progress callbacks */
+};
+
+
+struct Search {
+	/* What a single best_branch() call passes down the tree */
+	const BaoEngine *engine;
+	const BaoRules *rules;
+	const SearchParams *params;
+	unsigned long long nodes;	/* Counted even without stats */
+	struct SearchJob *job;		/* NULL unless run by search_start() */
+	int aborted;				/* job was cancelled, scores are void */
+	uint64_t tt_salt;			/* Keeps rule sets apart in the table */
+	uint32_t tt_generation;		/* See tt_new_search */
+};
+
+
+struct SearchJob {
+	/* A search running on its own thread, see search_start() */
+	pthread_t thread;
+	int threaded;				/* Has thread, see search_start() */
+	BaoTree *node;
+	const BaoRules *rules;
+	SearchParams params;
+	int max_depth;
+	SearchCallback callback;
+	void *arg;
+	int cancel;					/* Set by search_cancel() */
+	int done;					/* Set once the thread is about to exit */
+	SearchProgress progress;	/* Owned by the search thread */
+	unsigned long long start_ns;
+	unsigned long long report_ns;	/* When callback was last called */
+};
+
+
+typedef struct Search Search;
+
+
+const SearchParams default_search_params = {
+	1,		/* quiescence */
+	8,		/* max_qdepth */
+	1,		/* pvs */
+	1,		/* lmr */
+	3,		/* lmr_min_depth */
+	3,		/* lmr_min_move */
+	1,		/* lmr_reduction */
+	1,		/* tt */
+	0,		/* keep_tree */
+	1		/* lazy */
+};
+
+
+/* Takata cutoff counts, used to order takata children (see order_children).
+ * One table per thread, searches running side by side keep out of each
+ * other's way. */
+static __thread unsigned int history[NPLAYERS][NHOLES][2];
+
+#define HISTORY(p, m) (history[p][(m).hole][(m).dir == MXD_RIGHT])
+
+/* Move of entry e of an ordering, see order_children */
+#define ORDER_MOVE(node, moves, e) \
+	((e) < MAXTRANS ? &(node)->children[e].move : &(moves)[(e) - MAXTRANS])
+
+
+static int negamax(Search*, BaoTree*, int, int, int, int);
+
+static int order_children(const BaoTree*, int, const Move*, int,
+		unsigned char*);
+
+static int search_child(Search*, const BaoTree*, int, int, int, int, int, int);
+
+
+/* Copies the calling thread's history table out, SEARCH_HISTORY_SIZE long */
+void search_get_history(unsigned int *buf)
+{
+	memcpy(buf, history, sizeof(history));
+}
+
+
+/* Replaces the calling thread's history table, see search_get_history() */
+void search_set_history(const unsigned int *buf)
+{
+	memcpy(history, buf, sizeof(history));
+}
+
 
-// TODO: Use minimax/negamax with alpha - beta  pruning
 int best_branch(BaoTree *node, const BaoRules *rules, int depth)
 {
-	int i, best_path, max_score, score;
+	return best_branch_with(node, rules, depth, &default_search_params);
+}
+
+
+/* FNV-1a of the rules, mixed into the table keys (see negamax) */
+static uint64_t rules_salt(const BaoRules *rules)
+{
+	const unsigned char *p = (const unsigned char *) rules;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for(i = 0; i < sizeof(*rules); i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
 
-	if(grow_tree(node, rules) == -1)
+static void init_search(Search *s, const BaoRules *rules,
+		const SearchParams *params, SearchJob *job)
+{
+	/* Looked up once, the whole search then runs on the specialised code */
+	s->engine = get_engine(rules);
+	s->rules = rules;
+	s->params = params;
+	s->nodes = 0;
+	s->job = job;
+	s->aborted = 0;
+	s->tt_salt = params->tt ? rules_salt(rules) : 0;
+	s->tt_generation = params->tt ? tt_new_search() : 0;
+}
+
+
+/*****************************************************************************
+ * search_root: Searches each of node's children depth plies deep.
+ *
+ *		Child first (if not -1) is searched ahead of the others.
+ *
+ * Returns: Path of the best child (its score in score_p), -1 if node has no
+ *			children, or if the search was aborted.
+ *****************************************************************************/
+static int search_root(Search *s, BaoTree *node, int depth, int first,
+		int *score_p)
+{
+	unsigned char order[MAXTRANS];
+	int i, n, best_path, alpha, score;
+	int p, h;
+
+	s->nodes++;
+	STATS_INC(nodes);
+	if(s->engine->grow_tree(node, s->rules) == -1)
 		return -1;
+	STATS_INC(expanded[0]);
+	STATS_ADD(branches[0], node->nchildren);
+	/* Age the history so older searches count less */
+	for(p = 0; p < NPLAYERS; p++)
+		for(h = 0; h < NHOLES; h++) {
+			history[p][h][0] /= 2;
+			history[p][h][1] /= 2;
+		}
 	best_path = -1;
-	max_score = -1000;
-	for(i = 0; i < node->nchildren; i++) {
-		score = get_best_score(node->state.player, node->children[i],
-				rules, depth);
-		if(score == max_score) {
-			best_path = (rand() * 10) % 2 ? best_path : i;
-		} else if(score > max_score) {
-			max_score = score;
-			best_path = i;
+	alpha = -INF_SCORE;
+	n = order_children(node, first, NULL, 0, order);
+	for(i = 0; i < n; i++) {
+		score = search_child(s, node, order[i], i, depth + 1, 0, alpha,
+				INF_SCORE);
+		if(s->aborted)
+			return -1;
+		if(score > alpha || best_path == -1) {
+			alpha = score;
+			best_path = order[i];
 		}
 	}
+	if(best_path != -1) {
+		node->best = best_path;
+		node->score = alpha;
+	}
+	*score_p = alpha;
+	return best_path;
+}
+
+
+int best_branch_with(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params)
+{
+	Search s;
+	unsigned long long start;
+	int best_path, score;
+
+	start = stats_now_ns();
+	init_search(&s, rules, params, NULL);
+	best_path = search_root(&s, node, depth, -1, &score);
+	STATS_ADD(search_ns, stats_now_ns() - start);
 	return best_path;
 }
 
-static int eval_branch(const BaoTree *node, Player player)
+
+/*****************************************************************************
+ * search_score: Searches node depth plies deep with a full window.
+ *
+ *		Same search as best_branch_with() runs under each root child, for
+ *		callers that split the tree up themselves (see dist.c).
+ *
+ * Returns: Score of node for its side to move.
+ *****************************************************************************/
+int search_score(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params)
+{
+	Search s;
+	unsigned long long start;
+	int score;
+
+	start = stats_now_ns();
+	init_search(&s, rules, params, NULL);
+	score = negamax(&s, node, depth, 0, -INF_SCORE, INF_SCORE);
+	STATS_ADD(search_ns, stats_now_ns() - start);
+	return score;
+}
+
+
+/*****************************************************************************
+ * eval_features: Describes state for the evaluation, see enum EvalFeature.
+ *
+ *		takata is only known once the side to move's moves have been
+ *		listed (grow_tree, get_moves), it reads 0 before.
+ *****************************************************************************/
+void eval_features(const BaoState *state, uint8_t *f)
+{
+	Player opp = state->player == P_NORTH ? P_SOUTH : P_NORTH;
+	int h;
+
+	for(h = 0; h < NHOLES; h++) {
+		f[EF_OWN_HOLES + h] = state->board[state->player][h];
+		f[EF_OPP_HOLES + h] = state->board[opp][h];
+	}
+	f[EF_OWN_NYUMBA] = state->nyumba[state->player] != 0;
+	f[EF_OPP_NYUMBA] = state->nyumba[opp] != 0;
+	f[EF_TAKATA] = state->takata != 0;
+	f[EF_TRAP] = state->trapped_hole >= H_LFKICHWA
+		&& state->trapped_hole <= H_RFKICHWA;
+	f[EF_NAMUA] = state->board[state->player][H_STORE] != 0;
+	f[EF_TEMPO] = 1;
+}
+
+
+/*****************************************************************************
+ * eval_state: Weighted eval_features() of state for the side to move, kept
+ *		short of WIN_SCORE whatever the weights.
+ *
+ *		Weighs the board in place instead of filling in the features, so
+ *		it has to follow eval_features() for the weights to mean the same.
+ *****************************************************************************/
+static int eval_state(const BaoState *state)
+{
+	const unsigned char *own = state->board[state->player];
+	const unsigned char *opp = state->board[state->player == P_NORTH
+		? P_SOUTH : P_NORTH];
+	int h, score;
+
+	score = eval_weights[EF_TEMPO]
+		+ eval_weights[EF_OWN_HOLES + H_STORE] * own[H_STORE]
+		+ eval_weights[EF_OPP_HOLES + H_STORE] * opp[H_STORE];
+	for(h = 0; h < H_STORE; h++)	/* 16 each, vectorises */
+		score += eval_weights[EF_OWN_HOLES + h] * own[h]
+			+ eval_weights[EF_OPP_HOLES + h] * opp[h];
+	if(state->nyumba[state->player])
+		score += eval_weights[EF_OWN_NYUMBA];
+	if(state->nyumba[state->player == P_NORTH ? P_SOUTH : P_NORTH])
+		score += eval_weights[EF_OPP_NYUMBA];
+	if(state->takata)
+		score += eval_weights[EF_TAKATA];
+	if(state->trapped_hole >= H_LFKICHWA && state->trapped_hole <= H_RFKICHWA)
+		score += eval_weights[EF_TRAP];
+	if(own[H_STORE])
+		score += eval_weights[EF_NAMUA];
+	score /= EVAL_WEIGHT_SCALE;
+	if(score >= WIN_SCORE)
+		return WIN_SCORE - 1;
+	return score <= -WIN_SCORE ? -WIN_SCORE + 1 : score;
+}
+
+
+/*****************************************************************************
+ * eval_branch: Scores a grown node for player.
+ *
+ *		A node without children is a decided game: the side to move is out
+ *		of moves (or has only never ending ones) and has lost.
+ *
+ * Returns: eval_state() of node for player, or -WIN_SCORE / WIN_SCORE if
+ *			node's game is over.
+ *****************************************************************************/
+int eval_branch(const BaoTree *node, Player player)
 {
-	Hole h;
 	int score;
 
 	if(node->nchildren == 0)
-		/* Best or worst that can happen. If node->state.player != player then
-		 * opponent is out of moves else it's player that's out of moves. */
-		return 0;
-	score = 0;
-	for(h = 0; h < H_STORE; h++)
-		score += node->state.board[node->state.player][h];
+		/* If node->state.player != player then opponent is out of moves
+		 * else it's player that's out of moves. */
+		return player == node->state.player ? -WIN_SCORE : WIN_SCORE;
+	score = eval_state(&node->state);
 	if(player != node->state.player)
 		score = -score;
 	return score;
 }
 
-static int get_best_score(Player player, BaoTree *node, const BaoRules *rules,
-		int depth)
+
+/*****************************************************************************
+ * eval_leaf: eval_branch() of node for its side to move, without growing it.
+ *
+ *		A node without children is only probed for moves, like quiesce()
+ *		does, so one not grown yet whose moves are all never ending scores
+ *		as if it had some. A staged one that ran out of moves to execute
+ *		is lost, as in eval_branch().
+ *****************************************************************************/
+static int eval_leaf(Search *s, const BaoTree *node)
 {
-	int i, score, best_score;
+	Move buf[MAXMOVES];
+	BaoState probe;
 
-	if(grow_tree(node, rules) == -1)
-		choke("get_best_score(): grow_tree_failed");
-	if(depth == 0)
-		return eval_branch(node, player);
-	best_score = 0;
-	for(i = 0; i < node->nchildren; i++) {
-		score = get_best_score(player, node->children[i], rules, depth - 1);
-		if(score > best_score)
-			best_score = score;
-		free_tree(node->children[i]);
-		node->children[i] = NULL;
+	if(node->nchildren == 0) {
+		if(node->children != NULL && staged_moves(node) == 0)
+			return -WIN_SCORE;	/* Staged, every move was never ending */
+		probe = node->state;
+		if(s->engine->get_moves(buf, MAXMOVES, &probe, s->rules) == 0)
+			return -WIN_SCORE;	/* Out of moves, see eval_branch() */
+		return eval_state(&probe);	/* With takata known */
 	}
-	node->nchildren = 0;
+	return eval_state(&node->state);
+}
+
+
+/* Calls job's callback with its progress, now_ns being the time now */
+static void report(SearchJob *job, const Search *s, unsigned long long now_ns)
+{
+	SearchProgress *p = &job->progress;
+
+	p->nodes = s->nodes;
+	p->elapsed_ns = now_ns - job->start_ns;
+	p->nodes_per_sec = p->elapsed_ns ? p->nodes * 1e9 / p->elapsed_ns : 0;
+	job->report_ns = now_ns;
+	if(job->callback != NULL)
+		job->callback(p, job->arg);
+}
+
+
+/*****************************************************************************
+ * search_aborted: Counts a node and checks if s has been cancelled.
+ *
+ *		Searches started with search_start() look at the cancel flag on
+ *		every node and at the clock every SEARCH_TICK nodes, to call the
+ *		progress callback every REPORT_MS.
+ *
+ * Returns: Non-zero if s must unwind, scores it returns from now on are void.
+ *****************************************************************************/
+static int search_aborted(Search *s)
+{
+	unsigned long long now;
+
+	s->nodes++;
+	if(s->job == NULL)
+		return 0;
+	if(__atomic_load_n(&s->job->cancel, __ATOMIC_RELAXED))
+		s->aborted = 1;
+	if((s->nodes & (SEARCH_TICK - 1)) == 0) {
+		now = stats_now_ns();
+		if(now - s->job->report_ns >= REPORT_MS * 1000000ULL)
+			report(s->job, s, now);
+	}
+	return s->aborted;
+}
+
+
+/* Aborts s if the tree failed to grow because s got cancelled, else chokes */
+static void search_failed(Search *s)
+{
+	if(s->job == NULL || errno != ECANCELED)
+		choke("grow_tree() failed");
+	s->aborted = 1;
+}
+
+
+/*****************************************************************************
+ * search_grow: Grows node, or stages it if s is lazy (see stage_tree).
+ *
+ * Returns: Moves of node left to execute (put in moves), or -1 if s got
+ *			cancelled while node was being grown.
+ *****************************************************************************/
+static int search_grow(Search *s, BaoTree *node, Move *moves)
+{
+	int n;
+
+	if(s->params->lazy)
+		n = stage_tree(node, s->rules, moves);
+	else
+		n = s->engine->grow_tree(node, s->rules) == -1 ? -1 : 0;
+	if(n == -1)
+		search_failed(s);
+	return n;
+}
+
+
+/*****************************************************************************
+ * visit_entry: Gets the children behind entry e of an ordering.
+ *
+ *		Entries below MAXTRANS are paths of children. The others stand for
+ *		moves left to execute on a staged node, the move is executed here.
+ *
+ * Returns: Path of the first of the children, their number in *count (0 if
+ *			the move led to no new child), -1 if s got cancelled.
+ *****************************************************************************/
+static int visit_entry(Search *s, BaoTree *node, const Move *moves, int e,
+		int *count)
+{
+	if(e < MAXTRANS) {
+		*count = 1;
+		return e;
+	}
+	if((*count = s->engine->grow_branch(node, s->rules,
+					&moves[e - MAXTRANS])) == -1) {
+		search_failed(s);
+		return -1;
+	}
+	return node->nchildren - *count;
+}
+
+
+/*****************************************************************************
+ * quiesce: Resolves pending captures past the nominal search depth.
+ *
+ *		Only nodes whose moves are captures get expanded (get_moves() only
+ *		returns takatas when there is nothing to capture). The side to move
+ *		may always stand pat on the static score instead of capturing.
+ *
+ * Returns: Score of node for the side to move.
+ *****************************************************************************/
+static int quiesce(Search *s, BaoTree *node, int ply, int qdepth, int alpha,
+		int beta)
+{
+	Move buf[MAXMOVES];
+	BaoState probe;
+	int i, j, n, nmoves, path, count, stand_pat, score;
+
+	if(search_aborted(s))
+		return 0;
+	STATS_INC(nodes);
+	STATS_INC(qnodes);
+	if(node->nchildren == 0) {
+		if(node->children != NULL && staged_moves(node) == 0)
+			return -WIN_SCORE;	/* Staged, every move was never ending */
+		/* Find out if it's quiet without executing any move */
+		probe = node->state;
+		if(s->engine->get_moves(buf, MAXMOVES, &probe, s->rules) == 0)
+			return -WIN_SCORE;	/* Out of moves, see eval_branch() */
+		if(probe.takata)
+			return eval_state(&probe);
+	} else if(node->state.takata) {
+		return eval_branch(node, node->state.player);
+	}
+	stand_pat = eval_state(&node->state);
+	if(stand_pat >= beta) {
+		STATS_INC(cutoffs);
+		return stand_pat;
+	}
+	if(qdepth >= s->params->max_qdepth)
+		return stand_pat;
+	if(stand_pat > alpha)
+		alpha = stand_pat;
+	if((nmoves = search_grow(s, node, buf)) == -1)
+		return 0;
+	/* Children in the order they were found, then moves left */
+	n = node->nchildren;
+	for(i = 0; i < n + nmoves && alpha < beta && !s->aborted; i++) {
+		path = visit_entry(s, node, buf, i < n ? i : MAXTRANS + i - n,
+				&count);
+		for(j = 0; j < count && alpha < beta && !s->aborted; j++) {
+			score = -quiesce(s, &node->children[path + j], ply + 1,
+					qdepth + 1, -beta, -alpha);
+			if(!s->aborted && score > alpha)
+				alpha = score;
+		}
+	}
+	if(node->nchildren == 0 && !s->aborted)
+		/* Every move was never ending, see negamax() */
+		alpha = -WIN_SCORE;
+	else if(alpha >= beta)
+		STATS_INC(cutoffs);
+	if(!s->params->keep_tree)
+		prune_tree(node);
+	return alpha;
+}
+
+
+/*****************************************************************************
+ * order_children: Fills order with the order node's children get searched in.
+ *
+ *		The nmoves moves a staged node has left to execute go after its
+ *		children, as entries MAXTRANS and up (see visit_entry). Entry
+ *		first (if not -1) goes ahead of the rest. Captures keep the order
+ *		get_moves() found them in. Takatas are sorted on how often they
+ *		caused a cutoff so far (see history).
+ *
+ * Returns: Number of entries in order
+ *****************************************************************************/
+static int order_children(const BaoTree *node, int first, const Move *moves,
+		int nmoves, unsigned char *order)
+{
+	unsigned int i, j, key, start, n, total;
+	unsigned char tmp, e;
+	Player p = node->state.player;
+
+	total = node->nchildren + nmoves;
+	n = 0;
+	if(first >= 0)
+		order[n++] = first;
+	for(i = 0; i < total; i++) {
+		e = i < node->nchildren ? i : MAXTRANS + i - node->nchildren;
+		if((int) e != first)
+			order[n++] = e;
+	}
+	start = first >= 0;		/* first stays in front */
+	if(!node->state.takata)
+		return total;
+	for(i = start + 1; i < total; i++) {
+		tmp = order[i];
+		key = HISTORY(p, *ORDER_MOVE(node, moves, tmp));
+		for(j = i; j > start
+				&& HISTORY(p, *ORDER_MOVE(node, moves, order[j - 1])) < key;
+				j--)
+			order[j] = order[j - 1];
+		order[j] = tmp;
+	}
+	return total;
+}
+
+
+/*****************************************************************************
+ * search_child: Scores child path of node, k being its place in the ordering.
+ *
+ *		Only the first child is searched with the full (alpha, beta) window.
+ *		The rest are probed with a null window when pvs is on and late
+ *		takatas may be probed at a reduced depth (lmr), either probe is
+ *		repeated without the shortcut when the child turns out to beat alpha.
+ *
+ * Returns: Score of the child from the point of view of node's side to move.
+ *****************************************************************************/
+static int search_child(Search *s, const BaoTree *node, int path, int k,
+		int depth, int ply, int alpha, int beta)
+{
+	const SearchParams *sp = s->params;
+	BaoTree *child = &node->children[path];
+	int score, reduction, probe_beta;
+
+	if(k == 0 || (!sp->pvs && !sp->lmr))
+		return -negamax(s, child, depth - 1, ply + 1, -beta, -alpha);
+	reduction = 0;
+	if(sp->lmr && node->state.takata && depth >= sp->lmr_min_depth
+	&& k >= sp->lmr_min_move) {
+		reduction = sp->lmr_reduction < depth - 1 ?
+			sp->lmr_reduction : depth - 1;
+		STATS_INC(reductions);
+	}
+	probe_beta = sp->pvs ? alpha + 1 : beta;
+	score = -negamax(s, child, depth - 1 - reduction, ply + 1, -probe_beta,
+			-alpha);
+	if(reduction && score > alpha) {
+		STATS_INC(researches);
+		score = -negamax(s, child, depth - 1, ply + 1, -probe_beta, -alpha);
+	}
+	if(probe_beta != beta && score > alpha && score < beta) {
+		STATS_INC(researches);
+		score = -negamax(s, child, depth - 1, ply + 1, -beta, -alpha);
+	}
+	return score;
+}
+
+
+/*****************************************************************************
+ * negamax: Alpha-beta search of node to depth plies.
+ *
+ *		With the transposition table on, a position already searched deep
+ *		enough (this search, this position or its mirror image) is not
+ *		searched again, else the best move found for it is tried first.
+ *
+ * Returns: Score of node for the side to move.
+ *****************************************************************************/
+static int negamax(Search *s, BaoTree *node, int depth, int ply, int alpha,
+		int beta)
+{
+	unsigned char order[MAXTRANS];
+	Move moves[MAXMOVES];
+	int i, j, n, k, nmoves, path, count;
+	int score, best_score, best_path, first, mirrored, alpha_in;
+	TTEntry entry;
+	Move tt_move;
+	TTBound bound;
+	uint64_t key = 0;
+
+	if(depth == 0 && s->params->quiescence)
+		return quiesce(s, node, ply, 0, alpha, beta);
+	if(search_aborted(s))
+		return 0;
+	STATS_INC(nodes);
+	first = -1;
+	mirrored = 0;
+	if(s->params->tt && depth > 0) {
+		/* The same position plays out differently under other rules */
+		key = canon_hash(&node->state, &mirrored) ^ s->tt_salt;
+		if(tt_probe(key, mirrored, s->tt_generation, &entry, &tt_move)) {
+			if(entry.depth >= depth && (entry.bound == TT_EXACT
+			|| (entry.bound == TT_LOWER && entry.score >= beta)
+			|| (entry.bound == TT_UPPER && entry.score <= alpha)))
+				return entry.score;
+			first = 0;
+		}
+	}
+	if(depth == 0 && s->params->lazy)
+		return eval_leaf(s, node);
+	if((nmoves = search_grow(s, node, moves)) == -1)
+		return 0;
+	if(depth == 0 || node->nchildren + nmoves == 0)
+		return eval_branch(node, node->state.player);
+	STATS_INC(expanded[STATS_PLY(ply)]);
+	STATS_ADD(branches[STATS_PLY(ply)], node->nchildren + nmoves);
+	if(first == 0) {
+		first = find_branch(node, &tt_move);
+		for(i = 0; first == -1 && i < nmoves; i++)
+			if(moves[i].hole == tt_move.hole && moves[i].dir == tt_move.dir)
+				first = MAXTRANS + i;
+	}
+	alpha_in = alpha;
+	best_score = -INF_SCORE;
+	best_path = 0;
+	n = order_children(node, first, moves, nmoves, order);
+	for(i = k = 0; i < n && alpha < beta; i++) {
+		path = visit_entry(s, node, moves, order[i], &count);
+		for(j = 0; j < count && alpha < beta; j++, k++) {
+			score = search_child(s, node, path + j, k, depth, ply, alpha,
+					beta);
+			if(s->aborted)
+				break;
+			if(score > best_score) {
+				best_score = score;
+				best_path = path + j;
+			}
+			if(best_score > alpha)
+				alpha = best_score;
+		}
+		if(s->aborted) {
+			if(!s->params->keep_tree)
+				prune_tree(node);
+			return 0;
+		}
+	}
+	if(k == 0) {
+		/* Every move left was never ending */
+		if(!s->params->keep_tree)
+			prune_tree(node);
+		return eval_branch(node, node->state.player);
+	}
+	if(alpha >= beta) {
+		STATS_INC(cutoffs);
+		if(node->state.takata)
+			HISTORY(node->state.player, node->children[best_path].move)
+				+= depth * depth;
+	}
+	if(s->params->tt) {
+		if(best_score <= alpha_in)
+			bound = TT_UPPER;
+		else if(best_score >= beta)
+			bound = TT_LOWER;
+		else
+			bound = TT_EXACT;
+		tt_store(key, mirrored, s->tt_generation, depth, best_score, bound,
+				&node->children[best_path].move);
+	}
+	node->best = best_path;
+	node->score = best_score;
+	if(!s->params->keep_tree)
+		prune_tree(node);
 	return best_score;
 }
 
 
+/*****************************************************************************
+ * search_run: Runs job on the calling thread, see search_prepare().
+ *
+ *		Iterative deepening from depth 0 up to job->max_depth.
+ *****************************************************************************/
+void search_run(SearchJob *job)
+{
+	SearchProgress *p = &job->progress;
+	Search s;
+	int depth, path, score;
+
+	job->start_ns = stats_now_ns();
+	job->report_ns = job->start_ns;
+	/* One table for all depths, each depth tries the moves found by the
+	 * last one first */
+	init_search(&s, job->rules, &job->params, job);
+	set_cancel_flag(&job->cancel);
+	for(depth = 0; depth <= job->max_depth; depth++) {
+		p->searching = depth;
+		path = search_root(&s, job->node, depth, p->best_path, &score);
+		if(path == -1)
+			break;
+		p->depth = depth;
+		p->best_path = path;
+		p->score = score;
+		if(depth < job->max_depth)
+			report(job, &s, stats_now_ns());
+	}
+	set_cancel_flag(NULL);
+	p->done = 1;
+	STATS_ADD(search_ns, stats_now_ns() - job->start_ns);
+	report(job, &s, stats_now_ns());
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+}
+
+
+static void *search_thread(void *arg)
+{
+	search_run((SearchJob *) arg);
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * search_prepare: Sets up a search of node for search_run().
+ *
+ *		For callers that bring their own threads (see server.c), else see
+ *		search_start(). The job can be cancelled from any thread, but only
+ *		search_wait()ed for once search_run() has returned.
+ *
+ * Returns: The job, or NULL if out of memory.
+ *****************************************************************************/
+SearchJob *search_prepare(BaoTree *node, const BaoRules *rules, int max_depth,
+		const SearchParams *params, SearchCallback callback, void *arg)
+{
+	SearchJob *job;
+
+	if((job = (SearchJob *) calloc(1, sizeof(SearchJob))) == NULL)
+		return NULL;
+	job->node = node;
+	job->rules = rules;
+	job->params = *params;
+	job->max_depth = max_depth;
+	job->callback = callback;
+	job->arg = arg;
+	job->progress.depth = -1;
+	job->progress.best_path = -1;
+	return job;
+}
+
+
+/*****************************************************************************
+ * search_start: Starts searching node on a thread of its own.
+ *
+ *		The search deepens one ply at a time up to max_depth (as passed to
+ *		best_branch), callback gets called from the search thread after
+ *		each depth, every REPORT_MS while one runs and once more when the
+ *		search ends. It should return quickly.
+ *
+ *		node belongs to the search until search_wait() returns. Searches
+ *		running at once share the transposition table, see tt_set_shared().
+ *
+ * Returns: A handle for search_cancel/search_done/search_wait, else NULL
+ *			(errno set).
+ *****************************************************************************/
+SearchJob *search_start(BaoTree *node, const BaoRules *rules, int max_depth,
+		const SearchParams *params, SearchCallback callback, void *arg)
+{
+	SearchJob *job;
+	int err;
 
+	if((job = search_prepare(node, rules, max_depth, params, callback,
+					arg)) == NULL)
+		return NULL;
+	job->threaded = 1;
+	if((err = pthread_create(&job->thread, NULL, search_thread, job))) {
+		free(job);
+		errno = err;
+		return NULL;
+	}
+	return job;
+}
+
+
+/* The search unwinds within a few nodes, search_wait() still has to be
+ * called to collect it */
+void search_cancel(SearchJob *job)
+{
+	__atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Returns: Non-zero once search_wait() would not block */
+int search_done(SearchJob *job)
+{
+	return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+
+/*****************************************************************************
+ * search_wait: Waits for job to end and frees it.
+ *
+ *		progress (if not NULL) gets the final progress report.
+ *
+ * Returns: The best path from the deepest depth completed, -1 if none was.
+ *****************************************************************************/
+int search_wait(SearchJob *job, SearchProgress *progress)
+{
+	int best_path;
+
+	if(job->threaded)
+		pthread_join(job->thread, NULL);
+	if(progress != NULL)
+		*progress = job->progress;
+	best_path = job->progress.best_path;
+	free(job);
+	return best_path;
+}
@@ -3,6 +3,156 @@
 
 #include "tree.h"
 
+#include <stdint.h>
+
+
+enum {
+	SEARCH_HISTORY_SIZE = NPLAYERS * NHOLES * 2,
+	/* Counts in a thread's history table, see search_get_history() */
+	WIN_SCORE = 500,
+	/* Score of a decided game for the winner, more than any material */
+	EVAL_WEIGHT_SCALE = 16
+	/* eval_weights.h has weights in 1/EVAL_WEIGHT_SCALE seeds */
+};
+
+
+enum EvalFeature {
+	/* What eval_features() puts where, all from the side to move's point
+	 * of view. eval_state() in eval.c weighs them with eval_weights.h. */
+	EF_OWN_HOLES  = 0,			/* Seeds in each hole, store last */
+	EF_OPP_HOLES  = NHOLES,		/* Same for the opponent's holes */
+	EF_OWN_NYUMBA = 2 * NHOLES,	/* 1 while the nyumba stands */
+	EF_OPP_NYUMBA,
+	EF_TAKATA,					/* 1 if there is no capture to play */
+	EF_TRAP,					/* 1 if a hole is trapped (mtaji moja) */
+	EF_NAMUA,					/* 1 while there are seeds in store */
+	EF_TEMPO,					/* Always 1 */
+	EVAL_NFEATURES
+};
+
+
+struct SearchParams {
+	/* Knobs for best_branch_with(). best_branch() uses
+	 * default_search_params. */
+
+	int quiescence;
+	/* Non-zero to keep searching capture moves past the nominal depth
+	 * until the position is quiet (see quiesce in eval.c). */
+
+	int max_qdepth;
+	/* Maximum number of plies the quiescence stage may add. */
+
+	int pvs;
+	/* Non-zero to search all but the first child of a node with a null
+	 * window, re-searching with the full window only when it fails high. */
+
+	int lmr;
+	/* Non-zero to reduce the depth of takata children ordered late. A
+	 * reduced child that beats alpha is searched again at full depth. */
+
+	int lmr_min_depth;
+	/* Remaining depth a node needs before its children get reduced. */
+
+	int lmr_min_move;
+	/* Index (in search order) of the first child that may be reduced. */
+
+	int lmr_reduction;
+	/* Plies taken off a reduced child's depth. */
+
+	int tt;
+	/* Non-zero to keep searched positions in the transposition table
+	 * (see tt.c) and reuse them. */
+
+	int keep_tree;
+	/* Non-zero to leave the nodes searched in the tree, so later searches
+	 * and callers can reuse them. Bound the memory this takes with
+	 * set_tree_budget(). */
+
+	int lazy;
+	/* Non-zero to stage nodes below the root (see stage_tree) instead of
+	 * growing them, so moves are only executed once the search gets to
+	 * them. Moves after a cutoff never are. */
+};
+
+
+struct SearchProgress {
+	/* What an asynchronous search (search_start) has found so far */
+
+	int depth;
+	/* Deepest search completed, -1 before the first one is */
+
+	int searching;
+	/* Depth being searched now */
+
+	int best_path;
+	int score;
+	/* Best child of the root at depth and its score, -1 and 0 before the
+	 * first depth completes */
+
+	unsigned long long nodes;
+	unsigned long long elapsed_ns;
+	double nodes_per_sec;
+
+	int done;
+	/* Non-zero on the last report, the search has finished or was
+	 * cancelled */
+};
+
+
+typedef enum EvalFeature EvalFeature;
+
+typedef struct SearchParams SearchParams;
+
+typedef struct SearchProgress SearchProgress;
+
+typedef struct SearchJob SearchJob;
+
+typedef void (*SearchCallback)(const SearchProgress *progress, void *arg);
+
+
+extern const SearchParams default_search_params;
+
+
+void eval_features(const BaoState *state, uint8_t *f);
+
+
+int eval_branch(const BaoTree *node, Player player);
+
+
+void search_get_history(unsigned int *buf);
+
+
+void search_set_history(const unsigned int *buf);
+
+
 int best_branch(BaoTree *node, const BaoRules *rules, int depth);
 
+
+int best_branch_with(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params);
+
+
+int search_score(BaoTree *node, const BaoRules *rules, int depth,
+		const SearchParams *params);
+
+
+SearchJob *search_prepare(BaoTree *node, const BaoRules *rules, int max_depth,
+		const SearchParams *params, SearchCallback callback, void *arg);
+
+
+void search_run(SearchJob *job);
+
+
+SearchJob *search_start(BaoTree *node, const BaoRules *rules, int max_depth,
+		const SearchParams *params, SearchCallback callback, void *arg);
+
+
+void search_cancel(SearchJob *job);
+
+
+int search_done(SearchJob *job);
+
+
+int search_wait(SearchJob *job, SearchProgress *progress);
+
 #endif
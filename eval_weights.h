@@ -0,0 +1,25 @@
+/******************************************************************************
+ *	eval_weights.h: Weights of eval_features() (see enum EvalFeature)
+ *
+ *		Written by "baotrain tune" (see train.c) from a data set, this one
+ *		is plain material: a seed in the side to move's holes is worth one,
+ *		everything else nothing. Weights are in 1/EVAL_WEIGHT_SCALE seeds.
+ *****************************************************************************/
+
+#ifndef BAOEVAL_WEIGHTS_H
+#define BAOEVAL_WEIGHTS_H
+
+#include "eval.h"
+
+
+static const int16_t eval_weights[EVAL_NFEATURES] = {
+	/* Own holes, store last */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 0,
+	/* Opponent's holes, store last */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* Nyumba (own, opponent's), takata, trap, namua, tempo */
+	0, 0, 0, 0, 0, 0
+};
+
+
+#endif /* BAOEVAL_WEIGHTS_H */
@@ -0,0 +1,664 @@
+/******************************************************************************
+ *	frontier.c: Ply by ply (breadth first) expansion of the game tree
+ *
+ *		A Frontier holds every position of one ply as a flat array of
+ *		FRONTIER_ENTRY_SIZE byte entries: the position as pack_state()
+ *		writes it and the move that led to it (see frontier_entry).
+ *		frontier_expand() replaces it with the next ply. The ply is cut in
+ *		chunks of CHUNK entries which threads take in turn, each running
+ *		grow_tree() on a scratch node, and the chunks' children are put
+ *		back together in chunk order, so a ply comes out the same whatever
+ *		the number of threads. Transpositions between siblings are merged
+ *		by grow_tree() as ever. With FrontierConfig.dedup the whole ply is
+ *		made unique (see dedup_entries) before it is expanded in turn.
+ *
+ *		A ply that outgrows spill_bytes is streamed to an unlinked
+ *		temporary file and read back BATCH entries at a time. A spilled
+ *		ply is deduplicated by way of one file per hash partition, each
+ *		small enough to be sorted in memory.
+ *****************************************************************************/
+
+#include "frontier.h"
+#include "move_io.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+enum {
+	CHUNK      = 1024,			/* Entries a thread expands in one go */
+	BATCH      = 64 * CHUNK,	/* Entries expanded between writes to the
+								 * next ply */
+	PARTS      = 256,			/* Hash partitions sorted side by side */
+	MAX_SPILL_PARTS = 1024,		/* Files a spilled ply is split into */
+	SPARE_FDS  = 32,			/* Descriptors left to the rest of the
+								 * process while they are open */
+	PART_BUFFER = 256,			/* Entries buffered per partition file */
+	PATH_SIZE  = 4096,
+
+	NO_MOVE     = 0xFF			/* Move byte of the root's entry (see
+								 * encode_move) */
+};
+
+
+#define ENTRY(buf, i) ((buf) + (size_t) (i) * FRONTIER_ENTRY_SIZE)
+
+
+struct Level {
+	/* One ply, in memory or spilled */
+	unsigned char *mem;
+	size_t size;			/* Bytes allocated at mem */
+	int fd;					/* Spill file, -1 while in memory */
+	uint64_t n;
+};
+
+
+struct Chunk {
+	/* Children found expanding one chunk */
+	unsigned char *buf;
+	size_t n;
+	size_t size;			/* Entries buf has room for */
+};
+
+
+struct Pass {
+	/* A batch of entries being expanded, see expand_chunks */
+	const BaoRules *rules;
+	const unsigned char *in;
+	size_t n;
+	size_t nchunks;
+	size_t next_chunk;		/* Next chunk to take, atomic */
+	int error;				/* errno if a thread failed */
+	struct Chunk chunks[BATCH / CHUNK];
+};
+
+
+struct Sort {
+	/* Partitions being sorted, see sort_parts */
+	unsigned char *buf;
+	uint64_t start[PARTS + 1];
+	uint64_t kept[PARTS];	/* Entries left in each once unique */
+	int next_part;			/* atomic */
+};
+
+
+struct Frontier {
+	FrontierConfig cfg;
+	struct Level level;
+	int ply;
+	struct Pass *pass;
+	unsigned char *inbuf;	/* BATCH entries read back from a spilled ply */
+};
+
+
+/* FNV-1a of an entry's position */
+static uint64_t entry_hash(const unsigned char *entry)
+{
+	uint64_t h = 14695981039346656037ULL;
+	int i;
+
+	for(i = 0; i < PACKED_STATE_SIZE; i++) {
+		h ^= entry[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
+static int cmp_entries(const void *a, const void *b)
+{
+	return memcmp(a, b, FRONTIER_ENTRY_SIZE);
+}
+
+
+/* Runs fn on nthreads threads, the caller's included. The threads share
+ * their work through arg, so the ones that do start get it all done. Only
+ * the caller runs it under a tree budget (see tree_share_begin). */
+static void run_threads(int nthreads, void *(*fn)(void *), void *arg)
+{
+	pthread_t tids[FRONTIER_MAX_THREADS];
+	int i, started, shared;
+
+	shared = nthreads > 1 && tree_share_begin() == 0;
+	for(started = 0; shared && started < nthreads - 1; started++)
+		if(pthread_create(&tids[started], NULL, fn, arg) != 0)
+			break;
+	fn(arg);
+	for(i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	if(shared)
+		tree_share_end();
+}
+
+
+static int pread_all(int fd, void *buf, size_t len, off_t off)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while(len) {
+		if((n = pread(fd, p, len, off)) <= 0) {
+			if(n == -1 && errno == EINTR)
+				continue;
+			if(n == 0)
+				errno = EIO;
+			return -1;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static int spill_file(const FrontierConfig *cfg)
+{
+	char path[PATH_SIZE];
+	int fd;
+
+	if(snprintf(path, PATH_SIZE, "%s/frontier-XXXXXX",
+				cfg->spill_dir ? cfg->spill_dir : ".") >= PATH_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((fd = mkstemp(path)) == -1)
+		return -1;
+	unlink(path);
+	return fd;
+}
+
+
+static void level_free(struct Level *l)
+{
+	free(l->mem);
+	if(l->fd != -1)
+		close(l->fd);
+	l->mem = NULL;
+	l->size = 0;
+	l->fd = -1;
+	l->n = 0;
+}
+
+
+/* Adds n entries to l, moving it to a file once it is over spill_bytes */
+static int level_append(struct Level *l, const unsigned char *buf, size_t n,
+		const FrontierConfig *cfg)
+{
+	size_t need, size;
+	unsigned char *grown;
+
+	need = (l->n + n) * FRONTIER_ENTRY_SIZE;
+	if(l->fd == -1 && cfg->spill_bytes && need > cfg->spill_bytes) {
+		if((l->fd = spill_file(cfg)) == -1
+				|| write_all(l->fd, l->mem, l->n * FRONTIER_ENTRY_SIZE) == -1)
+			return -1;
+		free(l->mem);
+		l->mem = NULL;
+		l->size = 0;
+	}
+	if(l->fd != -1) {
+		if(write_all(l->fd, buf, n * FRONTIER_ENTRY_SIZE) == -1)
+			return -1;
+	} else {
+		if(need > l->size) {
+			for(size = l->size ? l->size : 4096; size < need; size *= 2)
+				;
+			if((grown = realloc(l->mem, size)) == NULL)
+				return -1;
+			l->mem = grown;
+			l->size = size;
+		}
+		memcpy(ENTRY(l->mem, l->n), buf, n * FRONTIER_ENTRY_SIZE);
+	}
+	l->n += n;
+	return 0;
+}
+
+
+/* Entries first..first+n of l, read into buf if l is spilled */
+static const unsigned char *level_read(const struct Level *l, uint64_t first,
+		size_t n, unsigned char *buf)
+{
+	if(l->fd == -1)
+		return ENTRY(l->mem, first);
+	if(pread_all(l->fd, buf, n * FRONTIER_ENTRY_SIZE,
+				first * FRONTIER_ENTRY_SIZE) == -1)
+		return NULL;
+	return buf;
+}
+
+
+static int expand_entry(struct Chunk *c, BaoTree *node,
+		const unsigned char *entry, const BaoRules *rules)
+{
+	unsigned char *e, *grown;
+	size_t size;
+	uint32_t i;
+
+	unpack_state(&node->state, entry);
+	if(grow_tree(node, rules) < 0)
+		return -1;
+	if(c->n + node->nchildren > c->size) {
+		for(size = c->size ? c->size : CHUNK; size < c->n + node->nchildren;
+				size *= 2)
+			;
+		if((grown = realloc(c->buf, size * FRONTIER_ENTRY_SIZE)) == NULL) {
+			prune_tree(node);
+			return -1;
+		}
+		c->buf = grown;
+		c->size = size;
+	}
+	for(i = 0; i < node->nchildren; i++) {
+		e = ENTRY(c->buf, c->n++);
+		pack_state(e, &node->children[i].state);
+		e[PACKED_STATE_SIZE] = encode_move(&node->children[i].move);
+	}
+	prune_tree(node);
+	return 0;
+}
+
+
+static void *expand_chunks(void *arg)
+{
+	struct Pass *p = arg;
+	struct Chunk *c;
+	BaoTree *node;
+	size_t i, k, end;
+
+	if((node = new_tree(p->rules)) == NULL) {
+		__atomic_store_n(&p->error, errno, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	while((k = __atomic_fetch_add(&p->next_chunk, 1, __ATOMIC_RELAXED))
+			< p->nchunks) {
+		c = &p->chunks[k];
+		c->n = 0;
+		end = (k + 1) * CHUNK < p->n ? (k + 1) * CHUNK : p->n;
+		for(i = k * CHUNK; i < end; i++) {
+			if(expand_entry(c, node, ENTRY(p->in, i), p->rules) == -1) {
+				__atomic_store_n(&p->error, errno ? errno : ENOMEM,
+						__ATOMIC_RELAXED);
+				break;
+			}
+		}
+	}
+	free_tree(node);
+	return NULL;
+}
+
+
+/* Sorts partitions and drops the repeats in each */
+static void *sort_parts(void *arg)
+{
+	struct Sort *s = arg;
+	unsigned char *base;
+	uint64_t n, i, kept;
+	int p;
+
+	while((p = __atomic_fetch_add(&s->next_part, 1, __ATOMIC_RELAXED))
+			< PARTS) {
+		base = ENTRY(s->buf, s->start[p]);
+		n = s->start[p + 1] - s->start[p];
+		qsort(base, n, FRONTIER_ENTRY_SIZE, cmp_entries);
+		for(i = kept = 0; i < n; i++) {
+			if(kept && memcmp(ENTRY(base, kept - 1), ENTRY(base, i),
+						PACKED_STATE_SIZE) == 0)
+				continue;
+			if(kept != i)
+				memcpy(ENTRY(base, kept), ENTRY(base, i), FRONTIER_ENTRY_SIZE);
+			kept++;
+		}
+		s->kept[p] = kept;
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * dedup_entries: Keeps one of each position among buf's n entries.
+ *
+ *		Entries are split into PARTS partitions by hash, which threads sort
+ *		and make unique side by side. The one kept of each position is the
+ *		one with the lowest move byte, buf ends up in partition order.
+ *
+ * Returns: 0 (n set to the entries left) or -1 on error
+ *****************************************************************************/
+static int dedup_entries(unsigned char *buf, uint64_t *n, int nthreads)
+{
+	struct Sort *s;
+	uint64_t i, fill[PARTS], kept;
+	unsigned char *part;
+	int p;
+
+	if(*n < 2)
+		return 0;
+	if((s = calloc(1, sizeof(*s))) == NULL)
+		return -1;
+	if((s->buf = malloc(*n * FRONTIER_ENTRY_SIZE)) == NULL) {
+		free(s);
+		return -1;
+	}
+	if((part = malloc(*n)) == NULL) {
+		free(s->buf);
+		free(s);
+		return -1;
+	}
+	for(i = 0; i < *n; i++) {
+		part[i] = entry_hash(ENTRY(buf, i)) >> 56;
+		s->start[part[i] + 1]++;
+	}
+	for(p = 0; p < PARTS; p++) {
+		s->start[p + 1] += s->start[p];
+		fill[p] = s->start[p];
+	}
+	for(i = 0; i < *n; i++)
+		memcpy(ENTRY(s->buf, fill[part[i]]++), ENTRY(buf, i),
+				FRONTIER_ENTRY_SIZE);
+	free(part);
+
+	run_threads(nthreads, sort_parts, s);
+	kept = 0;
+	for(p = 0; p < PARTS; p++) {
+		memcpy(ENTRY(buf, kept), ENTRY(s->buf, s->start[p]),
+				s->kept[p] * FRONTIER_ENTRY_SIZE);
+		kept += s->kept[p];
+	}
+	*n = kept;
+	free(s->buf);
+	free(s);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * dedup_spilled: dedup_entries() for a ply on disk.
+ *
+ *		The ply is streamed into partition files by hash, each about half
+ *		of spill_bytes, which are then made unique in memory one by one
+ *		and written out as the new ply. The files are all open at once,
+ *		so there are never more than the descriptor limit allows with
+ *		SPARE_FDS to spare; partitions then get bigger than spill_bytes.
+ *
+ * Returns: 0 or -1 on error (l is lost)
+ *****************************************************************************/
+static int dedup_spilled(Frontier *f, struct Level *l)
+{
+	int fds[MAX_SPILL_PARTS];
+	unsigned char *bufs, *in, *part;
+	size_t nbuf[MAX_SPILL_PARTS];
+	uint64_t count[MAX_SPILL_PARTS], first, i, n, per;
+	struct Level out = {NULL, 0, -1, 0};
+	struct rlimit lim;
+	int p, nparts, ret;
+
+	per = f->cfg.spill_bytes / 2 / FRONTIER_ENTRY_SIZE + 1;
+	nparts = l->n / per + 1;
+	if(nparts > MAX_SPILL_PARTS)
+		nparts = MAX_SPILL_PARTS;
+	if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY
+	&& (rlim_t) nparts + SPARE_FDS > lim.rlim_cur)
+		nparts = lim.rlim_cur > 2 * SPARE_FDS ? lim.rlim_cur - SPARE_FDS
+			: 1;
+	for(p = 0; p < nparts; p++) {
+		fds[p] = -1;
+		nbuf[p] = count[p] = 0;
+	}
+	if((bufs = malloc((size_t) nparts * PART_BUFFER * FRONTIER_ENTRY_SIZE))
+			== NULL)
+		return -1;
+	ret = -1;
+	for(p = 0; p < nparts; p++)
+		if((fds[p] = spill_file(&f->cfg)) == -1)
+			goto close;
+
+	/* Partition */
+	for(first = 0; first < l->n; first += n) {
+		n = l->n - first < BATCH ? l->n - first : BATCH;
+		if((in = (unsigned char *) level_read(l, first, n, f->inbuf)) == NULL)
+			goto close;
+		for(i = 0; i < n; i++) {
+			p = (entry_hash(ENTRY(in, i)) >> 32) % nparts;
+			part = ENTRY(bufs, (size_t) p * PART_BUFFER);
+			memcpy(ENTRY(part, nbuf[p]++), ENTRY(in, i), FRONTIER_ENTRY_SIZE);
+			if(nbuf[p] == PART_BUFFER) {
+				if(write_all(fds[p], part, PART_BUFFER * FRONTIER_ENTRY_SIZE)
+						== -1)
+					goto close;
+				count[p] += PART_BUFFER;
+				nbuf[p] = 0;
+			}
+		}
+	}
+	for(p = 0; p < nparts; p++) {
+		if(write_all(fds[p], ENTRY(bufs, (size_t) p * PART_BUFFER),
+					nbuf[p] * FRONTIER_ENTRY_SIZE) == -1)
+			goto close;
+		count[p] += nbuf[p];
+	}
+	level_free(l);
+
+	/* Sort each partition in memory */
+	for(p = 0; p < nparts; p++) {
+		if((part = malloc(count[p] * FRONTIER_ENTRY_SIZE + 1)) == NULL)
+			goto close;
+		n = count[p];
+		if(pread_all(fds[p], part, n * FRONTIER_ENTRY_SIZE, 0) == -1
+				|| dedup_entries(part, &n, f->cfg.nthreads) == -1
+				|| level_append(&out, part, n, &f->cfg) == -1) {
+			free(part);
+			goto close;
+		}
+		free(part);
+		close(fds[p]);
+		fds[p] = -1;
+	}
+	*l = out;
+	out.fd = -1;
+	out.mem = NULL;
+	ret = 0;
+close:
+	for(p = 0; p < nparts; p++)
+		if(fds[p] != -1)
+			close(fds[p]);
+	level_free(&out);
+	free(bufs);
+	return ret;
+}
+
+
+/*****************************************************************************
+ * frontier_new: A frontier holding just root, as ply 0.
+ *
+ * Returns: The frontier or NULL on error
+ *****************************************************************************/
+Frontier *frontier_new(const BaoState *root, const FrontierConfig *cfg)
+{
+	unsigned char entry[FRONTIER_ENTRY_SIZE];
+	Frontier *f;
+
+	if((f = calloc(1, sizeof(*f))) == NULL)
+		return NULL;
+	f->cfg = *cfg;
+	if(f->cfg.nthreads < 1)
+		f->cfg.nthreads = 1;
+	if(f->cfg.nthreads > FRONTIER_MAX_THREADS)
+		f->cfg.nthreads = FRONTIER_MAX_THREADS;
+	f->level.fd = -1;
+	pack_state(entry, root);
+	entry[PACKED_STATE_SIZE] = NO_MOVE;
+	if((f->pass = calloc(1, sizeof(*f->pass))) == NULL
+			|| level_append(&f->level, entry, 1, &f->cfg) == -1) {
+		frontier_free(f);
+		return NULL;
+	}
+	return f;
+}
+
+
+void frontier_free(Frontier *f)
+{
+	size_t i;
+
+	if(f == NULL)
+		return;
+	level_free(&f->level);
+	if(f->pass != NULL)
+		for(i = 0; i < BATCH / CHUNK; i++)
+			free(f->pass->chunks[i].buf);
+	free(f->pass);
+	free(f->inbuf);
+	free(f);
+}
+
+
+/*****************************************************************************
+ * frontier_expand: Replaces f's ply with the positions one move on.
+ *
+ *		Positions without moves drop out. ply, if not NULL, gets the
+ *		figures cfg.report is called with.
+ *
+ * Returns: 0 or -1 on error (errno set), f is left as it was
+ *****************************************************************************/
+int frontier_expand(Frontier *f, const BaoRules *rules, FrontierPly *ply)
+{
+	struct Level next = {NULL, 0, -1, 0};
+	struct Pass *p = f->pass;
+	FrontierPly done;
+	unsigned long long start;
+	uint64_t first;
+	size_t k;
+
+	start = stats_now_ns();
+	if(f->level.fd != -1 && f->inbuf == NULL
+			&& (f->inbuf = malloc(BATCH * FRONTIER_ENTRY_SIZE)) == NULL)
+		return -1;
+	p->rules = rules;
+	for(first = 0; first < f->level.n; first += p->n) {
+		p->n = f->level.n - first < BATCH ? f->level.n - first : BATCH;
+		if((p->in = level_read(&f->level, first, p->n, f->inbuf)) == NULL)
+			goto fail;
+		p->nchunks = (p->n + CHUNK - 1) / CHUNK;
+		p->next_chunk = 0;
+		p->error = 0;
+		run_threads(f->cfg.nthreads, expand_chunks, p);
+		if(p->error) {
+			errno = p->error;
+			goto fail;
+		}
+		for(k = 0; k < p->nchunks; k++)
+			if(level_append(&next, p->chunks[k].buf, p->chunks[k].n,
+						&f->cfg) == -1)
+				goto fail;
+	}
+
+	done.generated = next.n;
+	if(f->cfg.dedup) {
+		if(next.fd != -1) {
+			if(f->inbuf == NULL
+					&& (f->inbuf = malloc(BATCH * FRONTIER_ENTRY_SIZE)) == NULL)
+				goto fail;
+			if(dedup_spilled(f, &next) == -1)
+				goto fail;
+		} else if(dedup_entries(next.mem, &next.n, f->cfg.nthreads) == -1) {
+			goto fail;
+		}
+	}
+	level_free(&f->level);
+	f->level = next;
+	f->ply++;
+
+	done.ply = f->ply;
+	done.states = next.n;
+	done.ns = stats_now_ns() - start;
+	done.spilled = next.fd != -1;
+	if(ply != NULL)
+		*ply = done;
+	if(f->cfg.report != NULL)
+		f->cfg.report(&done, f->cfg.arg);
+	return 0;
+fail:
+	level_free(&next);
+	return -1;
+}
+
+
+uint64_t frontier_size(const Frontier *f)
+{
+	return f->level.n;
+}
+
+
+/*****************************************************************************
+ * frontier_read: Copies entries first..first+n of f's ply to buf.
+ *
+ * Returns: 0 or -1 on error (EINVAL if the range is off the ply)
+ *****************************************************************************/
+int frontier_read(const Frontier *f, uint64_t first, size_t n,
+		unsigned char *buf)
+{
+	const unsigned char *src;
+
+	if(first > f->level.n || n > f->level.n - first) {
+		errno = EINVAL;
+		return -1;
+	}
+	if((src = level_read(&f->level, first, n, buf)) == NULL)
+		return -1;
+	if(src != buf)
+		memcpy(buf, src, n * FRONTIER_ENTRY_SIZE);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * frontier_entry: Unpacks an entry.
+ *
+ * Returns: 1 if move got the move the position was reached by, 0 for the
+ *			root (move is left alone)
+ *****************************************************************************/
+int frontier_entry(const unsigned char *entry, BaoState *state, Move *move)
+{
+	uint8_t code = entry[PACKED_STATE_SIZE];
+
+	unpack_state(state, entry);
+	if(code == NO_MOVE)
+		return 0;
+	decode_move(move, code);
+	return 1;
+}
+
+
+/*****************************************************************************
+ * perft: Counts the positions depth plies from root.
+ *
+ *		With cfg->dedup these are distinct positions, else lines of play
+ *		(moves that transpose from the same position count once).
+ *
+ * Returns: 0 (leaves set) or -1 on error
+ *****************************************************************************/
+int perft(const BaoState *root, const BaoRules *rules, int depth,
+		const FrontierConfig *cfg, uint64_t *leaves)
+{
+	Frontier *f;
+	int i;
+
+	if((f = frontier_new(root, cfg)) == NULL)
+		return -1;
+	for(i = 0; i < depth; i++) {
+		if(frontier_expand(f, rules, NULL) == -1) {
+			frontier_free(f);
+			return -1;
+		}
+	}
+	*leaves = frontier_size(f);
+	frontier_free(f);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#ifndef BAOFRONTIER_H
+#define BAOFRONTIER_H
+
+#include "tree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	FRONTIER_MAX_THREADS = 64,	/* Threads a ply may be expanded with */
+	FRONTIER_ENTRY_SIZE  = PACKED_STATE_SIZE + 1
+	/* Bytes per position on a ply: pack_state() and the move to it */
+};
+
+
+struct FrontierPly {
+	/* What frontier_expand() did, see FrontierConfig.report */
+
+	int ply;
+	/* Plies from the root, the root itself is ply 0 */
+
+	uint64_t generated;
+	/* Children the ply before had (grow_tree() merges transpositions
+	 * between siblings) */
+
+	uint64_t states;
+	/* Positions on the ply, generated less any duplicates dropped */
+
+	uint64_t ns;
+	/* Time taken to expand and deduplicate */
+
+	int spilled;
+	/* Non-zero if the ply is on disk */
+};
+
+
+struct FrontierConfig {
+	/* How a frontier is expanded */
+
+	int nthreads;
+	/* Threads expanding each ply, at most FRONTIER_MAX_THREADS. */
+
+	int dedup;
+	/* Non-zero to keep a single entry per position on each ply. */
+
+	size_t spill_bytes;
+	/* Plies bigger than this are streamed to a file, 0 keeps every ply
+	 * in memory. */
+
+	const char *spill_dir;
+	/* Where spilled plies go, "." if NULL. The files are unlinked as soon
+	 * as they are made. */
+
+	void (*report)(const struct FrontierPly *, void *);
+	void *arg;
+	/* Called after each ply if not NULL */
+};
+
+
+typedef struct Frontier Frontier;
+
+typedef struct FrontierConfig FrontierConfig;
+
+typedef struct FrontierPly FrontierPly;
+
+
+Frontier *frontier_new(const BaoState *root, const FrontierConfig *cfg);
+
+
+void frontier_free(Frontier *f);
+
+
+int frontier_expand(Frontier *f, const BaoRules *rules, FrontierPly *ply);
+
+
+uint64_t frontier_size(const Frontier *f);
+
+
+int frontier_read(const Frontier *f, uint64_t first, size_t n,
+		unsigned char *buf);
+
+
+int frontier_entry(const unsigned char *entry, BaoState *state, Move *move);
+
+
+int perft(const BaoState *root, const BaoRules *rules, int depth,
+		const FrontierConfig *cfg, uint64_t *leaves);
+
+
+#endif /* BAOFRONTIER_H */
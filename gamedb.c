@@ -0,0 +1,701 @@
+/******************************************************************************
+ *	gamedb.c: Game record store and position index
+ *
+ *		Games are kept per rule set in DIR/VARIANT.games, an append only
+ *		file of move sequences. Each game is a 2 byte little endian ply
+ *		count and one byte per ply (see encode_move), gamedb_append() puts
+ *		a game down with a single O_APPEND write so several processes can
+ *		archive into the same file.
+ *
+ *		gamedb_build() replays every game from the start position and
+ *		writes DIR/VARIANT.idx: an open addressing hash table from
+ *		canon_hash() of each position reached to the moves played from it,
+ *		how often and how often they went on to win. Keys are canonical so
+ *		a position and its mirror image are counted together, moves are
+ *		kept as played on the canonical position and mirrored back by
+ *		gamedb_lookup(). The index is only a cache of the records, in
+ *		native byte order, and is replaced as a whole (rename) when
+ *		rebuilt, so readers with the old one mapped carry on unharmed.
+ *
+ *		Index layout:
+ *			IndexHeader
+ *			IndexSlot[nslots]	empty slots have count 0
+ *			IndexStat[nstats]	each slot's moves, first..first+nmoves
+ *****************************************************************************/
+
+#include "gamedb.h"
+#include "move_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define INDEX_MAGIC "BAOI"
+
+
+enum {
+	INDEX_VERSION = 1,
+	MAX_THREADS   = 64,
+	PATH_SIZE     = 4096
+};
+
+
+struct IndexHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t nslots;		/* A power of two */
+	uint64_t npositions;
+	uint64_t nstats;
+	uint64_t games;
+	uint64_t bad_games;
+};
+
+
+struct IndexSlot {
+	uint64_t key;
+	uint32_t count;			/* Times the position was reached */
+	uint32_t first;			/* Index of its first IndexStat */
+	uint32_t nmoves;
+	uint32_t pad;
+};
+
+
+struct IndexStat {
+	uint32_t count;
+	uint32_t wins;
+	uint8_t move;			/* encode_move(), canonical */
+	uint8_t pad[3];
+};
+
+
+struct Hit {
+	/* One move played from one position, or a run of them once sorted
+	 * and merged (see compact_hits). */
+	uint64_t key;
+	uint32_t count;
+	uint32_t wins;
+	uint8_t move;
+};
+
+
+struct Replay {
+	/* A build thread's share of the games and what it found in them */
+	const BaoRules *rules;
+	const unsigned char *records;
+	const uint64_t *offsets;	/* Where each of its games starts */
+	size_t ngames;
+
+	struct Hit *hits;
+	size_t nhits;
+	size_t bad_games;
+	int error;				/* errno if the thread failed */
+};
+
+
+struct GameDB {
+	void *map;
+	size_t size;
+	const struct IndexHeader *header;
+	const struct IndexSlot *slots;
+	const struct IndexStat *stats;
+};
+
+
+static int db_path(char *buf, const char *dir, const char *variant,
+		const char *ext)
+{
+	if(snprintf(buf, PATH_SIZE, "%s/%s%s", dir, variant, ext) >= PATH_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * gamedb_append: Archives a game played under variant's rules.
+ *
+ * Returns: 0 on success else -1 (errno set)
+ *****************************************************************************/
+int gamedb_append(const char *dir, const char *variant, const Move *moves,
+		int nmoves)
+{
+	char path[PATH_SIZE];
+	unsigned char *rec;
+	ssize_t n;
+	int i, fd, saved;
+
+	if(nmoves < 0 || nmoves > GAMEDB_MAX_PLIES) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(db_path(path, dir, variant, ".games") == -1)
+		return -1;
+	if((rec = malloc(2 + nmoves)) == NULL)
+		return -1;
+	rec[0] = nmoves & 0xFF;
+	rec[1] = nmoves >> 8;
+	for(i = 0; i < nmoves; i++)
+		rec[2 + i] = encode_move(&moves[i]);
+
+	if((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) == -1) {
+		free(rec);
+		return -1;
+	}
+	n = write(fd, rec, 2 + nmoves);
+	saved = errno;
+	free(rec);
+	close(fd);
+	if(n != 2 + nmoves) {
+		errno = n == -1 ? saved : EIO;
+		return -1;
+	}
+	return 0;
+}
+
+
+static int add_hit(struct Replay *r, size_t *size, uint64_t key,
+		uint8_t move)
+{
+	struct Hit *h;
+
+	if(r->nhits == *size) {
+		*size = *size ? *size * 2 : 4096;
+		if((h = realloc(r->hits, *size * sizeof(*h))) == NULL)
+			return -1;
+		r->hits = h;
+	}
+	h = &r->hits[r->nhits++];
+	h->key = key;
+	h->count = 1;
+	h->wins = 0;
+	h->move = move;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * replay_game: Plays one game through from the start, adding a Hit for
+ *		every ply to r.
+ *
+ *		A game that runs out of moves was lost by the side to move, the
+ *		hits of the winner's plies get a win. Games that stop early (a
+ *		resignation, an unfinished game) count no wins.
+ *
+ * Returns: 0 on success, 1 if the game held an illegal move (only the plies
+ * 		before it are kept), -1 on error
+ *****************************************************************************/
+static int replay_game(struct Replay *r, BaoTree *root, const BaoState *start,
+		const unsigned char *rec, size_t *size)
+{
+	unsigned nmoves = rec[0] | rec[1] << 8;
+	size_t i, first = r->nhits;
+	BaoState next;
+	Move move;
+	int path, mirrored, bad, loser;
+
+	root->state = *start;
+	bad = 0;
+	for(i = 0; i < nmoves; i++) {
+		if(grow_tree(root, r->rules) == -1)
+			return -1;
+		decode_move(&move, rec[2 + i]);
+		if((path = find_branch(root, &move)) == -1) {
+			bad = 1;
+			break;
+		}
+		if(add_hit(r, size, canon_hash(&root->state, &mirrored), 0) == -1)
+			return -1;
+		if(mirrored)
+			mirror_move(&move);
+		r->hits[r->nhits - 1].move = encode_move(&move);
+		/* Who moved, until the game's outcome is known */
+		r->hits[r->nhits - 1].wins = root->state.player;
+		next = root->children[path].state;
+		prune_tree(root);
+		root->state = next;
+	}
+	loser = -1;
+	if(!bad) {
+		if(grow_tree(root, r->rules) == -1)
+			return -1;
+		if(root->nchildren == 0)
+			loser = root->state.player;
+	}
+	for(i = first; i < r->nhits; i++)
+		r->hits[i].wins = loser != -1 && r->hits[i].wins != loser;
+	prune_tree(root);
+	return bad;
+}
+
+
+static int cmp_hits(const void *a, const void *b)
+{
+	const struct Hit *x = a, *y = b;
+
+	if(x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return (int) x->move - (int) y->move;
+}
+
+
+/* Sorts hits and merges the runs of one move from one position */
+static size_t compact_hits(struct Hit *hits, size_t n)
+{
+	size_t i, j;
+
+	if(n == 0)
+		return 0;
+	qsort(hits, n, sizeof(*hits), cmp_hits);
+	for(i = 0, j = 1; j < n; j++) {
+		if(hits[j].key == hits[i].key && hits[j].move == hits[i].move) {
+			hits[i].count += hits[j].count;
+			hits[i].wins += hits[j].wins;
+		} else {
+			hits[++i] = hits[j];
+		}
+	}
+	return i + 1;
+}
+
+
+static void *replay_games(void *arg)
+{
+	struct Replay *r = arg;
+	BaoTree *root;
+	BaoState start;
+	size_t i, size;
+	int ret;
+
+	size = 0;
+	if((root = new_tree(r->rules)) == NULL) {
+		r->error = errno;
+		return NULL;
+	}
+	start = root->state;
+	for(i = 0; i < r->ngames; i++) {
+		if((ret = replay_game(r, root, &start, r->records + r->offsets[i],
+						&size)) == -1) {
+			r->error = errno ? errno : EIO;
+			break;
+		}
+		r->bad_games += ret;
+	}
+	free_tree(root);
+	r->nhits = compact_hits(r->hits, r->nhits);
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * merge_replays: Merges the threads' sorted hits into one sorted list.
+ *
+ * Returns: The list (nhits set) or NULL on error
+ *****************************************************************************/
+static struct Hit *merge_replays(struct Replay *r, int n, size_t *nhits)
+{
+	struct Hit *all, *h;
+	size_t pos[MAX_THREADS], total;
+	int i, min;
+
+	total = 0;
+	for(i = 0; i < n; i++) {
+		total += r[i].nhits;
+		pos[i] = 0;
+	}
+	if((all = malloc((total ? total : 1) * sizeof(*all))) == NULL)
+		return NULL;
+	*nhits = 0;
+	for(;;) {
+		min = -1;
+		for(i = 0; i < n; i++)
+			if(pos[i] < r[i].nhits && (min == -1 || cmp_hits(
+						&r[i].hits[pos[i]], &r[min].hits[pos[min]]) < 0))
+				min = i;
+		if(min == -1)
+			break;
+		h = &r[min].hits[pos[min]++];
+		if(*nhits && cmp_hits(h, &all[*nhits - 1]) == 0) {
+			all[*nhits - 1].count += h->count;
+			all[*nhits - 1].wins += h->wins;
+		} else {
+			all[(*nhits)++] = *h;
+		}
+	}
+	return all;
+}
+
+
+/*****************************************************************************
+ * write_index: Hashes the merged hits into a table and writes it to path.
+ *
+ * Returns: 0 on success else -1
+ *****************************************************************************/
+static int write_index(const char *path, const struct Hit *hits, size_t nhits,
+		struct IndexHeader *hd)
+{
+	struct IndexSlot *slots, *s;
+	struct IndexStat *stats;
+	size_t i, j;
+	int fd, ret;
+
+	hd->npositions = 0;
+	for(i = 0; i < nhits; i++)
+		if(i == 0 || hits[i].key != hits[i - 1].key)
+			hd->npositions++;
+	/* At most half full keeps misses short */
+	for(hd->nslots = 16; hd->nslots < 2 * hd->npositions; hd->nslots *= 2)
+		;
+	hd->nstats = nhits;
+	slots = calloc(hd->nslots, sizeof(*slots));
+	stats = malloc((nhits ? nhits : 1) * sizeof(*stats));
+	if(slots == NULL || stats == NULL) {
+		free(slots);
+		free(stats);
+		return -1;
+	}
+
+	s = NULL;
+	for(i = 0; i < nhits; i++) {
+		if(i == 0 || hits[i].key != hits[i - 1].key) {
+			for(j = hits[i].key & (hd->nslots - 1); slots[j].count;
+					j = (j + 1) & (hd->nslots - 1))
+				;
+			s = &slots[j];
+			s->key = hits[i].key;
+			s->first = i;
+		}
+		s->count += hits[i].count;
+		s->nmoves++;
+		stats[i].count = hits[i].count;
+		stats[i].wins = hits[i].wins;
+		stats[i].move = hits[i].move;
+		memset(stats[i].pad, 0, sizeof(stats[i].pad));
+	}
+
+	ret = -1;
+	if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1) {
+		if(write_all(fd, hd, sizeof(*hd)) == 0
+				&& write_all(fd, slots, hd->nslots * sizeof(*slots)) == 0
+				&& write_all(fd, stats, nhits * sizeof(*stats)) == 0)
+			ret = 0;
+		if(close(fd) == -1)
+			ret = -1;
+	}
+	free(slots);
+	free(stats);
+	return ret;
+}
+
+
+/*****************************************************************************
+ * gamedb_build: (Re)builds variant's index from its records.
+ *
+ *		Games are split evenly over nthreads threads (at most 64) which
+ *		replay them side by side, each sorting and merging its own finds,
+ *		the threads' lists are then merged and hashed. A record cut short
+ *		(say by a crash while appending) ends the scan.
+ *
+ * Returns: 0 on success else -1 (errno set)
+ *****************************************************************************/
+int gamedb_build(const char *dir, const char *variant, const BaoRules *rules,
+		int nthreads)
+{
+	char path[PATH_SIZE], tmp[PATH_SIZE];
+	struct Replay r[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	struct IndexHeader hd;
+	struct stat st;
+	unsigned char *records;
+	uint64_t *offsets, *grown;
+	size_t ngames, size, off, nhits, per;
+	struct Hit *hits;
+	int i, fd, ret, err, shared, started;
+
+	if(nthreads < 1)
+		nthreads = 1;
+	if(nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	if(db_path(path, dir, variant, ".games") == -1)
+		return -1;
+	if((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	records = NULL;
+	if(st.st_size && (records = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+					fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	ngames = 0;
+	size = 0;
+	offsets = NULL;
+	for(off = 0; off + 2 <= st.st_size; ngames++) {
+		if(off + 2 + (records[off] | records[off + 1] << 8) > st.st_size)
+			break;
+		if(ngames == size) {
+			size = size ? size * 2 : 1024;
+			if((grown = realloc(offsets, size * sizeof(*offsets))) == NULL) {
+				ret = -1;
+				goto unmap;
+			}
+			offsets = grown;
+		}
+		offsets[ngames] = off;
+		off += 2 + (records[off] | records[off + 1] << 8);
+	}
+
+	memset(r, 0, sizeof(r));
+	per = (ngames + nthreads - 1) / nthreads;
+	for(i = 0; i < nthreads; i++) {
+		r[i].rules = rules;
+		r[i].records = records;
+		r[i].offsets = offsets + (i * per < ngames ? i * per : ngames);
+		r[i].ngames = i * per >= ngames ? 0
+			: ngames - i * per < per ? ngames - i * per : per;
+	}
+	/* Under a tree budget the calling thread replays it all */
+	shared = nthreads > 1 && tree_share_begin() == 0;
+	/* Threads 1 to started - 1 run, the caller takes r[0] and the rest */
+	for(started = 1; shared && started < nthreads; started++)
+		if(pthread_create(&tids[started], NULL, replay_games,
+					&r[started]) != 0)
+			break;
+	for(i = 0; i < nthreads; i++)
+		if(i == 0 || i >= started)
+			replay_games(&r[i]);
+	for(i = 1; i < started; i++)
+		pthread_join(tids[i], NULL);
+	if(shared)
+		tree_share_end();
+
+	ret = -1;
+	err = 0;
+	memcpy(hd.magic, INDEX_MAGIC, 4);
+	hd.version = INDEX_VERSION;
+	hd.games = ngames;
+	hd.bad_games = 0;
+	for(i = 0; i < nthreads; i++) {
+		if(r[i].error)
+			err = r[i].error;
+		hd.bad_games += r[i].bad_games;
+	}
+	if(err) {
+		errno = err;
+	} else if((hits = merge_replays(r, nthreads, &nhits)) != NULL) {
+		if(db_path(path, dir, variant, ".idx") == 0
+				&& db_path(tmp, dir, variant, ".idx.tmp") == 0
+				&& write_index(tmp, hits, nhits, &hd) == 0)
+			ret = rename(tmp, path);
+		free(hits);
+	}
+	for(i = 0; i < nthreads; i++)
+		free(r[i].hits);
+	free(offsets);
+unmap:
+	if(records != NULL)
+		munmap(records, st.st_size);
+	return ret;
+}
+
+
+/*****************************************************************************
+ * gamedb_games: Calls fn with each game archived for variant, in the order
+ *		they were archived. A partly written game at the end is skipped.
+ *
+ * Returns: 0, -1 on error (errno set) or the first non-zero fn returned
+ *****************************************************************************/
+int gamedb_games(const char *dir, const char *variant,
+		int (*fn)(const Move *, int, void *), void *arg)
+{
+	char path[PATH_SIZE];
+	struct stat st;
+	unsigned char *records;
+	Move *moves;
+	size_t off;
+	unsigned i, nmoves;
+	int fd, ret;
+
+	if(db_path(path, dir, variant, ".games") == -1)
+		return -1;
+	if((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	records = NULL;
+	if(st.st_size && (records = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+					fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	ret = -1;
+	if((moves = malloc(GAMEDB_MAX_PLIES * sizeof(*moves))) == NULL)
+		goto unmap;
+	ret = 0;
+	for(off = 0; ret == 0 && off + 2 <= st.st_size; off += 2 + nmoves) {
+		nmoves = records[off] | records[off + 1] << 8;
+		if(off + 2 + nmoves > st.st_size)
+			break;
+		for(i = 0; i < nmoves; i++)
+			decode_move(&moves[i], records[off + 2 + i]);
+		ret = fn(moves, nmoves, arg);
+	}
+	free(moves);
+unmap:
+	if(records != NULL)
+		munmap(records, st.st_size);
+	return ret;
+}
+
+
+/* Whether every slot's moves lie within the stats and a lookup can end on
+ * an empty slot. Returns: 0 or -1 */
+static int check_slots(const GameDB *db)
+{
+	const struct IndexSlot *s;
+	uint64_t i, empty = 0;
+
+	for(i = 0; i < db->header->nslots; i++) {
+		s = &db->slots[i];
+		if(s->count == 0)
+			empty++;
+		else if((uint64_t) s->first + s->nmoves > db->header->nstats)
+			return -1;
+	}
+	return empty ? 0 : -1;
+}
+
+
+/*****************************************************************************
+ * gamedb_open: Maps variant's index in.
+ *
+ * Returns: The database or NULL on error (errno set, EINVAL if the file is
+ * 		not a usable index)
+ *****************************************************************************/
+GameDB *gamedb_open(const char *dir, const char *variant)
+{
+	char path[PATH_SIZE];
+	const struct IndexHeader *hd;
+	struct stat st;
+	GameDB *db;
+	int fd;
+
+	if(db_path(path, dir, variant, ".idx") == -1)
+		return NULL;
+	if((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if(fstat(fd, &st) == -1 || (db = malloc(sizeof(*db))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	if(st.st_size < sizeof(*hd)) {
+		errno = EINVAL;
+		db->map = MAP_FAILED;
+	} else {
+		db->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if(db->map == MAP_FAILED) {
+		free(db);
+		return NULL;
+	}
+	db->size = st.st_size;
+	hd = db->header = db->map;
+	if(memcmp(hd->magic, INDEX_MAGIC, 4) != 0
+			|| hd->version != INDEX_VERSION
+			|| (hd->nslots & (hd->nslots - 1)) != 0 || hd->nslots == 0
+			|| hd->nslots > db->size / sizeof(*db->slots)
+			|| hd->nstats > db->size / sizeof(*db->stats)
+			|| db->size != sizeof(*hd) + hd->nslots * sizeof(*db->slots)
+					+ hd->nstats * sizeof(*db->stats)) {
+		gamedb_close(db);
+		errno = EINVAL;
+		return NULL;
+	}
+	db->slots = (const struct IndexSlot *) (hd + 1);
+	db->stats = (const struct IndexStat *) (db->slots + hd->nslots);
+	if(check_slots(db) == -1) {
+		gamedb_close(db);
+		errno = EINVAL;
+		return NULL;
+	}
+	return db;
+}
+
+
+void gamedb_close(GameDB *db)
+{
+	munmap(db->map, db->size);
+	free(db);
+}
+
+
+void gamedb_info(const GameDB *db, GameDBInfo *info)
+{
+	info->games = db->header->games;
+	info->positions = db->header->npositions;
+	info->bad_games = db->header->bad_games;
+}
+
+
+/*****************************************************************************
+ * gamedb_lookup: Finds what the archived games played from state.
+ *
+ *		count gets the times state (or its mirror image) was reached, buf
+ *		the moves played from it, most played first, as played on state.
+ *
+ * Returns: Number of moves put in buf (at most bufsz), 0 for an unknown
+ * 		position
+ *****************************************************************************/
+int gamedb_lookup(const GameDB *db, const BaoState *state, uint32_t *count,
+		GameDBMove *buf, int bufsz)
+{
+	const struct IndexSlot *s;
+	const struct IndexStat *st;
+	uint64_t key, mask = db->header->nslots - 1, i;
+	GameDBMove m, moves[MAXTRANS];
+	int mirrored, n, j, k;
+
+	key = canon_hash(state, &mirrored);
+	*count = 0;
+	for(i = key & mask; db->slots[i].count; i = (i + 1) & mask) {
+		s = &db->slots[i];
+		if(s->key != key)
+			continue;
+		*count = s->count;
+		st = &db->stats[s->first];
+		/* Most played first, there are at most MAXTRANS (more only if two
+		 * positions share a key) */
+		n = s->nmoves < MAXTRANS ? s->nmoves : MAXTRANS;
+		for(k = 0; k < n; k++) {
+			decode_move(&m.move, st[k].move);
+			if(mirrored)
+				mirror_move(&m.move);
+			m.count = st[k].count;
+			m.wins = st[k].wins;
+			for(j = k; j > 0 && moves[j - 1].count < m.count; j--)
+				moves[j] = moves[j - 1];
+			moves[j] = m;
+		}
+		if(n > bufsz)
+			n = bufsz;
+		memcpy(buf, moves, n * sizeof(*buf));
+		return n;
+	}
+	return 0;
+}
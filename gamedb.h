@@ -0,0 +1,69 @@
+#ifndef BAOGAMEDB_H
+#define BAOGAMEDB_H
+
+#include "tree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	GAMEDB_MAX_PLIES = 0xFFFF	/* Longest game a record can hold */
+};
+
+
+struct GameDBMove {
+	/* What became of one move played from a position */
+
+	Move move;
+	/* As played on the position looked up */
+
+	uint32_t count;
+	/* Games that played move here */
+
+	uint32_t wins;
+	/* Of those, games the side playing move went on to win */
+};
+
+
+struct GameDBInfo {
+	/* Totals over an index, see gamedb_info() */
+	uint64_t games;
+	uint64_t positions;
+	uint64_t bad_games;		/* Games with an illegal move, indexed up to it */
+};
+
+
+typedef struct GameDB GameDB;
+
+typedef struct GameDBMove GameDBMove;
+
+typedef struct GameDBInfo GameDBInfo;
+
+
+int gamedb_append(const char *dir, const char *variant, const Move *moves,
+		int nmoves);
+
+
+int gamedb_build(const char *dir, const char *variant, const BaoRules *rules,
+		int nthreads);
+
+
+int gamedb_games(const char *dir, const char *variant,
+		int (*fn)(const Move *, int, void *), void *arg);
+
+
+GameDB *gamedb_open(const char *dir, const char *variant);
+
+
+void gamedb_close(GameDB *db);
+
+
+void gamedb_info(const GameDB *db, GameDBInfo *info);
+
+
+int gamedb_lookup(const GameDB *db, const BaoState *state, uint32_t *count,
+		GameDBMove *buf, int bufsz);
+
+
+#endif /* BAOGAMEDB_H */
@@ -1,26 +1,24 @@
 #include "tree.h"
+#include "dist.h"
 #include "eval.h"
+#include "frontier.h"
+#include "replay.h"
+#include "rules.h"
+#include "server.h"
+#include "snapshot.h"
+#include "solve.h"
+#include "stats.h"
 
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 
 
-BaoRules rules[] = {
-	{
-		{1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 22}, 0, 1, 16, 0, 50
-	},
-	{
-		{0, 0, 0, 0, 8, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 20}, 1, 1, 16, 8, 50
-	},
-	{
-		{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0}, 0, 1, 16, 0, 50
-	}
-};
-
-
-void print_state(BaoState *s)
+void print_state(const BaoState *s)
 {
 	Hole h;
 
@@ -48,7 +46,8 @@ void print_move(Move *m)
 
 void print_node(BaoTree *n)
 {
-	int i;
+	Move moves[MAXMOVES];
+	int i, j, nmoves;
 
 	printf("Move: ");
 	print_move(&(n->move));
@@ -57,27 +56,220 @@ void print_node(BaoTree *n)
 	print_state(&(n->state));
 	printf("\n");
 	printf("Moves: ");
-	for(i = 0; n->children[i] != NULL; i++) {
+	for(i = 0; i < n->nchildren; i++) {
 		printf("%d.", i + 1);
-		print_move(&(n->children[i]->move));
+		nmoves = branch_moves(n, i, moves, MAXMOVES);
+		for(j = 0; j < nmoves; j++) {
+			if(j)
+				printf("= ");
+			print_move(&moves[j]);
+		}
 	}
 	printf("\n");
 }
 
 
+/* Where a move being played back is at, see the "n", "p" and "j" commands */
+static void print_replay(const MoveReplay *r)
+{
+	printf("Step %u/%u: hand on %c%d holding %u\n", r->step, r->nsteps,
+			r->side == P_NORTH ? 'N' : 'S', r->hole, r->nkhomo);
+	print_state(&r->state);
+	if(r->step == r->nsteps)
+		printf("Move completed%s\n", r->status == MXS_HAULTED
+				? " (haulted)" : "");
+}
+
+
+/* Called after each ply of --perft */
+static void print_ply(const FrontierPly *p, void *arg)
+{
+	printf("ply %d: %llu states (%llu generated) %.3f s, %.0f states/s%s\n",
+			p->ply, (unsigned long long) p->states,
+			(unsigned long long) p->generated, p->ns / 1e9,
+			p->ns ? p->generated * 1e9 / p->ns : 0.0,
+			p->spilled ? ", spilled" : "");
+	fflush(stdout);
+}
+
+
+/* Prints what the "solve" command found */
+static void print_solution(const BaoTree *tree, const SolveResult *r)
+{
+	printf("solve: %s, %llu nodes", r->outcome == SOLVE_WIN ? "win"
+			: r->outcome == SOLVE_LOSS ? "loss" : "unknown", r->nodes);
+	if(r->proof_nodes)
+		printf(", proof of %llu nodes, %d plies at most, best branch: %d",
+				r->proof_nodes, r->proof_plies, tree->best + 1);
+	printf("\n");
+}
+
+
+/* Runs on the search thread, see search_start() */
+static void print_progress(const SearchProgress *p, void *arg)
+{
+	if(p->done)
+		printf("\nsearch %s at depth %d, best branch: %d (score %d)\n",
+				p->searching > p->depth ? "stopped" : "done", p->depth,
+				p->best_path + 1, p->score);
+	else
+		printf("\ndepth %d (searching %d): best %d score %d, %llu nodes, "
+				"%.0f nodes/sec\n", p->depth, p->searching,
+				p->best_path + 1, p->score, p->nodes, p->nodes_per_sec);
+	fflush(stdout);
+}
+
+
+enum {
+	SEARCH_MAX_DEPTH = 30	/* Depth "go" gives up at if never stopped */
+};
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--stats] [--keep [--budget MiB]] "
+			"[--dist nworkers [--dist-cmd cmd]] [--snapshot file]\n"
+			"       %*s [--solve-nodes n]\n"
+			"       %s --worker\n"
+			"       %s [--keep] --serve socket [--threads n] [--movetime ms]\n"
+			"       %s --perft depth [--threads n] [--dedup] [--spill MiB "
+			"[--spill-dir dir]]\n"
+			"  --threads n  threads for --serve and --perft, one per CPU "
+			"by default\n",
+			prog, (int) strlen(prog), "", prog, prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+
 int main(int argc, char *argv[])
 {
 	BaoTree *tree;
-	BaoTree **child_p;
-	Hand *hand;
+	MoveReplay replay;
+	BaoStats st;
 	char line[80];
-	int i;
+	DistConfig dist;
+	ServerConfig server;
+	SearchParams params;
+	SearchJob *job;
+	FrontierConfig frontier;
+	SolveConfig solver;
+	SolveResult solution;
+	uint64_t leaves;
+	size_t budget;
+	const char *snapshot;
+	unsigned long step;
+	char *end;
+	int i, show_stats, perft_depth, replaying, nthreads;
+
+	show_stats = 0;
+	memset(&dist, 0, sizeof(dist));
+	dist.split_depth = 2;
+	dist.max_restarts = 8;
+	memset(&server, 0, sizeof(server));
+	server.movetime_ms = 1000;
+	memset(&frontier, 0, sizeof(frontier));
+	frontier.report = print_ply;
+	perft_depth = -1;
+	/* Threads --serve and --perft run on */
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	budget = 0;
+	snapshot = NULL;
+	params = default_search_params;
+	solver = default_solve_config;
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--stats") == 0) {
+			show_stats = 1;
+		} else if(strcmp(argv[i], "--keep") == 0) {
+			params.keep_tree = 1;
+		} else if(strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+			budget = (size_t) atol(argv[++i]) << 20;
+		} else if(strcmp(argv[i], "--dist") == 0 && i + 1 < argc) {
+			dist.nworkers = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--dist-cmd") == 0 && i + 1 < argc) {
+			dist.worker_cmd = argv[++i];
+		} else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			server.path = argv[++i];
+		} else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--movetime") == 0 && i + 1 < argc) {
+			server.movetime_ms = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+			snapshot = argv[++i];
+		} else if(strcmp(argv[i], "--perft") == 0 && i + 1 < argc) {
+			perft_depth = atoi(argv[++i]);
+		} else if(strcmp(argv[i], "--dedup") == 0) {
+			frontier.dedup = 1;
+		} else if(strcmp(argv[i], "--spill") == 0 && i + 1 < argc) {
+			frontier.spill_bytes = (size_t) atol(argv[++i]) << 20;
+		} else if(strcmp(argv[i], "--spill-dir") == 0 && i + 1 < argc) {
+			frontier.spill_dir = argv[++i];
+		} else if(strcmp(argv[i], "--solve-nodes") == 0 && i + 1 < argc) {
+			solver.max_nodes = strtoull(argv[++i], NULL, 10);
+		} else if(strcmp(argv[i], "--worker") == 0) {
+			/* Serve a coordinator on stdin/stdout, see dist.c */
+			if(dist_worker(STDIN_FILENO, STDOUT_FILENO) == -1) {
+				perror("Worker failed");
+				exit(EXIT_FAILURE);
+			}
+			exit(EXIT_SUCCESS);
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(dist.worker_cmd != NULL && dist.nworkers == 0)
+		usage(argv[0]);
+	if(budget && server.path != NULL) {
+		/* Sessions grow their trees on several threads, see server.c */
+		fprintf(stderr, "%s: --budget cannot be used with --serve\n",
+				argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if(set_tree_budget(budget) == -1) {
+		perror("Could not set tree budget");
+		exit(EXIT_FAILURE);
+	}
+	if(server.path != NULL) {
+		server.nworkers = nthreads < SERVER_MAX_WORKERS ? nthreads
+			: SERVER_MAX_WORKERS;
+		if(server.movetime_ms <= 0)
+			usage(argv[0]);
+		server.params = params;
+		if(serve(&server) == -1) {
+			perror("Could not serve");
+			exit(EXIT_FAILURE);
+		}
+		if(show_stats) {
+			stats_collect(&st);
+			stats_print(stdout, &st);
+		}
+		exit(EXIT_SUCCESS);
+	}
 
-	if((tree = new_tree(&rules[1])) == NULL) {
+	/* Warm start from the last run's snapshot if there is a usable one */
+	tree = NULL;
+	if(snapshot != NULL && (tree = snapshot_load(snapshot, &rules[1])) == NULL
+	&& errno != ENOENT)
+		perror("Ignoring snapshot");
+	if(tree == NULL && (tree = new_tree(&rules[1])) == NULL) {
 		perror("Could not initialise a new game");
 		exit(EXIT_FAILURE);
 	}
 
+	if(perft_depth >= 0) {
+		frontier.nthreads = nthreads;
+		if(perft(&tree->state, &rules[1], perft_depth, &frontier,
+					&leaves) == -1) {
+			perror("Perft failed");
+			exit(EXIT_FAILURE);
+		}
+		printf("perft %d: %llu\n", perft_depth, (unsigned long long) leaves);
+		if(show_stats) {
+			stats_collect(&st);
+			stats_print(stdout, &st);
+		}
+		exit(EXIT_SUCCESS);
+	}
+
 	if(grow_tree(tree, &rules[1]) == -1) {
 		perror("Could not update tree");
 		exit(EXIT_FAILURE);
@@ -87,54 +279,130 @@ int main(int argc, char *argv[])
 	print_node(tree);
 
 	printf("---------BEGIN-CHILDREN----------\n");
-	for(child_p = tree->children; *child_p != NULL; child_p++) {
-		print_node(*child_p);
+	for(i = 0; i < tree->nchildren; i++) {
+		print_node(&tree->children[i]);
 		printf("\n");
 	}
 	printf("----------END-CHILDREN-----------\n");
 
 
-	hand = NULL;
-	i = best_branch(tree, &rules[1], 5);
+	replaying = 0;
+	job = NULL;
+	if(dist.nworkers)
+		i = dist_best_branch(tree, &rules[1], 5, &params, &dist);
+	else
+		i = best_branch_with(tree, &rules[1], 5, &params);
 	printf("Best branch: %d\n", i);
+	if(show_stats) {
+		stats_collect(&st);
+		stats_print(stdout, &st);
+	}
 	i = 0;
 	print_node(tree);
 	printf("> ");
 	while(scanf("%79s", line) != EOF) {
 		// line[strlen(line) - 1] = '\0'; 	/* strip \n */
-		if(strcmp(line, "") == 0) {
-			if(hand != NULL) {
-				if(exec_move(hand, &rules[1], 1) == MXS_DONE) {
-					printf("Move completed\n");
-					end_move(hand);
-					hand = NULL;
-				}
+		if(job != NULL && search_done(job)) {
+			search_wait(job, NULL);
+			job = NULL;
+		}
+		if(strcmp(line, "go") == 0) {
+			/* Deepens until stopped, the prompt stays usable meanwhile */
+			if(job != NULL)
+				printf("Error: Already searching\n");
+			else if((job = search_start(tree, &rules[1], SEARCH_MAX_DEPTH,
+						&params, print_progress, NULL)) == NULL)
+				perror("Could not start search");
+			printf("> ");
+			fflush(stdout);
+			continue;
+		} else if(strcmp(line, "stop") == 0) {
+			if(job == NULL) {
+				printf("Error: No search running\n");
 			} else {
-				continue;
+				search_cancel(job);
+				search_wait(job, NULL);
+				job = NULL;
 			}
-		} else if(strcmp(line, "next") == 0 || strcmp(line, "n") == 0) {
-			if(hand == NULL) {
+		} else if(job != NULL) {
+			/* print_node() would walk the tree under the search */
+			printf("Error: Searching, stop it first\n> ");
+			fflush(stdout);
+			continue;
+		} else if(strcmp(line, "save") == 0) {
+			if(snapshot == NULL)
+				printf("Error: No --snapshot file\n");
+			else if(snapshot_save(snapshot, tree, &rules[1]) == -1)
+				perror("Could not save snapshot");
+		} else if(strcmp(line, "solve") == 0) {
+			if(solve(tree, &rules[1], &solver, &solution) == -1)
+				perror("Could not solve");
+			else
+				print_solution(tree, &solution);
+		} else if(strcmp(line, "next") == 0 || strcmp(line, "n") == 0
+				|| strcmp(line, "prev") == 0 || strcmp(line, "p") == 0
+				|| strcmp(line, "jump") == 0 || strcmp(line, "j") == 0) {
+			/* Plays the move back, the tree is left alone */
+			if(!replaying) {
 				printf("Error: No move in eval\n");
-			} else if(exec_move(hand, &rules[1], 1) == MXS_DONE) {
-				printf("Move completed\n");
-				end_move(hand);
-				hand = NULL;
+			} else {
+				if(line[0] == 'n') {
+					step = replay.step + 1UL;
+				} else if(line[0] == 'p') {
+					step = replay.step ? replay.step - 1 : ULONG_MAX;
+				} else {
+					/* The step is the next word, a bad one is not taken
+					 * for a command */
+					if(scanf("%79s", line) != 1)
+						break;
+					step = strtoul(line, &end, 10);
+					if(!isdigit(line[0]) || *end != '\0') {
+						printf("Error: Invalid step: %s\n", line);
+						step = replay.step;
+					}
+				}
+				if(step > replay.nsteps)
+					printf("Error: No such step, the move has %u\n",
+							replay.nsteps);
+				else
+					replay_seek(&replay, step);
+				print_replay(&replay);
+				printf("> ");
+				continue;
 			}
 		} else if(isdigit(line[0])) {
 			i = atoi(line) - 1;
-			if(i < 0 || i > tree->nchildren)
+			if(i < 0 || i >= tree->nchildren) {
 				printf("Error: Invalid move index: %d\n", i + 1);
-			printf("You are playing %d: ", i + 1);
-			print_move(&tree->children[i]->move);
-			printf("\n");
-			hand = start_move(&tree->state, &rules[1],
-					&tree->children[i]->move);
+			} else {
+				printf("You are playing %d: ", i + 1);
+				print_move(&tree->children[i].move);
+				printf("\n");
+				if(replaying)
+					replay_free(&replay);
+				replaying = replay_record(&replay, tree, i, &rules[1]) == 0;
+				if(!replaying) {
+					perror("Could not execute move");
+				} else {
+					print_replay(&replay);
+					printf("> ");
+					continue;
+				}
+			}
 		} else {
 			printf("unknown command %s\n", line);
 		}
 		print_node(tree);
 		printf("> ");
 	}
+	if(job != NULL) {
+		search_cancel(job);
+		search_wait(job, NULL);
+	}
+	if(replaying)
+		replay_free(&replay);
+	if(snapshot != NULL && snapshot_save(snapshot, tree, &rules[1]) == -1)
+		perror("Could not save snapshot");
 
 	exit(EXIT_SUCCESS);
 }
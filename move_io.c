@@ -0,0 +1,81 @@
+/******************************************************************************
+ *	move_io.c: Moves and records in and out of files and sockets
+ *
+ *		Moves are stored as one byte (see encode_move) by the game
+ *		records, the perft frontier and snapshots, and written as text,
+ *		hole then direction ("3+", "12-n"), by the server and baodb.
+ *****************************************************************************/
+
+#include "move_io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/* Hole in the low bits, then the direction and nyumba_sown flags */
+uint8_t encode_move(const Move *move)
+{
+	return (move->hole & MOVE_HOLE) | (move->dir == MXD_RIGHT ? MOVE_RIGHT : 0)
+		| (move->nyumba_sown ? MOVE_NYUMBA : 0);
+}
+
+
+void decode_move(Move *move, uint8_t code)
+{
+	move->hole = code & MOVE_HOLE;
+	move->dir = code & MOVE_RIGHT ? MXD_RIGHT : MXD_LEFT;
+	move->nyumba_sown = (code & MOVE_NYUMBA) != 0;
+}
+
+
+/*****************************************************************************
+ * parse_move: Reads a move written by format_move().
+ *
+ *		A hole, '+' to sow right or '-' to sow left, and 'n' if the
+ *		nyumba is sown, e.g. "3+" or "12-n".
+ *
+ * Returns: 0 on success, -1 if s is not a move.
+ *****************************************************************************/
+int parse_move(Move *move, const char *s)
+{
+	char *end;
+	long hole;
+
+	hole = strtol(s, &end, 10);
+	if(end == s || hole < 0 || hole >= H_STORE
+			|| (*end != '+' && *end != '-'))
+		return -1;
+	move->hole = hole;
+	move->dir = *end == '+' ? MXD_RIGHT : MXD_LEFT;
+	move->nyumba_sown = end[1] == 'n';
+	return end[move->nyumba_sown + 1] == '\0' ? 0 : -1;
+}
+
+
+/* Returns: What snprintf() returns */
+int format_move(char *buf, size_t size, const Move *move)
+{
+	return snprintf(buf, size, "%d%c%s", move->hole,
+			move->dir == MXD_RIGHT ? '+' : '-', move->nyumba_sown ? "n" : "");
+}
+
+
+/* Returns: 0 once all of buf is written, -1 on error (errno set) */
+int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while(len) {
+		if((n = write(fd, p, len)) == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
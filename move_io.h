@@ -0,0 +1,32 @@
+#ifndef BAOMOVEIO_H
+#define BAOMOVEIO_H
+
+#include "tree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	MOVE_HOLE   = 0x1F,		/* encode_move() bits */
+	MOVE_RIGHT  = 0x20,
+	MOVE_NYUMBA = 0x40
+};
+
+
+uint8_t encode_move(const Move *move);
+
+
+void decode_move(Move *move, uint8_t code);
+
+
+int parse_move(Move *move, const char *s);
+
+
+int format_move(char *buf, size_t size, const Move *move);
+
+
+int write_all(int fd, const void *buf, size_t len);
+
+
+#endif /* BAOMOVEIO_H */
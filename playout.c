@@ -0,0 +1,780 @@
+/******************************************************************************
+ *	playout.c: Random playouts (rollouts), one at a time or many at once
+ *
+ *		A playout plays uniformly random moves from a position until the
+ *		side to move has none (and loses) or max_plies run out. A haulted
+ *		move goes on to sow nyumba on a coin toss, moves that never end are
+ *		dropped and another one drawn.
+ *
+ *		playouts() keeps PLAYOUT_LANES games going side by side. Their
+ *		boards and hands are held as a structure of arrays, one byte per
+ *		lane in a GCC vector, and the work is done on all lanes at once:
+ *		step_lanes() takes every running lane through a lift point
+ *		(capture, lift or stop) and the sowing after it, end_turns() and
+ *		gen_moves() do prep_state() and get_moves() for the lanes whose
+ *		move ended. What is left lane by lane is drawing a move, starting
+ *		it and the odd haulted move. A lane whose move goes on for
+ *		LIFT_LIMIT lift points is handed over to run_move(), which can tell
+ *		a long move from one that never ends.
+ *
+ *		The vector code is a second copy of the rules in tree.c, Hand_exec()
+ *		and get_moves_impl() above all, and must be kept in step with them.
+ *		Playout i of playouts(start, rules, seed, ...) draws the same
+ *		numbers as playout(start, rules, seed + i, ...) and so gives the
+ *		same result, which is how the two are checked against each other
+ *		(see treeTest.c).
+ *****************************************************************************/
+
+#include "playout.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	LIFT_LIMIT = 200,		/* Lift points a lane runs before run_move() takes
+							 * over its move */
+	MOVE_BYTES = MAXMOVES / 8	/* Bytes of a lane's move set, see gen_moves */
+};
+
+
+enum LaneEvent {
+	/* Lanes.event, what a lane stopped running for */
+	LE_NONE    = 0,
+	LE_DONE    = 1,
+	LE_HAULTED = 2,
+	LE_LONG    = 4
+};
+
+
+typedef uint8_t LaneVec __attribute__((vector_size(PLAYOUT_LANES)));
+
+
+#define MASK(cmp) ((LaneVec) (cmp))
+
+#define SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+/* Moves are coded 2 * hole + 1 if sown MXD_RIGHT, in get_moves() order */
+#define MOVE_CODE(hole, right) ((hole) << 1 | (right))
+
+
+struct Lanes {
+	/* Masks are 0xFF in the lanes they hold for and 0 elsewhere */
+
+	LaneVec board[NPLAYERS][NHOLES];
+
+	LaneVec nyumba[NPLAYERS];
+	/* Mask of the nyumbas still standing */
+
+	LaneVec saved[NPLAYERS][NHOLES];
+
+	LaneVec saved_nyumba[NPLAYERS];
+	/* board and nyumba as they were before the current move, to try
+	 * another one if it never ends */
+
+	LaneVec south;
+	/* Mask of lanes where P_SOUTH moves. The hand is on the mover's side
+	 * at every lift point and while sowing. */
+
+	LaneVec hole;
+
+	LaneVec nkhomo;
+
+	LaneVec right;
+	/* Mask of lanes sowing MXD_RIGHT */
+
+	LaneVec takata;
+
+	LaneVec trapped;
+	/* BaoState.trapped_hole, 0xFF for none */
+
+	LaneVec has_trap;
+	/* Mask of all lanes if the rules have the mtaji moja trap */
+
+	LaneVec max_capture;
+	/* rules->max_nkhomo_for_mtaji_capture in every lane */
+
+	LaneVec running;
+	/* Mask of lanes step_lanes() moves on */
+
+	LaneVec lifts;
+	/* Lift points the current move went through */
+
+	LaneVec event;
+	/* LaneEvent of a lane that stopped, LE_NONE while running or idle */
+
+	uint8_t moves[PLAYOUT_LANES][MAXMOVES];
+	/* MOVE_CODEs of the lane's moves not yet found to be perpetual */
+
+	int nmoves[PLAYOUT_LANES];
+
+	int chosen[PLAYOUT_LANES];
+	/* Index of the move being played in moves[] */
+
+	uint64_t rng[PLAYOUT_LANES];
+
+	int game[PLAYOUT_LANES];
+	/* Playout the lane plays, -1 once there are none left for it */
+
+	int ply[PLAYOUT_LANES];
+};
+
+
+typedef struct Lanes Lanes;
+
+
+struct Batch {
+	/* What all lanes share */
+	const BaoEngine *engine;
+	const BaoRules *rules;
+	const BaoState *start;
+	uint8_t start_moves[MAXMOVES];
+	int nstart_moves;
+	int start_takata;
+	uint64_t seed;
+	int max_plies;
+	int ngames;
+	int next_game;
+	int active;		/* Lanes with a game */
+	PlayoutResult *results;
+};
+
+
+typedef struct Batch Batch;
+
+
+/* splitmix64 */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+/*****************************************************************************
+ * play_move: Plays a random move from state on one game.
+ *
+ *		This is the rule playouts() follows lane by lane.
+ *
+ * Returns: 1 if a move was played, 0 if state had none (or only perpetual
+ *			ones) and -1 on error.
+ *****************************************************************************/
+static int play_move(BaoState *state, const BaoEngine *engine,
+		const BaoRules *rules, uint64_t *rng)
+{
+	Move moves[MAXMOVES];
+	BaoState work;
+	Hand hand;
+	int i, n, sts;
+
+	n = engine->get_moves(moves, MAXMOVES, state, rules);
+	while(n > 0) {
+		i = next_random(rng) % n;
+		work = *state;
+		init_move(&hand, &work, rules, &moves[i]);
+		sts = engine->run_move(&hand, rules);
+		if(sts == MXS_HAULTED && (next_random(rng) & 1)) {
+			continue_move(&hand);
+			sts = engine->run_move(&hand, rules);
+		}
+		if(sts == MXS_ERROR)
+			return -1;
+		if(sts != MXS_PERPETUAL) {
+			next_turn(&work, rules);
+			*state = work;
+			return 1;
+		}
+		moves[i] = moves[--n];
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * playout: Plays one random game out from start.
+ *
+ * Returns: 0, or -1 if a move could not be executed (errno is set).
+ *****************************************************************************/
+int playout(const BaoState *start, const BaoRules *rules, uint64_t seed,
+		int max_plies, PlayoutResult *result)
+{
+	const BaoEngine *engine = get_engine(rules);
+	BaoState state = *start;
+	uint64_t rng = seed;
+	int ply, sts;
+
+	for(ply = 0; ply < max_plies; ply++) {
+		if((sts = play_move(&state, engine, rules, &rng)) == -1)
+			return -1;
+		if(sts == 0) {
+			result->winner = state.player == P_NORTH ? P_SOUTH : P_NORTH;
+			result->plies = ply;
+			return 0;
+		}
+	}
+	result->winner = PLAYOUT_DRAW;
+	result->plies = ply;
+	return 0;
+}
+
+
+static int any_lane(LaneVec v)
+{
+	uint64_t w[sizeof(LaneVec) / sizeof(uint64_t)];
+	size_t i;
+
+	memcpy(w, &v, sizeof(w));
+	for(i = 1; i < sizeof(w) / sizeof(w[0]); i++)
+		w[0] |= w[i];
+	return w[0] != 0;
+}
+
+
+/* The mover's row and, for holes 0 to 7, what lies opposite */
+static void side_view(const Lanes *b, LaneVec cur[NHOLES],
+		LaneVec opp[H_RFKICHWA + 1])
+{
+	int h;
+
+	for(h = 0; h < NHOLES; h++)
+		cur[h] = SELECT(b->south, b->board[P_SOUTH][h],
+				b->board[P_NORTH][h]);
+	for(h = 0; h <= H_RFKICHWA; h++)
+		opp[h] = SELECT(b->south, b->board[P_NORTH][H_RFKICHWA - h],
+				b->board[P_SOUTH][H_RFKICHWA - h]);
+}
+
+
+/* test_mtaji_capture() at holes 0 to 7 in both directions (MXD_LEFT
+ * first), can[h] being can_capture() at h */
+static void mtaji_captures(const Lanes *b, const LaneVec cur[NHOLES],
+		const LaneVec can[H_RFKICHWA + 1],
+		LaneVec cap[H_RFKICHWA + 1][2])
+{
+	LaneVec ok, left, right;
+	uint8_t h, t;
+
+	for(h = 0; h <= H_RFKICHWA; h++) {
+		ok = MASK(cur[h] != 0) & MASK(cur[h] <= b->max_capture);
+		left = (h - cur[h]) & H_LBKICHWA;
+		right = (h + cur[h]) & H_LBKICHWA;
+		cap[h][0] = cap[h][1] = (LaneVec) {0};
+		for(t = 0; t <= H_RFKICHWA; t++) {
+			cap[h][0] |= MASK(left == t) & can[t];
+			cap[h][1] |= MASK(right == t) & can[t];
+		}
+		cap[h][0] &= ok;
+		cap[h][1] &= ok;
+	}
+}
+
+
+/*****************************************************************************
+ * step_lanes: Takes every running lane through one lift point.
+ *
+ *		Hand_exec() and Hand_sow_all() with the lanes side by side: the
+ *		hand lifts, captures or stops where it lies, then sows all it
+ *		holds. Lanes that start a move with seeds in hand only sow. Lanes
+ *		that stop get their LaneEvent set and are taken off running.
+ *****************************************************************************/
+static void step_lanes(Lanes *b)
+{
+	LaneVec south = b->south, north = ~b->south, hole = b->hole;
+	LaneVec cur, opp, opposing, store, ny, atlift, cap, canlift, atny, stop,
+			nylift, trapdone, lift, done, haulted, m, om, reset_right, right,
+			first, n, laps, rem, add, sow, tolong;
+	uint8_t h;
+
+	/* What the hand sees: its hole, the one opposite and its store */
+	opposing = SELECT(MASK(hole <= H_RFKICHWA), H_RFKICHWA - hole,
+			H_STORE + H_RFKICHWA - hole);
+	cur = opp = (LaneVec) {0};
+	for(h = 0; h < H_STORE; h++) {
+		m = MASK(hole == h);
+		om = MASK(opposing == h);
+		cur |= m & SELECT(south, b->board[P_SOUTH][h], b->board[P_NORTH][h]);
+		opp |= om & SELECT(south, b->board[P_NORTH][h], b->board[P_SOUTH][h]);
+	}
+	store = SELECT(south, b->board[P_SOUTH][H_STORE],
+			b->board[P_NORTH][H_STORE]);
+	ny = SELECT(south, b->nyumba[P_SOUTH], b->nyumba[P_NORTH]);
+
+	/* Hand_exec() at a lift point */
+	atlift = b->running & MASK(b->nkhomo == 0);
+	cap = atlift & MASK(hole <= H_RFKICHWA) & ~b->takata & MASK(cur > 1)
+		& MASK(opp != 0);
+	canlift = atlift & ~cap & MASK(cur > 1);
+	atny = canlift & MASK(hole == H_NYUMBA) & ny;
+	stop = atny & MASK(store != 0);
+	nylift = atny & MASK(store == 0);
+	trapdone = canlift & ~atny & MASK(store == 0) & b->takata
+		& MASK(hole == b->trapped) & b->has_trap;
+	lift = canlift & ~stop & ~trapdone;
+	done = (atlift & ~cap & ~canlift) | trapdone | (stop & b->takata);
+	haulted = stop & ~b->takata;
+	b->event |= (done & LE_DONE) | (haulted & LE_HAULTED);
+	b->running &= ~(done | haulted);
+	b->lifts += atlift & 1;
+
+	for(h = 0; h < H_STORE; h++) {
+		m = MASK(hole == h) & lift;
+		om = MASK(opposing == h) & cap;
+		b->board[P_NORTH][h] &= ~((m & north) | (om & south));
+		b->board[P_SOUTH][h] &= ~((m & south) | (om & north));
+	}
+	b->nkhomo |= (cur & lift) | (opp & cap);
+	m = cap & MASK(opposing == H_NYUMBA);
+	b->nyumba[P_NORTH] &= ~((m & south) | (nylift & north));
+	b->nyumba[P_SOUTH] &= ~((m & north) | (nylift & south));
+
+	/* Sowing starts next to the hole, or from a kichwa after a capture
+	 * (Hand_reset()) */
+	reset_right = MASK(hole <= H_LFKIMBI)
+		| (~MASK(hole >= H_RFKIMBI) & b->right);
+	right = SELECT(cap, reset_right, b->right);
+	first = SELECT(cap, SELECT(reset_right, H_LFKICHWA, H_RFKICHWA),
+			SELECT(b->right, hole + 1, hole - 1) & H_LBKICHWA);
+	sow = b->running & MASK(b->nkhomo != 0);
+	n = b->nkhomo & sow;
+	laps = n >> 4;
+	rem = n & H_LBKICHWA;
+	for(h = 0; h <= H_LBKICHWA; h++) {
+		add = laps + (MASK((SELECT(right, h - first, first - h)
+						& H_LBKICHWA) < rem) & 1);
+		b->board[P_NORTH][h] += add & north;
+		b->board[P_SOUTH][h] += add & south;
+	}
+	b->hole = SELECT(sow, SELECT(right, first + n - 1, first - n + 1)
+			& H_LBKICHWA, hole);
+	b->right = SELECT(sow, right, b->right);
+	b->nkhomo &= ~sow;
+
+	tolong = b->running & MASK(b->lifts >= LIFT_LIMIT);
+	b->event |= tolong & LE_LONG;
+	b->running &= ~tolong;
+}
+
+
+/* prep_state() on the lanes in done, whose moves have ended */
+static void end_turns(Lanes *b, LaneVec done)
+{
+	LaneVec cur[NHOLES], opp[H_RFKICHWA + 1], can[H_RFKICHWA + 1],
+			cap[H_RFKICHWA + 1][2], holes, count, which, trap;
+	uint8_t h;
+
+	/* get_mtaji_moja_trap(): after a mtaji takata, the mover's captures
+	 * all start at one hole */
+	trap = done & b->takata & b->has_trap & MASK(SELECT(b->south,
+				b->board[P_SOUTH][H_STORE], b->board[P_NORTH][H_STORE]) == 0);
+	if(any_lane(trap)) {
+		side_view(b, cur, opp);
+		for(h = 0; h <= H_RFKICHWA; h++)
+			can[h] = MASK(cur[h] != 0) & MASK(opp[h] != 0);
+		mtaji_captures(b, cur, can, cap);
+		count = which = (LaneVec) {0};
+		for(h = 0; h <= H_RFKICHWA; h++) {
+			holes = cap[h][0] | cap[h][1];
+			count += holes & 1;
+			which |= holes & h;
+		}
+		trap &= MASK(count == 1);
+		which |= ~trap;
+	} else {
+		which = ~trap;
+	}
+	b->trapped = SELECT(done, which, b->trapped);
+	b->takata &= ~done;
+	b->south ^= done;
+}
+
+
+/*****************************************************************************
+ * gen_moves: get_moves() on the lanes in need.
+ *
+ *		Each lane gets its moves as a set of MOVE_CODEs, bit c % 8 of
+ *		set[c / 8], and takata is set the way get_moves() sets it. Both
+ *		take the first kind of move a lane has from the same list. The
+ *		namua takata singletons on that list are left out here, there are
+ *		none unless there are namua takatas.
+ *****************************************************************************/
+static void gen_moves(Lanes *b, LaneVec need, LaneVec set[MOVE_BYTES])
+{
+	LaneVec cur[NHOLES], opp[H_RFKICHWA + 1], can[H_RFKICHWA + 1],
+			cap[H_RFKICHWA + 1][2], ntak[H_RFKICHWA + 1],
+			mtak[H_LBKICHWA + 1], ny, namua, trap, tcur, others, anycap,
+			anyntak, anymcap, anyfront, anyback, special, use_cap, use_ntak,
+			use_nyumba, use_mcap, use_front, use_special, use_back, move;
+	uint8_t h, right;
+	int c;
+
+	side_view(b, cur, opp);
+	ny = SELECT(b->south, b->nyumba[P_SOUTH], b->nyumba[P_NORTH]);
+	namua = MASK(cur[H_STORE] != 0);
+
+	/* test_namua_capture(), test_namua_takata(), test_mtaji_capture() and
+	 * test_mtaji_takata() */
+	anycap = anyntak = anymcap = anyfront = anyback = (LaneVec) {0};
+	tcur = others = (LaneVec) {0};
+	for(h = 0; h <= H_RFKICHWA; h++) {
+		can[h] = MASK(cur[h] != 0) & MASK(opp[h] != 0);
+		anycap |= can[h];
+		ntak[h] = MASK(cur[h] != 0);
+		if(h == H_NYUMBA)
+			ntak[h] &= ~ny;
+		anyntak |= ntak[h];
+	}
+	mtaji_captures(b, cur, can, cap);
+	for(h = 0; h <= H_LBKICHWA; h++) {
+		trap = b->has_trap & MASK(b->trapped == h);
+		if(h == H_NYUMBA)
+			trap &= ~ny;
+		mtak[h] = MASK(cur[h] > 1) & ~trap;
+		if(h <= H_RFKICHWA) {
+			anymcap |= cap[h][0] | cap[h][1];
+			anyfront |= mtak[h];
+		} else {
+			anyback |= mtak[h];
+		}
+	}
+
+	/* test_mtaji_special(): the trapped hole is the only one to sow */
+	for(h = 0; h <= H_RFKICHWA; h++) {
+		trap = MASK(b->trapped == h);
+		tcur |= trap & cur[h];
+		others |= MASK(cur[h] > 1) & ~trap;
+	}
+	special = MASK(b->trapped <= H_RFKICHWA) & MASK(tcur > 1) & ~others;
+
+	/* The first kind of move a lane has */
+	use_cap = namua & anycap;
+	use_ntak = namua & ~anycap & anyntak;
+	use_nyumba = namua & ~anycap & ~anyntak & ny & MASK(cur[H_NYUMBA] != 0);
+	use_mcap = ~namua & anymcap;
+	use_front = ~namua & ~anymcap & anyfront;
+	use_special = ~namua & ~anymcap & ~anyfront & special;
+	use_back = ~namua & ~anymcap & ~anyfront & ~special & anyback;
+
+	for(c = 0; c < MOVE_BYTES; c++)
+		set[c] = (LaneVec) {0};
+	for(h = 0; h <= H_LBKICHWA; h++) {
+		for(right = 0; right < 2; right++) {
+			if(h <= H_RFKICHWA)
+				move = (use_cap & can[h]) | (use_ntak & ntak[h])
+					| (use_mcap & cap[h][right]) | (use_front & mtak[h])
+					| (use_special & MASK(b->trapped == h))
+					| (h == H_NYUMBA ? use_nyumba : (LaneVec) {0});
+			else
+				move = use_back & mtak[h];
+			c = MOVE_CODE(h, right);
+			set[c / 8] |= move & need & (uint8_t) (1 << c % 8);
+		}
+	}
+	b->takata = SELECT(need, use_ntak | use_nyumba | use_front | use_special
+			| use_back, b->takata);
+}
+
+
+/* Loads state into lane l as the position of a new game */
+static void load_lane(Lanes *b, int l, const BaoState *state, int takata)
+{
+	int p, h;
+
+	for(p = 0; p < NPLAYERS; p++) {
+		for(h = 0; h < NHOLES; h++)
+			b->board[p][h][l] = b->saved[p][h][l] = state->board[p][h];
+		b->nyumba[p][l] = b->saved_nyumba[p][l] = state->nyumba[p] ? 0xFF : 0;
+	}
+	b->south[l] = state->player == P_SOUTH ? 0xFF : 0;
+	b->takata[l] = takata ? 0xFF : 0;
+	b->trapped[l] = (unsigned int) state->trapped_hole <= H_RFKICHWA
+		? state->trapped_hole : 0xFF;
+}
+
+
+/* Builds lane l's position and hand for the scalar engine */
+static void lane_state(const Lanes *b, int l, BaoState *state, Hand *hand,
+		const BaoRules *rules)
+{
+	int p, h;
+
+	memset(state, 0, sizeof(BaoState));
+	for(p = 0; p < NPLAYERS; p++) {
+		for(h = 0; h < NHOLES; h++)
+			state->board[p][h] = b->board[p][h][l];
+		state->nyumba[p] = b->nyumba[p][l] ? rules->has_nyumba : 0;
+	}
+	state->takata = b->takata[l] != 0;
+	state->trapped_hole = b->trapped[l] == 0xFF ? -1 : b->trapped[l];
+	state->player = b->south[l] ? P_SOUTH : P_NORTH;
+	hand->state = state;
+	hand->side = state->player;
+	hand->hole = b->hole[l];
+	hand->nkhomo = b->nkhomo[l];
+	hand->dir = b->right[l] ? MXD_RIGHT : MXD_LEFT;
+}
+
+
+/* Draws one of lane l's moves and starts it the way Hand_start() does */
+static void pick_move(Batch *t, Lanes *b, int l)
+{
+	int p, hole, i;
+
+	i = next_random(&b->rng[l]) % b->nmoves[l];
+	b->chosen[l] = i;
+	hole = b->moves[l][i] >> 1;
+	p = b->south[l] ? P_SOUTH : P_NORTH;
+	b->hole[l] = hole;
+	b->right[l] = b->moves[l][i] & 1 ? 0xFF : 0;
+	b->nkhomo[l] = 0;
+	if(b->board[p][H_STORE][l]) {
+		b->board[p][H_STORE][l]--;
+		b->board[p][hole][l]++;
+		if(b->takata[l] && hole == H_NYUMBA && b->nyumba[p][l]
+		&& b->board[p][H_NYUMBA][l]
+				>= t->rules->min_nkhomo_for_namua_special) {
+			b->board[p][H_NYUMBA][l]--;
+			b->board[p][H_STORE][l]--;
+			b->nkhomo[l] = 2;
+		}
+	} else {
+		if(!b->takata[l])
+			b->nyumba[P_NORTH][l] = b->nyumba[P_SOUTH][l] = 0;
+		b->nkhomo[l] = b->board[p][hole][l];
+		b->board[p][hole][l] = 0;
+	}
+	b->running[l] = 0xFF;
+	b->lifts[l] = 0;
+}
+
+
+/* Gives lane l the next playout, or leaves it idle if none are left */
+static void start_game(Batch *t, Lanes *b, int l)
+{
+	PlayoutResult *res;
+
+	while(t->next_game < t->ngames) {
+		b->game[l] = t->next_game++;
+		b->rng[l] = t->seed + b->game[l];
+		b->ply[l] = 0;
+		if(t->max_plies > 0 && t->nstart_moves > 0) {
+			load_lane(b, l, t->start, t->start_takata);
+			memcpy(b->moves[l], t->start_moves, t->nstart_moves);
+			b->nmoves[l] = t->nstart_moves;
+			pick_move(t, b, l);
+			return;
+		}
+		res = &t->results[b->game[l]];
+		if(t->max_plies == 0)
+			res->winner = PLAYOUT_DRAW;
+		else
+			res->winner = t->start->player == P_NORTH ? P_SOUTH : P_NORTH;
+		res->plies = 0;
+	}
+	b->game[l] = -1;
+	t->active--;
+}
+
+
+static void end_game(Batch *t, Lanes *b, int l, int winner)
+{
+	t->results[b->game[l]].winner = winner;
+	t->results[b->game[l]].plies = b->ply[l];
+	start_game(t, b, l);
+}
+
+
+/* Lane l's move never ends, it gets another one if there are any left */
+static void drop_move(Batch *t, Lanes *b, int l)
+{
+	int p, h;
+
+	for(p = 0; p < NPLAYERS; p++) {
+		for(h = 0; h < NHOLES; h++)
+			b->board[p][h][l] = b->saved[p][h][l];
+		b->nyumba[p][l] = b->saved_nyumba[p][l];
+	}
+	b->moves[l][b->chosen[l]] = b->moves[l][--b->nmoves[l]];
+	if(b->nmoves[l] == 0)
+		end_game(t, b, l, b->south[l] ? P_NORTH : P_SOUTH);
+	else
+		pick_move(t, b, l);
+}
+
+
+/*****************************************************************************
+ * settle_lane: Sees to a lane that stopped running.
+ *
+ * Returns: 1 if the lane's move is over, 0 if it runs on (or has started
+ *			another) and -1 on error.
+ *****************************************************************************/
+static int settle_lane(Batch *t, Lanes *b, int l)
+{
+	BaoState state;
+	Hand hand;
+	int p, h, sts;
+
+	sts = b->event[l] == LE_DONE ? MXS_DONE : MXS_HAULTED;
+	if(b->event[l] == LE_LONG) {
+		lane_state(b, l, &state, &hand, t->rules);
+		if((sts = t->engine->run_move(&hand, t->rules)) == MXS_ERROR)
+			return -1;
+		for(p = 0; p < NPLAYERS; p++) {
+			for(h = 0; h < NHOLES; h++)
+				b->board[p][h][l] = state.board[p][h];
+			b->nyumba[p][l] = state.nyumba[p] ? 0xFF : 0;
+		}
+		b->hole[l] = hand.hole;
+		b->nkhomo[l] = hand.nkhomo;
+		b->right[l] = hand.dir == MXD_RIGHT ? 0xFF : 0;
+	}
+	b->event[l] = LE_NONE;
+	if(sts == MXS_PERPETUAL) {
+		drop_move(t, b, l);
+		return 0;
+	}
+	if(sts == MXS_HAULTED && (next_random(&b->rng[l]) & 1)) {
+		/* continue_move() */
+		b->nyumba[b->south[l] ? P_SOUTH : P_NORTH][l] = 0;
+		b->running[l] = 0xFF;
+		b->lifts[l] = 0;
+		return 0;
+	}
+	return 1;
+}
+
+
+/* Moves the lanes that need one on to their next move */
+static void next_moves(Batch *t, Lanes *b, LaneVec need)
+{
+	LaneVec set[MOVE_BYTES];
+	int p, h, l, c, bits;
+
+	gen_moves(b, need, set);
+	for(p = 0; p < NPLAYERS; p++) {
+		for(h = 0; h < NHOLES; h++)
+			b->saved[p][h] = SELECT(need, b->board[p][h], b->saved[p][h]);
+		b->saved_nyumba[p] = SELECT(need, b->nyumba[p], b->saved_nyumba[p]);
+	}
+	for(l = 0; l < PLAYOUT_LANES; l++) {
+		if(!need[l])
+			continue;
+		b->nmoves[l] = 0;
+		for(c = 0; c < MOVE_BYTES; c++)
+			for(bits = set[c][l]; bits; bits &= bits - 1)
+				b->moves[l][b->nmoves[l]++] = c * 8 + __builtin_ctz(bits);
+		if(b->nmoves[l] == 0)
+			end_game(t, b, l, b->south[l] ? P_NORTH : P_SOUTH);
+		else
+			pick_move(t, b, l);
+	}
+}
+
+
+/*****************************************************************************
+ * run_lanes: Plays on until every game is over.
+ *
+ *		Lanes whose moves end wait for the others until half of them are
+ *		waiting (or none are running) and end_turns() and gen_moves() take
+ *		them on together, the two cost the same for one lane as for all.
+ *****************************************************************************/
+static int run_lanes(Batch *t, Lanes *b)
+{
+	LaneVec waiting, need;
+	int l, sts, nwaiting;
+
+	waiting = (LaneVec) {0};
+	nwaiting = 0;
+	while(t->active > 0) {
+		step_lanes(b);
+		if(!any_lane(b->event))
+			continue;
+		for(l = 0; l < PLAYOUT_LANES; l++) {
+			if(b->event[l] == LE_NONE)
+				continue;
+			if((sts = settle_lane(t, b, l)) == -1)
+				return -1;
+			if(sts) {
+				waiting[l] = 0xFF;
+				nwaiting++;
+			}
+		}
+		if(nwaiting == 0 || (nwaiting < PLAYOUT_LANES / 2
+					&& any_lane(b->running)))
+			continue;
+		end_turns(b, waiting);
+		need = (LaneVec) {0};
+		for(l = 0; l < PLAYOUT_LANES; l++) {
+			if(!waiting[l])
+				continue;
+			if(++b->ply[l] == t->max_plies)
+				end_game(t, b, l, PLAYOUT_DRAW);
+			else
+				need[l] = 0xFF;
+		}
+		waiting = (LaneVec) {0};
+		nwaiting = 0;
+		if(any_lane(need))
+			next_moves(t, b, need);
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * playouts: Plays n random games out from start, PLAYOUT_LANES at a time.
+ *
+ *		results[i] is what playout() gives with seed + i. Batches too small
+ *		to fill half the lanes are played one game after another.
+ *
+ * Returns: 0, or -1 on error (errno is set).
+ *****************************************************************************/
+int playouts(const BaoState *start, const BaoRules *rules, uint64_t seed,
+		int n, int max_plies, PlayoutResult *results)
+{
+	Move moves[MAXMOVES];
+	BaoState s;
+	Batch t;
+	Lanes *b;
+	int i, l, sts;
+
+	if(n < PLAYOUT_LANES / 2) {
+		for(i = 0; i < n; i++)
+			if(playout(start, rules, seed + i, max_plies, &results[i]) == -1)
+				return -1;
+		return 0;
+	}
+	if(posix_memalign((void **) &b, sizeof(LaneVec), sizeof(Lanes)) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(b, 0, sizeof(Lanes));
+	memset(&b->has_trap, rules->has_mtaji_moja_trap ? 0xFF : 0,
+			sizeof(LaneVec));
+	memset(&b->max_capture, rules->max_nkhomo_for_mtaji_capture < 0xFF
+			? rules->max_nkhomo_for_mtaji_capture : 0xFF, sizeof(LaneVec));
+
+	t.engine = get_engine(rules);
+	t.rules = rules;
+	t.start = start;
+	s = *start;
+	t.nstart_moves = t.engine->get_moves(moves, MAXMOVES, &s, rules);
+	for(i = 0; i < t.nstart_moves; i++)
+		t.start_moves[i] = MOVE_CODE(moves[i].hole, moves[i].dir == MXD_RIGHT);
+	t.start_takata = s.takata;
+	t.seed = seed;
+	t.max_plies = max_plies;
+	t.ngames = n;
+	t.next_game = 0;
+	t.active = PLAYOUT_LANES;
+	t.results = results;
+
+	for(l = 0; l < PLAYOUT_LANES; l++)
+		start_game(&t, b, l);
+	sts = run_lanes(&t, b);
+	free(b);
+	return sts;
+}
@@ -0,0 +1,35 @@
+#ifndef BAOPLAYOUT_H
+#define BAOPLAYOUT_H
+
+#include "tree.h"
+
+#include <stdint.h>
+
+
+enum {
+	PLAYOUT_LANES = 16,		/* Games playouts() advances side by side */
+	PLAYOUT_DRAW  = -1		/* PlayoutResult.winner of a game cut short */
+};
+
+
+struct PlayoutResult {
+	int winner;
+	/* Player that won, PLAYOUT_DRAW if max_plies ran out first */
+
+	int plies;
+	/* Plies played */
+};
+
+
+typedef struct PlayoutResult PlayoutResult;
+
+
+int playout(const BaoState *start, const BaoRules *rules, uint64_t seed,
+		int max_plies, PlayoutResult *result);
+
+
+int playouts(const BaoState *start, const BaoRules *rules, uint64_t seed,
+		int n, int max_plies, PlayoutResult *results);
+
+
+#endif /* BAOPLAYOUT_H */
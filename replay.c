@@ -0,0 +1,200 @@
+/******************************************************************************
+ *	replay.c: Step by step playback of a child's move
+ *
+ *		The move is executed once on a copy of the parent's state, one
+ *		exec_move() step at a time, keeping for each step the single hole
+ *		it changed (value before and after), the nkhomo in hand and the
+ *		nyumba flags: five bytes a step. Going one step forward or back
+ *		then writes one hole, so a front end can scrub through a move of
+ *		any length without executing it again or touching the tree.
+ *****************************************************************************/
+
+#include "replay.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define NYUMBA_BITS(state) \
+	(((state)->nyumba[P_NORTH] != 0) | ((state)->nyumba[P_SOUTH] != 0) << 1)
+
+
+static int push_step(MoveReplay *replay, uint32_t *size,
+		const BaoState *before, const Hand *hand)
+{
+	ReplayStep *step, *p;
+	int cell;
+
+	if(replay->nsteps == *size) {
+		if(*size == REPLAY_MAX_STEPS) {
+			errno = E2BIG;
+			return -1;
+		}
+		*size = *size ? 2 * *size : 64;
+		p = (ReplayStep *) realloc(replay->steps, *size * sizeof(ReplayStep));
+		if(p == NULL)
+			return -1;
+		replay->steps = p;
+	}
+	cell = hand->side * NHOLES + hand->hole;
+	step = &replay->steps[replay->nsteps++];
+	step->cell = cell;
+	step->before = (&before->board[0][0])[cell];
+	step->after = (&hand->state->board[0][0])[cell];
+	step->nkhomo = hand->nkhomo;
+	step->nyumba = NYUMBA_BITS(before) | NYUMBA_BITS(hand->state) << 2;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * replay_record: Executes the move to node's child path into replay.
+ *
+ *		node must have been grown (see grow_tree). replay is left at step
+ *		0. A haulted move is followed as far as the child does: stopped
+ *		at nyumba or carried on.
+ *
+ * Returns: 0 on success, -1 if out of memory, path is not one of node's
+ *			children (errno EINVAL) or the move takes more than
+ *			REPLAY_MAX_STEPS (E2BIG).
+ *****************************************************************************/
+int replay_record(MoveReplay *replay, const BaoTree *node, unsigned int path,
+		const BaoRules *rules)
+{
+	const BaoTree *child;
+	BaoState work, before, next;
+	Hand hand;
+	uint32_t size;
+	int sts;
+
+	if(path >= node->nchildren) {
+		errno = EINVAL;
+		return -1;
+	}
+	child = &node->children[path];
+	memset(replay, 0, sizeof(MoveReplay));
+	work = node->state;
+	init_move(&hand, &work, rules, &child->move);
+	replay->start = hand;
+	replay->start.state = NULL;
+	replay->state = work;
+	size = 0;
+	for(;;) {
+		before = work;
+		sts = exec_move(&hand, rules, 1);
+		if(sts == MXS_NOTDONE) {
+			if(push_step(replay, &size, &before, &hand) == -1) {
+				replay_free(replay);
+				return -1;
+			}
+			continue;
+		}
+		if(sts == MXS_HAULTED) {
+			next = work;
+			next_turn(&next, rules);
+			if(cmp_state(&next, &child->state) != 0) {
+				/* The child went on past nyumba */
+				continue_move(&hand);
+				continue;
+			}
+		}
+		break;
+	}
+	replay->status = sts;
+	replay->side = replay->start.side;
+	replay->hole = replay->start.hole;
+	replay->nkhomo = replay->start.nkhomo;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * replay_children: replay_record() for every child of node.
+ *
+ *		For front ends that would rather keep the moves of a position
+ *		ready to play back than record each one as it gets picked. The
+ *		tree is left as it was.
+ *
+ * Returns: node->nchildren MoveReplays in one block, to be freed with
+ *			replay_free() on each then free(), NULL on error (errno set)
+ *			or if node has no children.
+ *****************************************************************************/
+MoveReplay *replay_children(const BaoTree *node, const BaoRules *rules)
+{
+	MoveReplay *replays;
+	unsigned int i;
+	int err;
+
+	if(node->nchildren == 0)
+		return NULL;
+	replays = (MoveReplay *) calloc(node->nchildren, sizeof(MoveReplay));
+	if(replays == NULL)
+		return NULL;
+	for(i = 0; i < node->nchildren; i++) {
+		if(replay_record(&replays[i], node, i, rules) == -1) {
+			err = errno;
+			while(i--)
+				replay_free(&replays[i]);
+			free(replays);
+			errno = err;
+			return NULL;
+		}
+	}
+	return replays;
+}
+
+
+/*****************************************************************************
+ * replay_seek: Moves replay to step, forwards or backwards.
+ *
+ *		Takes one hole write per step between the current step and the
+ *		new one.
+ *
+ * Returns: 0 on success, -1 (errno EINVAL) if step is past the end.
+ *****************************************************************************/
+int replay_seek(MoveReplay *replay, uint32_t step)
+{
+	unsigned char *board = &replay->state.board[0][0];
+	const ReplayStep *s;
+	int nyumba;
+
+	if(step > replay->nsteps) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(step == replay->step)
+		return 0;
+	for(; replay->step < step; replay->step++) {
+		s = &replay->steps[replay->step];
+		board[s->cell] = s->after;
+	}
+	for(; replay->step > step; replay->step--) {
+		s = &replay->steps[replay->step - 1];
+		board[s->cell] = s->before;
+	}
+	if(step == 0) {
+		nyumba = replay->steps[0].nyumba;
+		replay->side = replay->start.side;
+		replay->hole = replay->start.hole;
+		replay->nkhomo = replay->start.nkhomo;
+	} else {
+		s = &replay->steps[step - 1];
+		nyumba = s->nyumba >> 2;
+		replay->side = s->cell / NHOLES;
+		replay->hole = s->cell % NHOLES;
+		replay->nkhomo = s->nkhomo;
+	}
+	replay->state.nyumba[P_NORTH] = nyumba & 1;
+	replay->state.nyumba[P_SOUTH] = (nyumba >> 1) & 1;
+	return 0;
+}
+
+
+void replay_free(MoveReplay *replay)
+{
+	free(replay->steps);
+	replay->steps = NULL;
+	replay->nsteps = 0;
+	replay->step = 0;
+}
@@ -0,0 +1,83 @@
+#ifndef BAOREPLAY_H
+#define BAOREPLAY_H
+
+#include "tree.h"
+
+#include <stdint.h>
+
+
+enum {
+	REPLAY_MAX_STEPS = 1 << 24	/* Longest move replay_record() keeps */
+};
+
+
+struct ReplayStep {
+	/* What one exec_move() step changed. Every step lifts from or sows
+	 * into a single hole, the one the hand ends up on. */
+
+	uint8_t cell;
+	/* side * NHOLES + hole */
+
+	uint8_t before;
+
+	uint8_t after;
+	/* nkhomo in cell */
+
+	uint8_t nkhomo;
+	/* nkhomo in hand after the step */
+
+	uint8_t nyumba;
+	/* Nyumba of north (bit 0) and south (bit 1) before the step, the same
+	 * again shifted 2 bits up after it */
+};
+
+
+struct MoveReplay {
+	/* A move executed once, to be played back and forth step by step
+	 * without executing it again (see replay_seek) */
+
+	BaoState state;
+	/* Position at step, read only. Step 0 is right after start_move(),
+	 * step nsteps is where the move stopped, before the opponent's turn
+	 * (see next_turn). */
+
+	Player side;
+
+	Hole hole;
+
+	unsigned int nkhomo;
+	/* Where the hand is at step and what it holds */
+
+	uint32_t step;
+
+	uint32_t nsteps;
+
+	MoveExecSts status;
+	/* How the move ended, MXS_DONE or MXS_HAULTED */
+
+	struct ReplayStep *steps;
+
+	struct Hand start;
+	/* Hand at step 0, its state pointer unused */
+};
+
+
+typedef struct ReplayStep ReplayStep;
+
+typedef struct MoveReplay MoveReplay;
+
+
+int replay_record(MoveReplay *replay, const BaoTree *node, unsigned int path,
+		const BaoRules *rules);
+
+
+MoveReplay *replay_children(const BaoTree *node, const BaoRules *rules);
+
+
+int replay_seek(MoveReplay *replay, uint32_t step);
+
+
+void replay_free(MoveReplay *replay);
+
+
+#endif /* BAOREPLAY_H */
@@ -0,0 +1,18 @@
+#include "rules.h"
+
+
+#define UNPAREN(...) __VA_ARGS__
+
+
+const BaoRules rules[NRULES] = {
+#define BAO_RULESET(name, board, ...) {{UNPAREN board}, __VA_ARGS__},
+#include "rules.def"
+#undef BAO_RULESET
+};
+
+
+const char *rules_names[NRULES] = {
+#define BAO_RULESET(name, ...) #name,
+#include "rules.def"
+#undef BAO_RULESET
+};
@@ -0,0 +1,21 @@
+#ifndef BAORULES_H
+#define BAORULES_H
+
+#include "tree.h"
+
+
+enum {
+	/* One per variant in rules.def, in order */
+#define BAO_RULESET(name, ...) RULES_##name,
+#include "rules.def"
+#undef BAO_RULESET
+	NRULES
+};
+
+
+extern const BaoRules rules[NRULES];
+
+extern const char *rules_names[NRULES];
+
+
+#endif /* BAORULES_H */
@@ -0,0 +1,672 @@
+/******************************************************************************
+ *	server.c: Many games in one process
+ *
+ *		serve() listens on a Unix socket and makes every connection a
+ *		session: a game of its own (tree and rule set) driven by line
+ *		commands. The sessions' searches run on one pool of worker threads
+ *		and share one transposition table (see tt_set_shared, the rules are
+ *		mixed into its keys).
+ *
+ *		A session has at most one search queued or running. Idle workers
+ *		take the queued search with the earliest deadline, so no session
+ *		can crowd the others out. A search deepens until its deadline
+ *		(counted from when its "go" came in) and answers with the best
+ *		move of the deepest depth done, depth 0 always gets done.
+ *
+ *		Commands, one per line, each answered with one line:
+ *			rules NAME	new game under rules NAME (see rules.def)
+ *			new			new game under the same rules
+ *			board		the position
+ *			moves		the legal moves, written as in baodb.c ("5+ 12-n")
+ *			play MOVE	plays MOVE
+ *			time MS		time a "go" without one gets
+ *			go [MS]		searches, "bestmove MOVE ..." comes once it is done
+ *			stop		ends the search now
+ *			stats		percentiles of this session's go to bestmove times
+ *			quit
+ *
+ *		Sessions are under one lock. The main thread polls the sockets and
+ *		stops searches at their deadline, workers only search. Trees get
+ *		grown by several threads at once, so no tree budget may be set
+ *		(see set_tree_budget): eviction could free another session's nodes
+ *		under its search. serve() fails with EBUSY if one is.
+ *****************************************************************************/
+
+#include "server.h"
+#include "move_io.h"
+#include "error.h"
+#include "rules.h"
+#include "stats.h"
+#include "tt.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+enum {
+	LINE_SIZE        = 256,		/* Longest command line */
+	REPLY_SIZE       = 1024,
+	LAT_SAMPLES      = 1024,	/* Latest search times kept per session */
+	MAX_SESSIONS     = 1024,
+	SERVER_MAX_DEPTH = 30
+};
+
+
+enum SessionState {
+	S_IDLE,
+	S_QUEUED,		/* job waits for a worker */
+	S_SEARCHING		/* A worker runs job, only it may touch tree */
+};
+
+
+struct Session {
+	struct Session *next;
+	int fd;
+	int id;
+	int variant;			/* Index into rules[] */
+	BaoTree *tree;
+
+	char line[LINE_SIZE];	/* Command read so far */
+	size_t len;
+
+	int state;				/* See enum SessionState */
+	int closing;			/* Client gone, freed once job is done */
+	SearchJob *job;
+	int depth_done;			/* Deepest depth job has done, see on_progress */
+	unsigned long long request_ns;
+	unsigned long long deadline_ns;
+	int movetime_ms;
+
+	unsigned long long lat_ns[LAT_SAMPLES];
+	unsigned long long nsearches;
+	/* Go to bestmove times, the last LAT_SAMPLES of nsearches */
+};
+
+
+struct Server {
+	const ServerConfig *cfg;
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* Signalled when a search gets queued */
+	struct Session *sessions;
+	int nsessions;
+	int next_id;
+	int stop;
+};
+
+
+typedef struct Session Session;
+
+typedef struct Server Server;
+
+
+static volatile sig_atomic_t stop_requested;
+
+static int wake_fd = -1;	/* Write end of the pipe that wakes poll() */
+
+
+static void on_signal(int sig)
+{
+	int saved = errno;
+
+	stop_requested = 1;
+	if(write(wake_fd, "", 1) == -1)
+		;	/* Pipe full, poll() wakes anyway */
+	errno = saved;
+}
+
+
+/* Sends s a line, the server lock must be held */
+static void reply(Session *s, const char *fmt, ...)
+{
+	char buf[REPLY_SIZE];
+	va_list ap;
+	int n;
+
+	if(s->fd == -1)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+	if(n > (int) sizeof(buf) - 2)
+		n = sizeof(buf) - 2;
+	buf[n++] = '\n';
+	/* A client that does not read its replies loses them */
+	send(s->fd, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+
+static int cmp_ns(const void *a, const void *b)
+{
+	const unsigned long long *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+
+/* Puts s's latency percentiles in buf, the server lock must be held */
+static void format_latency(char *buf, size_t size, const Session *s)
+{
+	static const int pct[] = {50, 90, 99, 100};
+	unsigned long long lat[LAT_SAMPLES];
+	size_t n, i;
+	int len;
+
+	n = s->nsearches < LAT_SAMPLES ? s->nsearches : LAT_SAMPLES;
+	len = snprintf(buf, size, "latency n=%llu", s->nsearches);
+	if(n == 0)
+		return;
+	memcpy(lat, s->lat_ns, n * sizeof(*lat));
+	qsort(lat, n, sizeof(*lat), cmp_ns);
+	for(i = 0; i < sizeof(pct) / sizeof(pct[0]) && len < size; i++)
+		if(pct[i] == 100)
+			len += snprintf(buf + len, size - len, " max=%.1fms",
+					lat[n - 1] / 1e6);
+		else
+			len += snprintf(buf + len, size - len, " p%d=%.1fms", pct[i],
+					lat[(n - 1) * pct[i] / 100] / 1e6);
+}
+
+
+/* Called on the search's worker after each depth and every REPORT_MS */
+static void on_progress(const SearchProgress *p, void *arg)
+{
+	Session *s = (Session *) arg;
+
+	__atomic_store_n(&s->depth_done, p->depth, __ATOMIC_RELAXED);
+	/* A depth that ended past the deadline, the main thread leaves
+	 * searches without one be */
+	if(p->depth >= 0 && stats_now_ns() >= s->deadline_ns)
+		search_cancel(s->job);
+}
+
+
+static void free_session(Server *sv, Session *s)
+{
+	Session **pp;
+	char buf[REPLY_SIZE];
+
+	for(pp = &sv->sessions; *pp != s; pp = &(*pp)->next)
+		;
+	*pp = s->next;
+	sv->nsessions--;
+	format_latency(buf, sizeof(buf), s);
+	fprintf(stderr, "session %d closed, %s\n", s->id, buf);
+	if(s->fd != -1)
+		close(s->fd);
+	free_tree(s->tree);
+	free(s);
+}
+
+
+/* Answers s's search, the server lock must be held */
+static void finish_search(Server *sv, Session *s)
+{
+	SearchProgress p;
+	unsigned long long lat;
+	char move[16];
+
+	search_wait(s->job, &p);
+	s->job = NULL;
+	s->state = S_IDLE;
+	if(s->closing) {
+		free_session(sv, s);
+		return;
+	}
+	lat = stats_now_ns() - s->request_ns;
+	s->lat_ns[s->nsearches++ % LAT_SAMPLES] = lat;
+	if(p.best_path == -1) {
+		reply(s, "bestmove none");
+		return;
+	}
+	format_move(move, sizeof(move), &s->tree->children[p.best_path].move);
+	reply(s, "bestmove %s score %d depth %d nodes %llu ms %.1f", move,
+			p.score, p.depth, p.nodes, lat / 1e6);
+}
+
+
+static void *worker(void *arg)
+{
+	Server *sv = (Server *) arg;
+	Session *s, *next;
+
+	pthread_mutex_lock(&sv->lock);
+	for(;;) {
+		/* Earliest deadline first */
+		next = NULL;
+		for(s = sv->sessions; s != NULL; s = s->next)
+			if(s->state == S_QUEUED
+					&& (next == NULL || s->deadline_ns < next->deadline_ns))
+				next = s;
+		if(next == NULL) {
+			if(sv->stop)
+				break;
+			pthread_cond_wait(&sv->work, &sv->lock);
+			continue;
+		}
+		next->state = S_SEARCHING;
+		pthread_mutex_unlock(&sv->lock);
+		search_run(next->job);
+		pthread_mutex_lock(&sv->lock);
+		finish_search(sv, next);
+	}
+	pthread_mutex_unlock(&sv->lock);
+	return NULL;
+}
+
+
+/* Starts a new game on s under its rules, s must be idle */
+static int new_game(Session *s)
+{
+	BaoTree *tree;
+
+	if((tree = new_tree(&rules[s->variant])) == NULL)
+		return -1;
+	free_tree(s->tree);
+	s->tree = tree;
+	return 0;
+}
+
+
+static void list_moves(Session *s, char *buf, size_t size)
+{
+	Move moves[MAXMOVES];
+	int i, j, n, len;
+
+	len = snprintf(buf, size, "moves");
+	for(i = 0; i < s->tree->nchildren; i++) {
+		n = branch_moves(s->tree, i, moves, MAXMOVES);
+		for(j = 0; j < n && len < size - 1; j++) {
+			buf[len++] = ' ';
+			len += format_move(buf + len, size - len, &moves[j]);
+		}
+	}
+}
+
+
+static void show_board(Session *s, char *buf, size_t size)
+{
+	const BaoState *st = &s->tree->state;
+	int p, h, len;
+
+	len = snprintf(buf, size, "board");
+	for(p = P_NORTH; p <= P_SOUTH; p++) {
+		len += snprintf(buf + len, size - len, " %c", p == P_NORTH ? 'N' : 'S');
+		for(h = H_LFKICHWA; h <= H_STORE; h++)
+			len += snprintf(buf + len, size - len, " %d", st->board[p][h]);
+	}
+	snprintf(buf + len, size - len, " nyumba %d %d takata %d player %c",
+			st->nyumba[P_NORTH], st->nyumba[P_SOUTH], st->takata,
+			st->player == P_NORTH ? 'N' : 'S');
+}
+
+
+/* Plays move on s's game, s must be idle. Returns: 0 or -1 if illegal */
+static int play_move(Session *s, const Move *move)
+{
+	BaoState next;
+	int path;
+
+	if(grow_tree(s->tree, &rules[s->variant]) == -1
+			|| (path = find_branch(s->tree, move)) == -1)
+		return -1;
+	next = s->tree->children[path].state;
+	prune_tree(s->tree);
+	s->tree->state = next;
+	s->tree->best = NO_PATH;
+	s->tree->score = 0;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * run_command: Carries out one command line from s.
+ *
+ *		Runs without the server lock, only taking it to look at or change
+ *		what workers share. The tree is only touched while s is idle.
+ *
+ * Returns: 1 if s asked to quit else 0
+ *****************************************************************************/
+static int run_command(Server *sv, Session *s, char *line)
+{
+	char buf[REPLY_SIZE], *cmd, *arg;
+	unsigned long long now;
+	SearchJob *job;
+	Move move;
+	int busy, v, ms;
+
+	if((cmd = strtok(line, " \t\r")) == NULL)
+		return 0;
+	arg = strtok(NULL, " \t\r");
+	pthread_mutex_lock(&sv->lock);
+	busy = s->state != S_IDLE;
+	if(strcmp(cmd, "quit") == 0) {
+		pthread_mutex_unlock(&sv->lock);
+		return 1;
+	} else if(strcmp(cmd, "stop") == 0) {
+		if(busy)
+			search_cancel(s->job);
+		else
+			reply(s, "error not searching");
+	} else if(strcmp(cmd, "stats") == 0) {
+		format_latency(buf, sizeof(buf), s);
+		reply(s, "%s", buf);
+	} else if(strcmp(cmd, "time") == 0) {
+		if(arg == NULL || (ms = atoi(arg)) <= 0) {
+			reply(s, "error bad time");
+		} else {
+			s->movetime_ms = ms;
+			reply(s, "ok");
+		}
+	} else if(busy) {
+		reply(s, "error searching");
+	} else if(strcmp(cmd, "go") == 0) {
+		ms = arg != NULL ? atoi(arg) : s->movetime_ms;
+		if(ms <= 0) {
+			reply(s, "error bad time");
+		} else if((job = search_prepare(s->tree, &rules[s->variant],
+						SERVER_MAX_DEPTH, &sv->cfg->params, on_progress, s))
+				== NULL) {
+			reply(s, "error %s", strerror(errno));
+		} else {
+			now = stats_now_ns();
+			s->job = job;
+			s->depth_done = -1;
+			s->request_ns = now;
+			s->deadline_ns = now + ms * 1000000ULL;
+			s->state = S_QUEUED;
+			pthread_cond_signal(&sv->work);
+		}
+	} else {
+		/* s stays idle until we are done with its tree */
+		pthread_mutex_unlock(&sv->lock);
+		if(strcmp(cmd, "rules") == 0) {
+			for(v = 0; v < NRULES; v++)
+				if(arg != NULL && strcmp(arg, rules_names[v]) == 0)
+					break;
+			if(v == NRULES) {
+				snprintf(buf, sizeof(buf), "error unknown rules");
+			} else {
+				s->variant = v;
+				snprintf(buf, sizeof(buf), new_game(s) == -1
+						? "error out of memory" : "ok");
+			}
+		} else if(strcmp(cmd, "new") == 0) {
+			snprintf(buf, sizeof(buf), new_game(s) == -1
+					? "error out of memory" : "ok");
+		} else if(strcmp(cmd, "board") == 0) {
+			show_board(s, buf, sizeof(buf));
+		} else if(strcmp(cmd, "moves") == 0) {
+			if(grow_tree(s->tree, &rules[s->variant]) == -1)
+				snprintf(buf, sizeof(buf), "error %s", strerror(errno));
+			else
+				list_moves(s, buf, sizeof(buf));
+		} else if(strcmp(cmd, "play") == 0) {
+			if(arg == NULL || parse_move(&move, arg) == -1)
+				snprintf(buf, sizeof(buf), "error bad move");
+			else if(play_move(s, &move) == -1)
+				snprintf(buf, sizeof(buf), "error illegal move");
+			else
+				snprintf(buf, sizeof(buf), "ok");
+		} else {
+			snprintf(buf, sizeof(buf), "error unknown command %s", cmd);
+		}
+		pthread_mutex_lock(&sv->lock);
+		reply(s, "%s", buf);
+	}
+	pthread_mutex_unlock(&sv->lock);
+	return 0;
+}
+
+
+/* Client hung up, s goes now or once its search ends */
+static void close_session(Server *sv, Session *s)
+{
+	pthread_mutex_lock(&sv->lock);
+	close(s->fd);
+	s->fd = -1;
+	if(s->state == S_SEARCHING) {
+		s->closing = 1;
+		search_cancel(s->job);
+	} else {
+		if(s->state == S_QUEUED)
+			search_wait(s->job, NULL);
+		free_session(sv, s);
+	}
+	pthread_mutex_unlock(&sv->lock);
+}
+
+
+static void read_session(Server *sv, Session *s)
+{
+	char buf[LINE_SIZE];
+	ssize_t n, i;
+
+	if((n = read(s->fd, buf, sizeof(buf))) <= 0) {
+		if(n == -1 && (errno == EINTR || errno == EAGAIN))
+			return;
+		close_session(sv, s);
+		return;
+	}
+	for(i = 0; i < n; i++) {
+		if(buf[i] != '\n') {
+			/* Overlong lines get cut */
+			if(s->len < LINE_SIZE - 1)
+				s->line[s->len++] = buf[i];
+			continue;
+		}
+		s->line[s->len] = '\0';
+		s->len = 0;
+		if(run_command(sv, s, s->line)) {
+			close_session(sv, s);
+			return;
+		}
+	}
+}
+
+
+static void accept_session(Server *sv, int lfd)
+{
+	Session *s;
+	int fd;
+
+	if((fd = accept(lfd, NULL, NULL)) == -1)
+		return;
+	if((s = (Session *) calloc(1, sizeof(Session))) == NULL) {
+		close(fd);
+		return;
+	}
+	s->fd = fd;
+	s->variant = RULES_kiswahili;
+	s->movetime_ms = sv->cfg->movetime_ms;
+	if((s->tree = new_tree(&rules[s->variant])) == NULL) {
+		close(fd);
+		free(s);
+		return;
+	}
+	pthread_mutex_lock(&sv->lock);
+	if(sv->nsessions >= MAX_SESSIONS) {
+		pthread_mutex_unlock(&sv->lock);
+		close(fd);
+		free_tree(s->tree);
+		free(s);
+		return;
+	}
+	s->id = ++sv->next_id;
+	s->next = sv->sessions;
+	sv->sessions = s;
+	sv->nsessions++;
+	reply(s, "ready session %d rules %s", s->id, rules_names[s->variant]);
+	pthread_mutex_unlock(&sv->lock);
+}
+
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+	unlink(path);
+	if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+			|| listen(fd, 64) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/*****************************************************************************
+ * poll_timeout: Stops the searches that are past their deadline.
+ *
+ *		Searches that have not done depth 0 yet are left to on_progress().
+ *		The server lock must be held.
+ *
+ * Returns: Milliseconds till the next deadline, -1 if there is none.
+ *****************************************************************************/
+static int poll_timeout(Server *sv)
+{
+	unsigned long long now, left, next;
+	Session *s;
+
+	now = stats_now_ns();
+	next = 0;
+	for(s = sv->sessions; s != NULL; s = s->next) {
+		if(s->state != S_SEARCHING
+				|| __atomic_load_n(&s->depth_done, __ATOMIC_RELAXED) < 0)
+			continue;
+		if(s->deadline_ns <= now) {
+			search_cancel(s->job);
+			continue;
+		}
+		left = s->deadline_ns - now;
+		if(next == 0 || left < next)
+			next = left;
+	}
+	return next ? (int) ((next + 999999) / 1000000) : -1;
+}
+
+
+/*****************************************************************************
+ * serve: Serves sessions on cfg->path until SIGINT or SIGTERM.
+ *
+ * Returns: 0 once stopped, -1 if the server could not be set up (errno set)
+ *****************************************************************************/
+int serve(const ServerConfig *cfg)
+{
+	struct pollfd pfds[2 + MAX_SESSIONS];
+	Session *polled[2 + MAX_SESSIONS];
+	pthread_t threads[SERVER_MAX_WORKERS];
+	struct sigaction sa;
+	int pipefd[2], lfd, i, n, nthreads, timeout, err;
+	Server sv;
+	Session *s;
+	char c;
+
+	if(cfg->nworkers < 1 || cfg->nworkers > SERVER_MAX_WORKERS) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(tree_share_begin() == -1)
+		return -1;
+	if((lfd = listen_on(cfg->path)) == -1) {
+		tree_share_end();
+		return -1;
+	}
+	if(pipe(pipefd) == -1) {
+		close(lfd);
+		tree_share_end();
+		return -1;
+	}
+	wake_fd = pipefd[1];
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&sv, 0, sizeof(sv));
+	sv.cfg = cfg;
+	pthread_mutex_init(&sv.lock, NULL);
+	pthread_cond_init(&sv.work, NULL);
+	tt_set_shared(1);
+	for(nthreads = 0; nthreads < cfg->nworkers; nthreads++)
+		if((err = pthread_create(&threads[nthreads], NULL, worker, &sv))) {
+			errno = err;
+			warn("Could not start worker");
+			break;
+		}
+	fprintf(stderr, "serving on %s with %d workers\n", cfg->path, nthreads);
+
+	while(!stop_requested && nthreads) {
+		pthread_mutex_lock(&sv.lock);
+		timeout = poll_timeout(&sv);
+		pfds[0].fd = lfd;
+		pfds[1].fd = pipefd[0];
+		n = 2;
+		for(s = sv.sessions; s != NULL; s = s->next)
+			if(s->fd != -1) {
+				pfds[n].fd = s->fd;
+				polled[n++] = s;
+			}
+		pthread_mutex_unlock(&sv.lock);
+		for(i = 0; i < n; i++) {
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+		if(poll(pfds, n, timeout) == -1) {
+			if(errno == EINTR)
+				continue;
+			warn("poll");
+			break;
+		}
+		if(pfds[1].revents & POLLIN)
+			if(read(pipefd[0], &c, 1) == -1)
+				;
+		/* Only the main thread frees sessions that have an open fd */
+		for(i = 2; i < n; i++)
+			if(pfds[i].revents)
+				read_session(&sv, polled[i]);
+		if(pfds[0].revents & POLLIN)
+			accept_session(&sv, lfd);
+	}
+
+	pthread_mutex_lock(&sv.lock);
+	sv.stop = 1;
+	for(s = sv.sessions; s != NULL; s = s->next)
+		if(s->job != NULL)
+			search_cancel(s->job);
+	pthread_cond_broadcast(&sv.work);
+	pthread_mutex_unlock(&sv.lock);
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	while(sv.sessions != NULL)
+		free_session(&sv, sv.sessions);
+	tt_set_shared(0);
+	pthread_cond_destroy(&sv.work);
+	pthread_mutex_destroy(&sv.lock);
+	close(lfd);
+	unlink(cfg->path);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	wake_fd = -1;
+	tree_share_end();
+	return 0;
+}
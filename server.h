@@ -0,0 +1,36 @@
+#ifndef BAOSERVER_H
+#define BAOSERVER_H
+
+#include "eval.h"
+
+
+enum {
+	SERVER_MAX_WORKERS = 32	/* Search threads a server may run */
+};
+
+
+struct ServerConfig {
+	/* What serve() listens on and how it searches */
+
+	const char *path;
+	/* Unix socket to listen on, replaced if it exists. */
+
+	int nworkers;
+	/* Search threads shared by all sessions, at most SERVER_MAX_WORKERS. */
+
+	int movetime_ms;
+	/* Time a "go" without one gets, sessions may change theirs with
+	 * "time". */
+
+	SearchParams params;
+	/* Used for every session's searches. */
+};
+
+
+typedef struct ServerConfig ServerConfig;
+
+
+int serve(const ServerConfig *cfg);
+
+
+#endif /* BAOSERVER_H */
@@ -0,0 +1,356 @@
+/******************************************************************************
+ *	snapshot.c: Saving what a search has learnt, for a warm restart
+ *
+ *		A snapshot holds the transposition table, the calling thread's
+ *		history table and a game tree from its root down. Nothing in it is
+ *		a pointer, nodes refer to their children by index, so it loads at
+ *		any address in any process.
+ *
+ *		Layout:
+ *			SnapHeader
+ *			unsigned int[SEARCH_HISTORY_SIZE]
+ *			SnapNode[nnodes]	breadth first from the root, the children of
+ *								a node next to each other from first on
+ *			SnapAlias[naliases]	each node's from first_alias on
+ *			TT slots			at tt_offset, a multiple of SNAP_ALIGN
+ *
+ *		snapshot_load() maps the table straight in (see tt_import), so it
+ *		takes the same time whatever the table's size and its pages are
+ *		only read as they get probed. The tree is rebuilt node by node,
+ *		copying states rather than executing moves. A snapshot written by
+ *		another version, with a table of another size or under other rules
+ *		is refused.
+ *****************************************************************************/
+
+#include "snapshot.h"
+#include "eval.h"
+#include "move_io.h"
+#include "tt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define SNAP_MAGIC "BAOS"
+
+#define TT_BYTES ((size_t) TT_SLOT_SIZE << TT_BITS)
+
+
+enum {
+	SNAP_VERSION = 2,
+	SNAP_ALIGN   = 1 << 16,		/* Of the table, a multiple of any page size */
+	SNAP_ENDIAN  = 0x01020304,	/* Reads otherwise on a machine of the other
+								 * byte order */
+	PATH_SIZE    = 4096
+};
+
+
+struct SnapHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t tt_bits;
+	uint32_t history_size;
+	uint32_t generation;	/* See tt_export */
+	BaoRules rules;			/* The tree was grown under */
+	uint64_t nnodes;
+	uint64_t naliases;
+	uint64_t tt_offset;
+	uint64_t size;			/* Of the whole file */
+};
+
+
+struct SnapNode {
+	uint8_t state[PACKED_STATE_SIZE];	/* pack_state() */
+	uint8_t move;			/* encode_move() */
+	uint8_t best;
+	int16_t score;
+	uint32_t first;			/* Index of the first child */
+	uint32_t first_alias;
+	uint8_t nchildren;		/* 0 for a node not grown (or staged) */
+	uint8_t naliases;
+	uint8_t pad[2];
+};
+
+
+struct SnapAlias {
+	uint8_t move;			/* encode_move() */
+	uint8_t pad[3];
+	uint32_t path;
+};
+
+
+struct Saver {
+	/* The tree being flattened, see snapshot_save() */
+	struct SnapNode *nodes;
+	struct SnapAlias *aliases;
+	const BaoTree **queue;	/* nodes[i] was made from queue[i] */
+};
+
+
+/* Staged nodes are saved without their children, see stage_tree() */
+static int saved_children(const BaoTree *node)
+{
+	return staged_moves(node) ? 0 : node->nchildren;
+}
+
+
+/* Counts the nodes and aliases under node, node included */
+static void count_tree(const BaoTree *node, uint64_t *nnodes,
+		uint64_t *naliases)
+{
+	int i, n = saved_children(node);
+
+	(*nnodes)++;
+	if(n == 0)
+		return;
+	*naliases += node->naliases;
+	for(i = 0; i < n; i++)
+		count_tree(&node->children[i], nnodes, naliases);
+}
+
+
+/* Flattens the tree at s->queue[0], one level after another */
+static void flatten_tree(struct Saver *s)
+{
+	const MoveAlias *alias;
+	const BaoTree *node;
+	struct SnapNode *sn;
+	struct SnapAlias *sa;
+	uint64_t i, n, a;
+	int j, nchildren;
+
+	n = 1;
+	a = 0;
+	for(i = 0; i < n; i++) {
+		node = s->queue[i];
+		sn = &s->nodes[i];
+		memset(sn, 0, sizeof(*sn));
+		pack_state(sn->state, &node->state);
+		sn->move = encode_move(&node->move);
+		sn->score = node->score;
+		if((nchildren = saved_children(node)) == 0) {
+			/* A path into children a staged node orders as they come */
+			sn->best = node->children == NULL ? node->best : NO_PATH;
+			continue;
+		}
+		sn->best = node->best;
+		sn->nchildren = nchildren;
+		sn->first = n;
+		for(j = 0; j < nchildren; j++)
+			s->queue[n++] = &node->children[j];
+		sn->naliases = node->naliases;
+		sn->first_alias = a;
+		alias = NODE_ALIASES(node);
+		for(j = 0; j < node->naliases; j++) {
+			sa = &s->aliases[a++];
+			memset(sa, 0, sizeof(*sa));
+			sa->move = encode_move(&alias[j].move);
+			sa->path = alias[j].path;
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * snapshot_save: Writes root's tree and the search tables to path.
+ *
+ *		The file is written next to path and renamed over it, so path
+ *		always holds a whole snapshot. The history table saved is the
+ *		calling thread's. No search may be running.
+ *
+ * Returns: 0 on success else -1 (errno set)
+ *****************************************************************************/
+int snapshot_save(const char *path, const BaoTree *root,
+		const BaoRules *rules)
+{
+	char tmp[PATH_SIZE];
+	unsigned int history[SEARCH_HISTORY_SIZE];
+	struct SnapHeader hd;
+	struct Saver s;
+	const void *tt;
+	int fd, ret;
+
+	if(snprintf(tmp, PATH_SIZE, "%s.tmp", path) >= PATH_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, SNAP_MAGIC, 4);
+	hd.version = SNAP_VERSION;
+	hd.endian = SNAP_ENDIAN;
+	hd.tt_bits = TT_BITS;
+	hd.history_size = SEARCH_HISTORY_SIZE;
+	hd.rules = *rules;
+	count_tree(root, &hd.nnodes, &hd.naliases);
+	hd.tt_offset = sizeof(hd) + sizeof(history)
+		+ hd.nnodes * sizeof(struct SnapNode)
+		+ hd.naliases * sizeof(struct SnapAlias);
+	hd.tt_offset = (hd.tt_offset + SNAP_ALIGN - 1) / SNAP_ALIGN * SNAP_ALIGN;
+	hd.size = hd.tt_offset + TT_BYTES;
+
+	s.nodes = malloc(hd.nnodes * sizeof(*s.nodes));
+	s.aliases = malloc((hd.naliases ? hd.naliases : 1) * sizeof(*s.aliases));
+	s.queue = malloc(hd.nnodes * sizeof(*s.queue));
+	ret = -1;
+	if(s.nodes == NULL || s.aliases == NULL || s.queue == NULL)
+		goto done;
+	s.queue[0] = root;
+	flatten_tree(&s);
+	search_get_history(history);
+	tt = tt_export(&hd.generation);
+
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		goto done;
+	if(write_all(fd, &hd, sizeof(hd)) == 0
+			&& write_all(fd, history, sizeof(history)) == 0
+			&& write_all(fd, s.nodes, hd.nnodes * sizeof(*s.nodes)) == 0
+			&& write_all(fd, s.aliases,
+				hd.naliases * sizeof(*s.aliases)) == 0
+			&& lseek(fd, hd.tt_offset, SEEK_SET) != -1
+			&& write_all(fd, tt, TT_BYTES) == 0)
+		ret = 0;
+	if(close(fd) == -1)
+		ret = -1;
+	if(ret == 0)
+		ret = rename(tmp, path);
+	else
+		unlink(tmp);
+done:
+	free(s.nodes);
+	free(s.aliases);
+	free(s.queue);
+	return ret;
+}
+
+
+/*****************************************************************************
+ * load_node: Rebuilds node from nodes[i] and its subtree below it.
+ *
+ * Returns: 0 or -1 (EINVAL if the nodes do not make a tree)
+ *****************************************************************************/
+static int load_node(BaoTree *node, const struct SnapHeader *hd,
+		const struct SnapNode *nodes, const struct SnapAlias *aliases,
+		uint64_t i)
+{
+	const struct SnapNode *sn = &nodes[i];
+	MoveAlias *alias;
+	int j;
+
+	/* A node saved without children keeps the path it had (see
+	 * flatten_tree), which has to fit the children it can grow */
+	if(sn->best != NO_PATH
+			&& sn->best >= (sn->nchildren ? sn->nchildren : MAXTRANS)) {
+		errno = EINVAL;
+		return -1;
+	}
+	unpack_state(&node->state, sn->state);
+	node->best = sn->best;
+	node->score = sn->score;
+	if(sn->nchildren == 0)
+		return 0;
+	/* Children come later in breadth first order, so there is no loop */
+	if(sn->first <= i || sn->first + sn->nchildren > hd->nnodes
+			|| sn->first_alias + sn->naliases > hd->naliases) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(attach_children(node, sn->nchildren, sn->naliases) == -1)
+		return -1;
+	alias = NODE_ALIASES(node);
+	for(j = 0; j < sn->naliases; j++) {
+		if(aliases[sn->first_alias + j].path >= sn->nchildren) {
+			errno = EINVAL;
+			return -1;
+		}
+		decode_move(&alias[j].move, aliases[sn->first_alias + j].move);
+		alias[j].path = aliases[sn->first_alias + j].path;
+	}
+	for(j = 0; j < sn->nchildren; j++) {
+		node->children[j].best = NO_PATH;
+		node->children[j].score = 0;
+		decode_move(&node->children[j].move, nodes[sn->first + j].move);
+		if(load_node(&node->children[j], hd, nodes, aliases,
+					sn->first + j) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * snapshot_load: Restores what snapshot_save() wrote to path.
+ *
+ *		The transposition table and the calling thread's history table are
+ *		replaced, only once the snapshot has proven good. No search may be
+ *		running. The tree is returned as new_tree() would, free it with
+ *		free_tree().
+ *
+ * Returns: The tree's root or NULL on error (errno set, EINVAL if path is
+ *			not a snapshot this build can use under rules)
+ *****************************************************************************/
+BaoTree *snapshot_load(const char *path, const BaoRules *rules)
+{
+	const struct SnapHeader *hd;
+	const struct SnapNode *nodes;
+	struct stat st;
+	BaoTree *root;
+	void *map, *tt;
+	uint64_t end;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	root = NULL;
+	map = MAP_FAILED;
+	if(fstat(fd, &st) == -1)
+		goto unmap;
+	if(st.st_size < sizeof(*hd)) {
+		errno = EINVAL;
+		goto unmap;
+	}
+	if((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+			== MAP_FAILED)
+		goto unmap;
+	hd = map;
+	end = sizeof(*hd) + SEARCH_HISTORY_SIZE * sizeof(unsigned int)
+		+ hd->nnodes * sizeof(struct SnapNode)
+		+ hd->naliases * sizeof(struct SnapAlias);
+	if(memcmp(hd->magic, SNAP_MAGIC, 4) != 0
+			|| hd->version != SNAP_VERSION || hd->endian != SNAP_ENDIAN
+			|| hd->tt_bits != TT_BITS
+			|| hd->history_size != SEARCH_HISTORY_SIZE
+			|| memcmp(&hd->rules, rules, sizeof(*rules)) != 0
+			|| hd->size != st.st_size || hd->nnodes == 0
+			|| hd->nnodes > st.st_size || hd->naliases > st.st_size
+			|| hd->tt_offset % SNAP_ALIGN || hd->tt_offset < end
+			|| hd->tt_offset + TT_BYTES != hd->size) {
+		errno = EINVAL;
+		goto unmap;
+	}
+	nodes = (const struct SnapNode *) ((const unsigned char *) (hd + 1)
+			+ SEARCH_HISTORY_SIZE * sizeof(unsigned int));
+	if((root = new_tree(rules)) == NULL)
+		goto unmap;
+	if(load_node(root, hd, nodes,
+				(const struct SnapAlias *) (nodes + hd->nnodes), 0) == -1
+			|| (tt = mmap(NULL, TT_BYTES, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE, fd, hd->tt_offset)) == MAP_FAILED) {
+		free_tree(root);
+		root = NULL;
+		goto unmap;
+	}
+	tt_import(tt, hd->generation);
+	search_set_history((const unsigned int *) (hd + 1));
+unmap:
+	if(map != MAP_FAILED)
+		munmap(map, st.st_size);
+	close(fd);
+	return root;
+}
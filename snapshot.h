@@ -0,0 +1,14 @@
+#ifndef BAOSNAPSHOT_H
+#define BAOSNAPSHOT_H
+
+#include "tree.h"
+
+
+int snapshot_save(const char *path, const BaoTree *root,
+		const BaoRules *rules);
+
+
+BaoTree *snapshot_load(const char *path, const BaoRules *rules);
+
+
+#endif /* BAOSNAPSHOT_H */
@@ -0,0 +1,441 @@
+/******************************************************************************
+ *	solve.c: Depth first proof number search (df-pn)
+ *
+ *		Proves a position won or lost outright instead of scoring it. A
+ *		side out of moves (a node grow_tree() gives no children, never
+ *		ending moves included) has lost, there are no draws. Each pass
+ *		tries to prove that one side, the attacker, wins. Numbers are kept
+ *		in negamax form for the side to move at each node: phi is the
+ *		proof number of "the side to move wins", delta its disproof
+ *		number, so a node's phi is the least delta of its children and its
+ *		delta the sum of their phis.
+ *
+ *		The search is the df-pn of Nagai: a node is searched until its
+ *		numbers reach the thresholds its parent gave it, children are
+ *		grown again each time the search comes back to a node and freed
+ *		when it leaves, so the tree in memory is never more than the path
+ *		being searched. Numbers live in a fixed size table of BUCKET entry
+ *		buckets keyed on canon_hash(), the entry that took the least work
+ *		to find goes when a bucket is full.
+ *
+ *		A position repeating one on the path, or deeper than max_plies,
+ *		counts as a loss for the attacker. Such a result depends on the
+ *		path it was found on but still lands in the table, which can only
+ *		lose proofs, never make a wrong one: a proof never goes through a
+ *		repetition. A disproof is no proof of a loss, so solve() proves a
+ *		loss with a second pass that has the other side attack.
+ *****************************************************************************/
+
+#include "eval.h"
+#include "solve.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+	BUCKET = 4	/* Table entries a key may go in */
+};
+
+
+struct Entry {
+	uint64_t key;			/* canon_hash() | 1, 0 if never stored */
+	uint32_t phi;
+	uint32_t delta;
+	uint64_t work;			/* Nodes grown to find phi and delta */
+};
+
+
+struct Solver {
+	/* What a solve() call passes down the tree */
+	const BaoRules *rules;
+	const SolveConfig *cfg;
+	struct Entry *table;
+	size_t mask;			/* Entries in table - 1 */
+	uint64_t *path;			/* Key of each node down to the one searched */
+	Player attacker;
+	unsigned long long nodes;
+	unsigned long long max_nodes;	/* Node count to stop at, 0 for none */
+	int stopped;			/* Out of nodes or failed, unwind */
+	int failed;				/* grow_tree() failed, errno is set */
+};
+
+
+typedef struct Entry Entry;
+
+typedef struct Solver Solver;
+
+
+const SolveConfig default_solve_config = {
+	16 << 20,	/* table_bytes */
+	1000000,	/* max_nodes */
+	200,		/* max_plies */
+	1			/* proof */
+};
+
+
+static uint64_t node_key(const BaoState *state)
+{
+	return canon_hash(state, NULL) | 1;
+}
+
+
+/* Returns: a + b, short of SOLVE_INF unless either is SOLVE_INF */
+static uint32_t add_numbers(uint32_t a, uint32_t b)
+{
+	uint64_t sum = (uint64_t) a + b;
+
+	if(a == SOLVE_INF || b == SOLVE_INF)
+		return SOLVE_INF;
+	return sum < SOLVE_INF ? sum : SOLVE_INF - 1;
+}
+
+
+static Entry *bucket(const Solver *sv, uint64_t key)
+{
+	return &sv->table[(key >> 1) & sv->mask & ~(size_t) (BUCKET - 1)];
+}
+
+
+/* Sets phi and delta of key, 1 and 1 if it has not been searched */
+static void lookup(const Solver *sv, uint64_t key, uint32_t *phi,
+		uint32_t *delta)
+{
+	const Entry *e = bucket(sv, key);
+	int i;
+
+	for(i = 0; i < BUCKET; i++) {
+		if(e[i].key == key) {
+			*phi = e[i].phi;
+			*delta = e[i].delta;
+			return;
+		}
+	}
+	*phi = 1;
+	*delta = 1;
+}
+
+
+static void store(Solver *sv, uint64_t key, uint32_t phi, uint32_t delta,
+		uint64_t work)
+{
+	Entry *e = bucket(sv, key);
+	int i, victim;
+
+	victim = 0;
+	for(i = 0; i < BUCKET; i++) {
+		if(e[i].key == key) {
+			victim = i;
+			break;
+		}
+		if(e[i].work < e[victim].work)
+			victim = i;
+	}
+	e[victim].key = key;
+	e[victim].phi = phi;
+	e[victim].delta = delta;
+	e[victim].work = work;
+}
+
+
+/*****************************************************************************
+ * child_numbers: Sets phi and delta of a child ply plies from the root.
+ *
+ *		A child repeating a node on the path (path[0] to path[ply - 1])
+ *		or past max_plies is lost for the attacker, whichever side is to
+ *		move on it.
+ *****************************************************************************/
+static void child_numbers(const Solver *sv, const BaoTree *child,
+		uint64_t key, int ply, uint32_t *phi, uint32_t *delta)
+{
+	int i;
+
+	for(i = 0; i < ply && sv->path[i] != key; i++)
+		;
+	if(i < ply || ply > sv->cfg->max_plies) {
+		*phi = child->state.player == sv->attacker ? SOLVE_INF : 0;
+		*delta = child->state.player == sv->attacker ? 0 : SOLVE_INF;
+		return;
+	}
+	lookup(sv, key, phi, delta);
+}
+
+
+/* Grows node for the search. Returns: 0, or -1 with the search stopped */
+static int expand(Solver *sv, BaoTree *node)
+{
+	if(grow_tree(node, sv->rules) < 0) {
+		sv->failed = 1;
+		sv->stopped = 1;
+		return -1;
+	}
+	sv->nodes++;
+	if(sv->max_nodes && sv->nodes >= sv->max_nodes)
+		sv->stopped = 1;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * mid: Searches node (key, ply plies from the root) until its phi reaches
+ *		thphi or its delta reaches thdelta, or the search is stopped.
+ *
+ *		The child with the least delta is searched next, until its phi
+ *		would take the node's delta to thdelta or its delta passes that of
+ *		the second best child. The 1 + 1/4 margin over the second best
+ *		saves switching back and forth between two close children. Node's
+ *		numbers go in the table and the children mid() grew are freed on
+ *		the way out.
+ *
+ *		The children's numbers are looked up once and then kept here, a
+ *		child search raising them: one pushed out of the table by a
+ *		deeper search is not taken for unsearched again, so the search
+ *		of a node always comes to an end, node limit or not.
+ *****************************************************************************/
+static void mid(Solver *sv, BaoTree *node, uint64_t key, int ply,
+		uint32_t thphi, uint32_t thdelta, uint32_t *phi_out,
+		uint32_t *delta_out)
+{
+	uint64_t keys[MAXTRANS];
+	uint32_t cphi[MAXTRANS], cdelta[MAXTRANS];
+	unsigned long long start;
+	uint32_t phi, delta, best_phi, delta2, thchild;
+	unsigned int i, best;
+	int grown;
+
+	start = sv->nodes;
+	phi = 1;
+	delta = 1;
+	grown = node->children == NULL;
+	if(expand(sv, node) == -1)
+		goto out;
+	if(node->nchildren == 0) {
+		phi = SOLVE_INF;
+		delta = 0;
+		goto out;
+	}
+	sv->path[ply] = key;
+	for(i = 0; i < node->nchildren; i++) {
+		keys[i] = node_key(&node->children[i].state);
+		child_numbers(sv, &node->children[i], keys[i], ply + 1, &cphi[i],
+				&cdelta[i]);
+	}
+	for(;;) {
+		phi = SOLVE_INF;
+		delta = 0;
+		delta2 = SOLVE_INF;
+		best = 0;
+		best_phi = 0;
+		for(i = 0; i < node->nchildren; i++) {
+			if(cdelta[i] < phi) {
+				delta2 = phi;
+				phi = cdelta[i];
+				best = i;
+				best_phi = cphi[i];
+			} else if(cdelta[i] < delta2) {
+				delta2 = cdelta[i];
+			}
+			delta = add_numbers(delta, cphi[i]);
+		}
+		if(phi >= thphi || delta >= thdelta || sv->stopped)
+			break;
+		thchild = delta2 == SOLVE_INF ? SOLVE_INF
+			: add_numbers(delta2, delta2 / 4 + 1);
+		mid(sv, &node->children[best], keys[best], ply + 1,
+				thdelta == SOLVE_INF ? SOLVE_INF
+					: thdelta - delta + best_phi,
+				thchild < thphi ? thchild : thphi, &cphi[best],
+				&cdelta[best]);
+	}
+out:
+	if(!sv->failed)
+		store(sv, key, phi, delta, sv->nodes - start);
+	if(grown)
+		prune_tree(node);
+	*phi_out = phi;
+	*delta_out = delta;
+}
+
+
+/*****************************************************************************
+ * proven: Finds out if child (ply plies from the root) is won for the
+ *		attacker.
+ *
+ *		With search set a child the table has no answer for (its numbers
+ *		may have been pushed out) is searched again.
+ *
+ * Returns: 1 if child is proven won for the attacker, else 0.
+ *****************************************************************************/
+static int proven(Solver *sv, BaoTree *child, int ply, int search)
+{
+	uint64_t key = node_key(&child->state);
+	uint32_t phi, delta;
+
+	child_numbers(sv, child, key, ply, &phi, &delta);
+	if(search && phi != 0 && delta != 0)
+		mid(sv, child, key, ply, SOLVE_INF, SOLVE_INF, &phi, &delta);
+	return child->state.player == sv->attacker ? phi == 0 : delta == 0;
+}
+
+
+/*****************************************************************************
+ * extract: Leaves the proof below node (ply plies from the root) in the
+ *		tree.
+ *
+ *		A node with the attacker to move keeps a child won for the
+ *		attacker as its best, one with the defender to move keeps all its
+ *		children, its best being the one that holds out longest. Scores
+ *		are set to WIN_SCORE and -WIN_SCORE.
+ *
+ *		A node extract() fails on gets the children it grew for it freed
+ *		again, so a tree the caller kept is left with what it had.
+ *
+ * Returns: Plies of the longest line in the proof, -1 if the proof could
+ *			not be rebuilt within the node limit (or sv failed).
+ *****************************************************************************/
+static int extract(Solver *sv, BaoTree *node, int ply,
+		unsigned long long *nodes)
+{
+	uint64_t fresh;
+	unsigned int i;
+	int plies, longest, attacking, grown;
+
+	grown = node->children == NULL;
+	fresh = 0;
+	if(grow_tree(node, sv->rules) < 0) {
+		sv->failed = 1;
+		return -1;
+	}
+	(*nodes)++;
+	attacking = node->state.player == sv->attacker;
+	node->score = attacking ? WIN_SCORE : -WIN_SCORE;
+	node->best = NO_PATH;
+	if(node->nchildren == 0)
+		return attacking ? -1 : ply;
+	sv->path[ply] = node_key(&node->state);
+	if(attacking) {
+		/* Search again only if no winning move is left in the table */
+		for(i = 0; i < node->nchildren; i++)
+			if(proven(sv, &node->children[i], ply + 1, 0))
+				break;
+		for(i = i < node->nchildren ? i : 0; i < node->nchildren; i++)
+			if(proven(sv, &node->children[i], ply + 1, 1))
+				break;
+		if(i < node->nchildren) {
+			node->best = i;
+			if((plies = extract(sv, &node->children[i], ply + 1, nodes))
+					!= -1)
+				return plies;
+		}
+		goto failed;
+	}
+	longest = -1;
+	for(i = 0; i < node->nchildren; i++) {
+		if(node->children[i].children == NULL)
+			fresh |= (uint64_t) 1 << i;
+		if(!proven(sv, &node->children[i], ply + 1, 1))
+			goto failed;
+		if((plies = extract(sv, &node->children[i], ply + 1, nodes)) == -1)
+			goto failed;
+		if(plies > longest) {
+			longest = plies;
+			node->best = i;
+		}
+	}
+	return longest;
+failed:
+	node->best = NO_PATH;
+	if(grown) {
+		prune_tree(node);
+	} else if(!attacking) {
+		/* Proofs already rebuilt below children that were not grown */
+		for(i = 0; i < node->nchildren; i++)
+			if(fresh >> i & 1)
+				prune_tree(&node->children[i]);
+	}
+	return -1;
+}
+
+
+/*****************************************************************************
+ * solve: Proves root won or lost for its side to move.
+ *
+ *		The first pass attacks with the side to move, the second (run if
+ *		the first finds no win) with the opponent. cfg->max_nodes bounds
+ *		both passes together, and again the searches that rebuild parts
+ *		of the proof pushed out of the table.
+ *
+ *		With cfg->proof the proof of a win or loss is left in root's
+ *		subtree: along best from root to a node the defender has no moves
+ *		on, the attacker's moves are the ones that win and the defender's
+ *		the ones that hold out longest. The rest of the defender's
+ *		children are in the proof too, each with a best of its own.
+ *		Proven nodes score WIN_SCORE or -WIN_SCORE. A proof that cannot
+ *		be rebuilt within the node limit leaves proof_nodes at 0, and
+ *		root's subtree with the nodes it had.
+ *
+ * Returns: 0 and sets result, -1 if out of memory (errno is set).
+ *****************************************************************************/
+int solve(BaoTree *root, const BaoRules *rules, const SolveConfig *cfg,
+		SolveResult *result)
+{
+	Solver sv;
+	BaoTree scratch;
+	size_t nentries;
+	uint64_t key;
+	uint32_t phi, delta;
+	int pass, plies;
+
+	memset(result, 0, sizeof(*result));
+	result->outcome = SOLVE_UNKNOWN;
+	memset(&sv, 0, sizeof(sv));
+	sv.rules = rules;
+	sv.cfg = cfg;
+	sv.max_nodes = cfg->max_nodes;
+	for(nentries = BUCKET; nentries * 2 * sizeof(Entry) <= cfg->table_bytes;)
+		nentries *= 2;
+	sv.mask = nentries - 1;
+	if((sv.table = (Entry *) malloc(nentries * sizeof(Entry))) == NULL)
+		return -1;
+	if((sv.path = (uint64_t *) malloc((cfg->max_plies + 2)
+					* sizeof(uint64_t))) == NULL) {
+		free(sv.table);
+		return -1;
+	}
+	key = node_key(&root->state);
+	for(pass = 0; pass < 2 && !sv.stopped; pass++) {
+		sv.attacker = root->state.player;
+		if(pass == 1)
+			sv.attacker = sv.attacker == P_NORTH ? P_SOUTH : P_NORTH;
+		memset(sv.table, 0, nentries * sizeof(Entry));
+		memset(&scratch, 0, sizeof(scratch));
+		scratch.state = root->state;
+		scratch.best = NO_PATH;
+		mid(&sv, &scratch, key, 0, SOLVE_INF, SOLVE_INF, &phi, &delta);
+		if(pass == 0 && phi == 0)
+			result->outcome = SOLVE_WIN;
+		else if(pass == 1 && delta == 0)
+			result->outcome = SOLVE_LOSS;
+		if(result->outcome != SOLVE_UNKNOWN)
+			break;
+	}
+	result->nodes = sv.nodes;
+	if(result->outcome != SOLVE_UNKNOWN && cfg->proof && !sv.failed) {
+		sv.max_nodes = cfg->max_nodes ? sv.nodes + cfg->max_nodes : 0;
+		sv.stopped = 0;
+		plies = extract(&sv, root, 0, &result->proof_nodes);
+		if(plies == -1) {
+			result->proof_nodes = 0;
+		} else {
+			result->proof_plies = plies;
+		}
+	}
+	free(sv.path);
+	free(sv.table);
+	if(sv.failed) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef BAOSOLVE_H
+#define BAOSOLVE_H
+
+#include "tree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	SOLVE_INF = 0xFFFFFFFF	/* Proof or disproof number of a decided node */
+};
+
+
+enum SolveOutcome {
+	SOLVE_UNKNOWN,
+	/* Neither side was proven to win within the limits, or the game can
+	 * be dragged out forever */
+	SOLVE_WIN,
+	/* The side to move wins whatever the opponent plays */
+	SOLVE_LOSS
+	/* The opponent wins whatever the side to move plays */
+};
+
+
+struct SolveConfig {
+	/* Limits of a solve() call */
+
+	size_t table_bytes;
+	/* Memory for the proof number table, all solve() takes besides the
+	 * nodes on the path it is searching. */
+
+	unsigned long long max_nodes;
+	/* Nodes grown before giving up, 0 for no limit. Rebuilding parts
+	 * of the proof gets as many again. */
+
+	int max_plies;
+	/* Plies from the root a proof may reach. Deeper positions (and
+	 * positions repeating one on the path to them) count as not won by
+	 * the side being proven to win. */
+
+	int proof;
+	/* Non-zero to leave the proof in the tree, see solve(). */
+};
+
+
+struct SolveResult {
+	/* What a solve() call found */
+
+	enum SolveOutcome outcome;
+
+	unsigned long long nodes;
+	/* Nodes grown by the search, proof extraction not counted */
+
+	unsigned long long proof_nodes;
+	/* Nodes on the proof left in the tree, 0 if none was */
+
+	int proof_plies;
+	/* Longest line in the proof: the most plies the losing side can hold
+	 * out for against the moves the proof picks */
+};
+
+
+typedef enum SolveOutcome SolveOutcome;
+
+typedef struct SolveConfig SolveConfig;
+
+typedef struct SolveResult SolveResult;
+
+
+extern const SolveConfig default_solve_config;
+
+
+int solve(BaoTree *root, const BaoRules *rules, const SolveConfig *cfg,
+		SolveResult *result);
+
+
+#endif /* BAOSOLVE_H */
@@ -0,0 +1,204 @@
+/******************************************************************************
+ *	stats.c: Search and move execution counters
+ *
+ *		Every thread that bumps a counter gets its own BaoStats block on
+ *		first use. Blocks are only ever written by their owner thread,
+ *		readers get totals by summing all blocks. No locks are taken on
+ *		either side. A thread that exits leaves its counts in its block
+ *		and the block to the next thread that needs one.
+ *
+ *		Build with -DBAO_NO_STATS to compile all counting out, the API
+ *		below then reports zeros.
+ *****************************************************************************/
+
+#include "stats.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+
+#define STATS_NFIELDS ((offsetof(BaoStats, branches) \
+			+ sizeof(((BaoStats *) 0)->branches)) / sizeof(unsigned long long))
+
+
+#ifndef BAO_NO_STATS
+
+static BaoStats stats_slots[STATS_MAX_THREADS];
+
+static unsigned int stats_nslots;
+
+static BaoStats *stats_idle[STATS_MAX_THREADS];
+/* Blocks of threads that exited, stats_lock held */
+
+static unsigned int stats_nidle;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t stats_key;
+
+static int stats_keyed;
+
+__thread BaoStats *stats_local;
+
+
+/* Thread exit: the block, counts and all, goes to the next thread */
+static void stats_detach(void *block)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats_idle[stats_nidle++] = (BaoStats *) block;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+
+static void stats_init_key(void)
+{
+	stats_keyed = pthread_key_create(&stats_key, stats_detach) == 0;
+}
+
+
+/*****************************************************************************
+ * stats_attach: Hands the calling thread its private counter block.
+ *
+ *		The block of a thread that exited is handed on before a new one
+ *		is taken. Beyond STATS_MAX_THREADS threads at once the extra ones
+ *		share the last block, their counts may then be slightly off but
+ *		nothing breaks.
+ *****************************************************************************/
+BaoStats *stats_attach(void)
+{
+	BaoStats *block;
+
+	pthread_once(&stats_once, stats_init_key);
+	pthread_mutex_lock(&stats_lock);
+	block = NULL;
+	if(stats_nidle) {
+		block = stats_idle[--stats_nidle];
+	} else if(stats_nslots < STATS_MAX_THREADS) {
+		block = &stats_slots[stats_nslots];
+		__atomic_store_n(&stats_nslots, stats_nslots + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&stats_lock);
+	if(block == NULL)
+		block = &stats_slots[STATS_MAX_THREADS - 1];
+	else if(stats_keyed)
+		pthread_setspecific(stats_key, block);
+	stats_local = block;
+	return block;
+}
+
+
+int stats_enabled(void)
+{
+	return 1;
+}
+
+
+void stats_collect(BaoStats *total)
+{
+	unsigned int i, n, f;
+	unsigned long long *src, *dst;
+
+	memset(total, 0, sizeof(BaoStats));
+	n = __atomic_load_n(&stats_nslots, __ATOMIC_ACQUIRE);
+	dst = (unsigned long long *) total;
+	for(i = 0; i < n; i++) {
+		src = (unsigned long long *) &stats_slots[i];
+		for(f = 0; f < STATS_NFIELDS; f++)
+			dst[f] += __atomic_load_n(&src[f], __ATOMIC_RELAXED);
+	}
+}
+
+
+/* NOTE: Counts bumped by other threads while this runs may survive */
+void stats_reset(void)
+{
+	unsigned int i, n, f;
+	unsigned long long *p;
+
+	n = __atomic_load_n(&stats_nslots, __ATOMIC_ACQUIRE);
+	for(i = 0; i < n; i++) {
+		p = (unsigned long long *) &stats_slots[i];
+		for(f = 0; f < STATS_NFIELDS; f++)
+			__atomic_store_n(&p[f], 0, __ATOMIC_RELAXED);
+	}
+}
+
+#else
+
+int stats_enabled(void)
+{
+	return 0;
+}
+
+
+void stats_collect(BaoStats *total)
+{
+	memset(total, 0, sizeof(BaoStats));
+}
+
+
+void stats_reset(void)
+{
+}
+
+#endif /* BAO_NO_STATS */
+
+
+static double ratio(unsigned long long num, unsigned long long den)
+{
+	return den ? (double) num / den : 0.0;
+}
+
+
+void stats_print(FILE *fp, const BaoStats *st)
+{
+	int ply;
+
+	if(!stats_enabled()) {
+		fprintf(fp, "stats: compiled out (BAO_NO_STATS)\n");
+		return;
+	}
+	fprintf(fp, "nodes:            %llu (%llu quiescence)\n", st->nodes,
+			st->qnodes);
+	fprintf(fp, "nodes/sec:        %.0f\n",
+			ratio(st->nodes, st->search_ns) * 1e9);
+	fprintf(fp, "search time:      %.3f s\n", st->search_ns / 1e9);
+	fprintf(fp, "grow_tree:        %llu calls, %llu expansions, "
+			"%llu staged\n", st->grow_calls, st->expansions, st->stages);
+	fprintf(fp, "get_moves:        %llu calls, %llu moves\n",
+			st->get_moves_calls, st->moves_generated);
+	fprintf(fp, "moves executed:   %llu\n", st->moves_executed);
+	fprintf(fp, "exec_move steps:  %llu\n", st->exec_steps);
+	fprintf(fp, "avg sowing:       %.2f steps/move\n",
+			ratio(st->exec_steps, st->moves_executed));
+	fprintf(fp, "haulted moves:    %llu\n", st->moves_haulted);
+	fprintf(fp, "perpetual moves:  %llu\n", st->moves_perpetual);
+	fprintf(fp, "merged moves:     %llu\n", st->transpositions);
+	fprintf(fp, "cutoffs:          %llu\n", st->cutoffs);
+	fprintf(fp, "reductions:       %llu (%llu re-searches)\n", st->reductions,
+			st->researches);
+	fprintf(fp, "evictions:        %llu (%llu nodes)\n", st->evictions,
+			st->evicted_nodes);
+	fprintf(fp, "tt hit rate:      %.2f%% (%llu/%llu)\n",
+			ratio(st->tt_hits, st->tt_probes) * 100, st->tt_hits,
+			st->tt_probes);
+	fprintf(fp, "branching factor per ply:\n");
+	for(ply = 0; ply < STATS_MAX_PLY; ply++)
+		if(st->expanded[ply])
+			fprintf(fp, "  %2d: %.2f (%llu nodes)\n", ply,
+					ratio(st->branches[ply], st->expanded[ply]),
+					st->expanded[ply]);
+}
+
+
+unsigned long long stats_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
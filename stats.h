@@ -0,0 +1,126 @@
+#ifndef BAOSTATS_H
+#define BAOSTATS_H
+
+#include <stdio.h>
+
+
+enum {
+	STATS_MAX_PLY     = 32,	/* Plies tracked by the per depth counters */
+	STATS_MAX_THREADS = 64	/* Threads at once with a private counter block */
+};
+
+
+struct BaoStats {
+	/* Search and move execution counters. Each thread owns one of these
+	 * and is the only writer to it, readers sum all of them up (see
+	 * stats_collect). */
+
+	unsigned long long nodes;
+	/* Nodes visited by the search */
+
+	unsigned long long qnodes;
+	/* Nodes of the above visited by the quiescence stage */
+
+	unsigned long long grow_calls;
+	/* Calls to grow_tree() */
+
+	unsigned long long expansions;
+	/* Calls to grow_tree() that actually generated children */
+
+	unsigned long long stages;
+	/* Nodes stage_tree() listed the moves of (see grow_branch) */
+
+	unsigned long long get_moves_calls;
+
+	unsigned long long moves_generated;
+	/* Moves returned by get_moves() */
+
+	unsigned long long moves_executed;
+	/* Moves started with start_move() */
+
+	unsigned long long exec_steps;
+	/* Steps (lifts, sows and side switches) taken by exec_move() */
+
+	unsigned long long moves_haulted;
+	/* Moves that returned MXS_HAULTED */
+
+	unsigned long long moves_perpetual;
+	/* Moves discarded as never ending (MXS_PERPETUAL) */
+
+	unsigned long long transpositions;
+	/* Moves merged into a sibling that reached the same state */
+
+	unsigned long long cutoffs;
+
+	unsigned long long reductions;
+	/* Children searched at a reduced depth (late move reductions) */
+
+	unsigned long long researches;
+	/* Null window or reduced probes that had to be searched again */
+
+	unsigned long long tt_probes;
+
+	unsigned long long tt_hits;
+
+	unsigned long long evictions;
+	/* Subtrees freed to keep within the tree budget (set_tree_budget) */
+
+	unsigned long long evicted_nodes;
+	/* Nodes freed with them */
+
+	unsigned long long search_ns;
+	/* Wall clock time spent in best_branch() */
+
+	unsigned long long expanded[STATS_MAX_PLY];
+	/* Interior nodes searched at each ply from the root */
+
+	unsigned long long branches[STATS_MAX_PLY];
+	/* Children found on the nodes in expanded at each ply */
+} __attribute__((aligned(64)));
+
+
+typedef struct BaoStats BaoStats;
+
+
+#ifndef BAO_NO_STATS
+
+extern __thread BaoStats *stats_local;
+
+BaoStats *stats_attach(void);
+
+/* Single writer per block so a relaxed store is enough, no locked ops */
+#define STATS_ADD(field, n) do { \
+	BaoStats *stats_p_ = stats_local ? stats_local : stats_attach(); \
+	__atomic_store_n(&stats_p_->field, stats_p_->field + (n), \
+			__ATOMIC_RELAXED); \
+} while(0)
+
+#define STATS_PLY(ply) ((ply) < STATS_MAX_PLY ? (ply) : STATS_MAX_PLY - 1)
+
+#else
+
+#define STATS_ADD(field, n) ((void) sizeof(n))
+
+#define STATS_PLY(ply) 0
+
+#endif /* BAO_NO_STATS */
+
+#define STATS_INC(field) STATS_ADD(field, 1)
+
+
+int stats_enabled(void);
+
+
+void stats_collect(BaoStats *total);
+
+
+void stats_reset(void);
+
+
+void stats_print(FILE *fp, const BaoStats *st);
+
+
+unsigned long long stats_now_ns(void);
+
+
+#endif /* BAOSTATS_H */
@@ -0,0 +1,223 @@
+/******************************************************************************
+ *	trace.c: Sampled move execution traces
+ *
+ *		run_move() asks trace_sample() before every move. While tracing is
+ *		off that is a load and a branch, with trace_set_period(n) one move
+ *		in n on each thread is run on a counting copy of the move loop and
+ *		its MoveTrace pushed to the thread's ring. Rings are allocated on
+ *		first push and only ever written by their owner, trace_drain()
+ *		reads them without stopping the writers: records overwritten
+ *		while being read are dropped and counted as lost. A thread that
+ *		exits hands its ring, records not drained yet included, on to the
+ *		next thread that pushes; a push finding no ring is counted as
+ *		lost too.
+ *
+ *		Build with -DBAO_NO_TRACE to compile tracing out altogether.
+ *****************************************************************************/
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#ifndef BAO_NO_TRACE
+
+struct TraceRing {
+	unsigned long long begun;	/* Records started, owner writes */
+	unsigned long long done;	/* Records finished, owner writes */
+	unsigned long long tail;	/* Records drained, trace_drain() writes */
+	MoveTrace traces[TRACE_RING_SIZE];
+};
+
+
+typedef struct TraceRing TraceRing;
+
+
+unsigned int trace_period;
+
+__thread unsigned int trace_countdown;
+
+static TraceRing *trace_rings[TRACE_MAX_THREADS];
+
+static unsigned int trace_nrings;
+
+static TraceRing *trace_idle[TRACE_MAX_THREADS];
+/* Rings of threads that exited, trace_lock held */
+
+static unsigned int trace_nidle;
+
+static unsigned long long trace_refused;
+/* Pushes that found no ring, trace_drain() takes them as lost */
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static pthread_key_t trace_key;
+
+static int trace_keyed;
+
+static __thread TraceRing *trace_local;
+
+static __thread int trace_failed;
+
+
+/* Thread exit: the ring goes to the next thread to attach */
+static void trace_detach(void *ring)
+{
+	pthread_mutex_lock(&trace_lock);
+	trace_idle[trace_nidle++] = (TraceRing *) ring;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+static void trace_init_key(void)
+{
+	trace_keyed = pthread_key_create(&trace_key, trace_detach) == 0;
+}
+
+
+/* Gives the calling thread a ring, NULL if out of memory or slots */
+static TraceRing *trace_attach(void)
+{
+	TraceRing *ring;
+
+	if(trace_failed)
+		return NULL;
+	pthread_once(&trace_once, trace_init_key);
+	pthread_mutex_lock(&trace_lock);
+	ring = NULL;
+	if(trace_nidle) {
+		ring = trace_idle[--trace_nidle];
+	} else if(trace_nrings < TRACE_MAX_THREADS
+	&& (ring = (TraceRing *) calloc(1, sizeof(TraceRing))) != NULL) {
+		__atomic_store_n(&trace_rings[trace_nrings], ring, __ATOMIC_RELEASE);
+		__atomic_store_n(&trace_nrings, trace_nrings + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&trace_lock);
+	if(ring == NULL) {
+		trace_failed = 1;
+		return NULL;
+	}
+	/* Without the key the ring stays with this thread for good */
+	if(trace_keyed)
+		pthread_setspecific(trace_key, ring);
+	trace_local = ring;
+	return ring;
+}
+
+
+int trace_enabled(void)
+{
+	return 1;
+}
+
+
+/*****************************************************************************
+ * trace_set_period: Traces one move in period on every thread from now on.
+ *
+ *		0 turns tracing off, 1 traces every move.
+ *****************************************************************************/
+void trace_set_period(unsigned int period)
+{
+	__atomic_store_n(&trace_period, period, __ATOMIC_RELAXED);
+}
+
+
+void trace_push(const MoveTrace *trace)
+{
+	TraceRing *ring = trace_local ? trace_local : trace_attach();
+	unsigned long long n;
+
+	if(ring == NULL) {
+		__atomic_fetch_add(&trace_refused, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	n = ring->begun;
+	__atomic_store_n(&ring->begun, n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ring->traces[n & (TRACE_RING_SIZE - 1)] = *trace;
+	__atomic_store_n(&ring->done, n + 1, __ATOMIC_RELEASE);
+}
+
+
+/*****************************************************************************
+ * trace_drain: Hands every MoveTrace pushed since the last call to fn.
+ *
+ *		Traces come ring by ring, oldest first on each ring. Traces that
+ *		were overwritten before they could be read (the ring holds the
+ *		last TRACE_RING_SIZE) or that found no ring to go to (more than
+ *		TRACE_MAX_THREADS threads tracing at once) are added to *lost if
+ *		lost is not NULL.
+ *
+ *		NOTE: Only one thread may drain at a time.
+ *
+ * Returns: The number of traces passed to fn.
+ *****************************************************************************/
+size_t trace_drain(void (*fn)(const MoveTrace *, void *), void *arg,
+		unsigned long long *lost)
+{
+	TraceRing *ring;
+	MoveTrace trace;
+	unsigned long long i, done, skipped;
+	unsigned int r, n;
+	size_t count;
+
+	n = __atomic_load_n(&trace_nrings, __ATOMIC_ACQUIRE);
+	count = 0;
+	skipped = __atomic_exchange_n(&trace_refused, 0, __ATOMIC_RELAXED);
+	for(r = 0; r < n; r++) {
+		if((ring = __atomic_load_n(&trace_rings[r], __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+		i = ring->tail;
+		if(done - i > TRACE_RING_SIZE) {
+			skipped += done - TRACE_RING_SIZE - i;
+			i = done - TRACE_RING_SIZE;
+		}
+		for(; i < done; i++) {
+			memcpy(&trace, &ring->traces[i & (TRACE_RING_SIZE - 1)],
+					sizeof(MoveTrace));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&ring->begun, __ATOMIC_RELAXED) - i
+					> TRACE_RING_SIZE) {
+				skipped++;		/* Overwritten while we copied it */
+				continue;
+			}
+			fn(&trace, arg);
+			count++;
+		}
+		ring->tail = done;
+	}
+	if(lost != NULL)
+		*lost += skipped;
+	return count;
+}
+
+#else
+
+int trace_enabled(void)
+{
+	return 0;
+}
+
+
+void trace_set_period(unsigned int period)
+{
+}
+
+
+void trace_push(const MoveTrace *trace)
+{
+}
+
+
+size_t trace_drain(void (*fn)(const MoveTrace *, void *), void *arg,
+		unsigned long long *lost)
+{
+	return 0;
+}
+
+#endif /* BAO_NO_TRACE */
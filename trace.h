@@ -0,0 +1,93 @@
+#ifndef BAOTRACE_H
+#define BAOTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	TRACE_RING_SIZE   = 4096,	/* MoveTraces per thread, a power of 2 */
+	TRACE_MAX_THREADS = 64		/* Threads tracing at once that get a ring */
+};
+
+
+struct MoveTrace {
+	/* What one run_move() call did, from the hand it was given to the
+	 * status it returned. A haulted move that is continued gives two. */
+
+	const char *engine;
+	/* Name of the engine that ran it (see get_engine) */
+
+	uint64_t ns;
+	/* Wall clock time */
+
+	uint32_t steps;
+	/* Lifts, sows and side switches, as counted by exec_move() */
+
+	uint32_t lifts;
+
+	uint32_t sows;
+
+	uint32_t captures;
+	/* Lifts from the opponent's side */
+
+	uint32_t switches;
+	/* Side switches, one onto the opponent's side and one back for each
+	 * capture */
+
+	uint8_t status;
+	/* MoveExecSts returned */
+
+	uint8_t hole;
+	/* Where the hand was when the call began */
+
+	uint8_t side;
+};
+
+
+typedef struct MoveTrace MoveTrace;
+
+
+#ifndef BAO_NO_TRACE
+
+extern unsigned int trace_period;
+
+extern __thread unsigned int trace_countdown;
+
+
+/* Whether the calling thread should trace the move it is about to run */
+static inline int trace_sample(void)
+{
+	unsigned int period = __atomic_load_n(&trace_period, __ATOMIC_RELAXED);
+
+	if(__builtin_expect(period == 0, 1))
+		return 0;
+	if(trace_countdown > 1) {
+		trace_countdown--;
+		return 0;
+	}
+	trace_countdown = period;
+	return 1;
+}
+
+#else
+
+#define trace_sample() 0
+
+#endif /* BAO_NO_TRACE */
+
+
+int trace_enabled(void);
+
+
+void trace_set_period(unsigned int period);
+
+
+void trace_push(const MoveTrace *trace);
+
+
+size_t trace_drain(void (*fn)(const MoveTrace *, void *), void *arg,
+		unsigned long long *lost);
+
+
+#endif /* BAOTRACE_H */
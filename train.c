@@ -0,0 +1,747 @@
+/******************************************************************************
+ *	train.c: Training data for the evaluation and a tuner for its weights
+ *
+ *		A TrainSet is a flat array of positions: eval_features() of each
+ *		and how its game ended for the side to move (enum TrainResult).
+ *		Games are played (train_selfplay) or replayed from the game
+ *		archive (train_replay) by threads that each take a contiguous
+ *		share of them. The shares are put back together in game order and
+ *		each game is played from its own seed, so a set does not depend on
+ *		the number of threads. On disk a set is a SetHeader and the
+ *		records, in native byte order.
+ *
+ *		train_tune() fits the weights of eval_state() the way Texel tuning
+ *		does: a position's expected result is sigmoid(eval / scale), with
+ *		eval in seeds. scale is fitted first with the starting weights and
+ *		then kept, so the weights stay in seeds, and every weight is moved
+ *		down the gradient of the mean squared error with Adam. The threads
+ *		sum the error and gradient over their slices of the set once per
+ *		epoch, a record at a time in Lanes of floats (GCC vector
+ *		extensions) so the dot product and the gradient update are SIMD
+ *		whatever the compiler flags.
+ *****************************************************************************/
+
+#include "train.h"
+#include "gamedb.h"
+#include "move_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define SET_MAGIC "BAOT"
+
+
+enum {
+	SET_VERSION = 1,
+	PATH_SIZE   = 4096,
+	LANE_WIDTH  = 4,		/* Floats per Lane */
+	NLANES      = (EVAL_NFEATURES + LANE_WIDTH - 1) / LANE_WIDTH,
+	FLUSH       = 4096,		/* Records summed in floats before the running
+							 * totals (doubles) get them */
+	SCALE_STEPS = 32,		/* Golden section steps fitting the scale */
+	ROW         = 9			/* Weights per line in train_emit() */
+};
+
+
+typedef float Lane __attribute__((vector_size(LANE_WIDTH * sizeof(float))));
+
+
+struct SetHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t nfeatures;		/* EVAL_NFEATURES of the writer */
+	uint32_t pad;
+	uint64_t n;
+};
+
+
+struct Archive {
+	/* Games read from the game archive, see train_replay() */
+	Move *moves;
+	size_t nmoves;
+	size_t size;			/* Moves allocated */
+	size_t *offsets;		/* Where each game starts in moves, and ends */
+	size_t ngames;
+	size_t nsize;			/* Offsets allocated */
+};
+
+
+struct Worker {
+	/* A thread's share of the games and the positions found in them */
+	const BaoRules *rules;
+	const TrainConfig *cfg;
+	size_t first;			/* Number of its first game */
+	size_t ngames;
+	const struct Archive *archive;	/* NULL for self-play */
+
+	TrainSet out;
+	int error;				/* errno if the thread failed */
+};
+
+
+struct Slice {
+	/* A tuning thread's share of the set and its sums over it */
+	const unsigned char *records;
+	size_t n;
+	const Lane *weights;
+	float inv_scale;
+	int gradient;			/* Non-zero to sum the gradient too */
+
+	double error;			/* Sum of squared errors */
+	double grad[NLANES * LANE_WIDTH];
+};
+
+
+const TrainConfig default_train_config = {
+	1,			/* nthreads */
+	1,			/* seed */
+	2,			/* depth */
+	10,			/* explore */
+	400,		/* max_plies */
+	0,			/* skip_plies */
+	300,		/* epochs */
+	0.02,		/* rate */
+	NULL,		/* report */
+	NULL		/* arg */
+};
+
+
+/* splitmix64, each game gets its own stream (see TrainConfig.seed) */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+/* Adds state to set, its result byte holding the side to move for now */
+static int add_record(TrainSet *set, const BaoState *state)
+{
+	unsigned char *rec;
+	size_t size;
+
+	if((set->n + 1) * TRAIN_RECORD_SIZE > set->size) {
+		size = set->size ? set->size * 2 : 4096 * TRAIN_RECORD_SIZE;
+		if((rec = realloc(set->records, size)) == NULL)
+			return -1;
+		set->records = rec;
+		set->size = size;
+	}
+	rec = set->records + set->n++ * TRAIN_RECORD_SIZE;
+	eval_features(state, rec);
+	rec[EVAL_NFEATURES] = state->player;
+	return 0;
+}
+
+
+/* Turns the side to move of records first.. into results, winner being -1
+ * for a draw */
+static void set_results(TrainSet *set, size_t first, int winner)
+{
+	unsigned char *res;
+	size_t i;
+
+	for(i = first; i < set->n; i++) {
+		res = set->records + i * TRAIN_RECORD_SIZE + EVAL_NFEATURES;
+		*res = winner == -1 ? TR_DRAW : *res == winner ? TR_WIN : TR_LOSS;
+	}
+}
+
+
+/*****************************************************************************
+ * play_game: Plays self-play game g from start, adding its positions to
+ *		w->out.
+ *
+ *		Each move is best_branch()'s at cfg->depth, or a random one for
+ *		cfg->explore percent of them. The history table is cleared first
+ *		and the transposition table left out, so the game only depends on
+ *		its seed.
+ *
+ * Returns: 0 on success, -1 on error (errno set)
+ *****************************************************************************/
+static int play_game(struct Worker *w, BaoTree *root, const BaoState *start,
+		size_t g)
+{
+	static const unsigned int no_history[SEARCH_HISTORY_SIZE];
+	const TrainConfig *cfg = w->cfg;
+	SearchParams params;
+	BaoState next;
+	uint64_t rng;
+	size_t first;
+	int ply, path, winner;
+
+	params = default_search_params;
+	params.tt = 0;
+	search_set_history(no_history);
+	rng = cfg->seed + g;
+	root->state = *start;
+	first = w->out.n;
+	winner = -1;
+	for(ply = 0; ply < cfg->max_plies; ply++) {
+		if(grow_tree(root, w->rules) == -1)
+			return -1;
+		if(root->nchildren == 0) {
+			winner = root->state.player == P_NORTH ? P_SOUTH : P_NORTH;
+			break;
+		}
+		if(ply >= cfg->skip_plies && add_record(&w->out, &root->state) == -1)
+			return -1;
+		if(cfg->depth == 0 || next_random(&rng) % 100 < cfg->explore)
+			path = next_random(&rng) % root->nchildren;
+		else if((path = best_branch_with(root, w->rules, cfg->depth,
+						&params)) == -1)
+			return -1;
+		next = root->children[path].state;
+		prune_tree(root);
+		root->state = next;
+	}
+	prune_tree(root);
+	set_results(&w->out, first, winner);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * replay_game: Replays archived game g from start, adding its positions to
+ *		w->out.
+ *
+ *		A game that runs out of moves was lost by the side to move, one
+ *		that stops before is a draw. A game with an illegal move is left
+ *		out altogether.
+ *
+ * Returns: 0 on success, -1 on error (errno set)
+ *****************************************************************************/
+static int replay_game(struct Worker *w, BaoTree *root, const BaoState *start,
+		size_t g)
+{
+	const struct Archive *a = w->archive;
+	BaoState next;
+	size_t i, first;
+	int ply, path, winner;
+
+	root->state = *start;
+	first = w->out.n;
+	for(i = a->offsets[g], ply = 0; i < a->offsets[g + 1]; i++, ply++) {
+		if(grow_tree(root, w->rules) == -1)
+			return -1;
+		if((path = find_branch(root, &a->moves[i])) == -1) {
+			prune_tree(root);
+			w->out.n = first;
+			return 0;
+		}
+		if(ply >= w->cfg->skip_plies
+				&& add_record(&w->out, &root->state) == -1)
+			return -1;
+		next = root->children[path].state;
+		prune_tree(root);
+		root->state = next;
+	}
+	if(grow_tree(root, w->rules) == -1)
+		return -1;
+	winner = -1;
+	if(root->nchildren == 0)
+		winner = root->state.player == P_NORTH ? P_SOUTH : P_NORTH;
+	prune_tree(root);
+	set_results(&w->out, first, winner);
+	return 0;
+}
+
+
+static void *run_worker(void *arg)
+{
+	struct Worker *w = arg;
+	BaoTree *root;
+	BaoState start;
+	size_t g;
+	int ret;
+
+	if((root = new_tree(w->rules)) == NULL) {
+		w->error = errno;
+		return NULL;
+	}
+	start = root->state;
+	for(g = w->first; g < w->first + w->ngames; g++) {
+		if(w->archive != NULL)
+			ret = replay_game(w, root, &start, g);
+		else
+			ret = play_game(w, root, &start, g);
+		if(ret == -1) {
+			w->error = errno ? errno : EIO;
+			break;
+		}
+	}
+	free_tree(root);
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * run_games: Splits ngames games among cfg->nthreads threads and puts what
+ *		they found in set, in game order.
+ *
+ * Returns: 0 on success, -1 on error (errno set)
+ *****************************************************************************/
+static int run_games(TrainSet *set, const BaoRules *rules, size_t ngames,
+		const struct Archive *archive, const TrainConfig *cfg)
+{
+	struct Worker w[TRAIN_MAX_THREADS];
+	pthread_t tids[TRAIN_MAX_THREADS];
+	size_t per, n;
+	int i, nthreads, err, shared;
+
+	nthreads = cfg->nthreads < 1 ? 1 : cfg->nthreads;
+	if(nthreads > TRAIN_MAX_THREADS)
+		nthreads = TRAIN_MAX_THREADS;
+	memset(w, 0, sizeof(w));
+	per = (ngames + nthreads - 1) / nthreads;
+	for(i = 0; i < nthreads; i++) {
+		w[i].rules = rules;
+		w[i].cfg = cfg;
+		w[i].archive = archive;
+		w[i].first = i * per < ngames ? i * per : ngames;
+		w[i].ngames = ngames - w[i].first < per ? ngames - w[i].first : per;
+	}
+	/* Under a tree budget the calling thread plays them all */
+	shared = nthreads > 1 && tree_share_begin() == 0;
+	for(i = 1; i < nthreads; i++)
+		if(!shared || pthread_create(&tids[i], NULL, run_worker, &w[i]) != 0)
+			tids[i] = 0;
+	for(i = 0; i < nthreads; i++)
+		if(i == 0 || tids[i] == 0)
+			run_worker(&w[i]);
+	for(i = 1; i < nthreads; i++)
+		if(tids[i])
+			pthread_join(tids[i], NULL);
+	if(shared)
+		tree_share_end();
+
+	err = 0;
+	n = 0;
+	for(i = 0; i < nthreads; i++) {
+		if(w[i].error)
+			err = w[i].error;
+		n += w[i].out.n;
+	}
+	memset(set, 0, sizeof(*set));
+	if(!err && n && (set->records = malloc(n * TRAIN_RECORD_SIZE)) == NULL)
+		err = errno;
+	for(i = 0; i < nthreads; i++) {
+		if(!err && w[i].out.n) {
+			memcpy(set->records + set->n * TRAIN_RECORD_SIZE,
+					w[i].out.records, w[i].out.n * TRAIN_RECORD_SIZE);
+			set->n += w[i].out.n;
+		}
+		free(w[i].out.records);
+	}
+	set->size = set->n * TRAIN_RECORD_SIZE;
+	if(err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * train_selfplay: Plays ngames games from the start position, see
+ *		play_game() and TrainConfig.
+ *
+ * Returns: 0 and fills set (see train_free), -1 on error (errno set)
+ *****************************************************************************/
+int train_selfplay(TrainSet *set, const BaoRules *rules, int ngames,
+		const TrainConfig *cfg)
+{
+	return run_games(set, rules, ngames < 0 ? 0 : ngames, NULL, cfg);
+}
+
+
+/* gamedb_games() callback, adds a game to the Archive at arg */
+static int archive_game(const Move *moves, int nmoves, void *arg)
+{
+	struct Archive *a = arg;
+	size_t *offsets;
+	Move *grown;
+
+	if(a->ngames + 2 > a->nsize) {
+		a->nsize = a->nsize ? a->nsize * 2 : 1024;
+		if((offsets = realloc(a->offsets, a->nsize * sizeof(*offsets)))
+				== NULL)
+			return -1;
+		a->offsets = offsets;
+	}
+	if(a->nmoves + nmoves > a->size) {
+		a->size = a->size ? a->size * 2 : 65536;
+		while(a->nmoves + nmoves > a->size)
+			a->size *= 2;
+		if((grown = realloc(a->moves, a->size * sizeof(*grown))) == NULL)
+			return -1;
+		a->moves = grown;
+	}
+	memcpy(a->moves + a->nmoves, moves, nmoves * sizeof(*moves));
+	a->offsets[a->ngames++] = a->nmoves;
+	a->nmoves += nmoves;
+	a->offsets[a->ngames] = a->nmoves;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * train_replay: Replays the games archived for variant in dir (see
+ *		gamedb.c), see replay_game().
+ *
+ * Returns: 0 and fills set (see train_free), -1 on error (errno set)
+ *****************************************************************************/
+int train_replay(TrainSet *set, const char *dir, const char *variant,
+		const BaoRules *rules, const TrainConfig *cfg)
+{
+	struct Archive a;
+	int ret;
+
+	memset(&a, 0, sizeof(a));
+	if((ret = gamedb_games(dir, variant, archive_game, &a)) == 0)
+		ret = run_games(set, rules, a.ngames, &a, cfg);
+	free(a.moves);
+	free(a.offsets);
+	return ret;
+}
+
+
+/*****************************************************************************
+ * train_save: Writes set to path, through path.tmp so a reader never sees
+ *		half a set.
+ *
+ * Returns: 0 on success else -1 (errno set)
+ *****************************************************************************/
+int train_save(const TrainSet *set, const char *path)
+{
+	char tmp[PATH_SIZE];
+	struct SetHeader hd;
+	int fd, ret, saved;
+
+	if(snprintf(tmp, PATH_SIZE, "%s.tmp", path) >= PATH_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, SET_MAGIC, 4);
+	hd.version = SET_VERSION;
+	hd.nfeatures = EVAL_NFEATURES;
+	hd.n = set->n;
+	ret = -1;
+	if(write_all(fd, &hd, sizeof(hd)) == 0
+			&& write_all(fd, set->records, set->n * TRAIN_RECORD_SIZE) == 0)
+		ret = 0;
+	if(close(fd) == -1)
+		ret = -1;
+	if(ret == 0)
+		return rename(tmp, path);
+	saved = errno;
+	unlink(tmp);
+	errno = saved;
+	return -1;
+}
+
+
+/*****************************************************************************
+ * train_load: Maps the set at path in, read only.
+ *
+ * Returns: 0 and fills set, -1 on error (errno set, EINVAL if the file is
+ *			not a set of this program's features)
+ *****************************************************************************/
+int train_load(TrainSet *set, const char *path)
+{
+	const struct SetHeader *hd;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if(st.st_size < sizeof(*hd)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+	hd = map;
+	if(memcmp(hd->magic, SET_MAGIC, 4) != 0 || hd->version != SET_VERSION
+			|| hd->nfeatures != EVAL_NFEATURES
+			|| st.st_size != sizeof(*hd) + hd->n * TRAIN_RECORD_SIZE) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	set->records = (unsigned char *) (hd + 1);
+	set->n = hd->n;
+	set->size = 0;
+	set->map_size = st.st_size;
+	return 0;
+}
+
+
+void train_free(TrainSet *set)
+{
+	if(set->size)
+		free(set->records);
+	else if(set->map_size)
+		munmap(set->records - sizeof(struct SetHeader), set->map_size);
+	memset(set, 0, sizeof(*set));
+}
+
+
+/*****************************************************************************
+ * sum_slice: Sums the squared error of sl's records, and the gradient of
+ *		it over the weights if sl->gradient is set.
+ *
+ *		Per record, e being the weighted features and p = sigmoid(e / scale)
+ *		the expected result, the error is p - result and its gradient
+ *		(halved) error * p * (1 - p) / scale times the features.
+ *****************************************************************************/
+static void *sum_slice(void *arg)
+{
+	struct Slice *sl = arg;
+	unsigned char padded[NLANES * LANE_WIDTH];
+	const unsigned char *rec;
+	Lane f[NLANES], grad[NLANES], dot;
+	float e, p, err;
+	size_t i;
+	int j, k;
+
+	memset(padded, 0, sizeof(padded));
+	memset(grad, 0, sizeof(grad));
+	memset(sl->grad, 0, sizeof(sl->grad));
+	sl->error = 0;
+	for(i = 0; i < sl->n; i++) {
+		rec = sl->records + i * TRAIN_RECORD_SIZE;
+		memcpy(padded, rec, EVAL_NFEATURES);
+		dot = (Lane) {0};
+		for(k = 0; k < NLANES; k++) {
+			for(j = 0; j < LANE_WIDTH; j++)
+				f[k][j] = padded[k * LANE_WIDTH + j];
+			dot += sl->weights[k] * f[k];
+		}
+		e = 0;
+		for(j = 0; j < LANE_WIDTH; j++)
+			e += dot[j];
+		p = 1 / (1 + expf(-e * sl->inv_scale));
+		err = p - rec[EVAL_NFEATURES] * 0.5f;
+		sl->error += err * err;
+		if(!sl->gradient)
+			continue;
+		err *= p * (1 - p) * sl->inv_scale;
+		for(k = 0; k < NLANES; k++)
+			grad[k] += err * f[k];
+		if((i + 1) % FLUSH == 0 || i + 1 == sl->n) {
+			for(k = 0; k < NLANES; k++) {
+				for(j = 0; j < LANE_WIDTH; j++)
+					sl->grad[k * LANE_WIDTH + j] += grad[k][j];
+				grad[k] = (Lane) {0};
+			}
+		}
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * sum_set: Mean squared error of set at weights (in seeds) and scale, and
+ *		its gradient in grad unless that is NULL, over nthreads threads.
+ *		A slice whose thread could not be started is summed on the
+ *		calling thread.
+ *
+ * Returns: The error.
+ *****************************************************************************/
+static double sum_set(const TrainSet *set, int nthreads, const double *weights,
+		double scale, double *grad)
+{
+	struct Slice sl[TRAIN_MAX_THREADS];
+	pthread_t tids[TRAIN_MAX_THREADS];
+	Lane w[NLANES];
+	size_t per;
+	double error;
+	int i, j;
+
+	memset(w, 0, sizeof(w));
+	for(j = 0; j < EVAL_NFEATURES; j++)
+		w[j / LANE_WIDTH][j % LANE_WIDTH] = weights[j];
+	per = (set->n + nthreads - 1) / nthreads;
+	for(i = 0; i < nthreads; i++) {
+		sl[i].records = set->records + (i * per < set->n ? i * per : set->n)
+			* TRAIN_RECORD_SIZE;
+		sl[i].n = i * per >= set->n ? 0
+			: set->n - i * per < per ? set->n - i * per : per;
+		sl[i].weights = w;
+		sl[i].inv_scale = 1 / scale;
+		sl[i].gradient = grad != NULL;
+	}
+	for(i = 1; i < nthreads; i++)
+		if(pthread_create(&tids[i], NULL, sum_slice, &sl[i]) != 0) {
+			sum_slice(&sl[i]);	/* On this thread then */
+			tids[i] = 0;
+		}
+	sum_slice(&sl[0]);
+	error = 0;
+	if(grad != NULL)
+		memset(grad, 0, EVAL_NFEATURES * sizeof(*grad));
+	for(i = 0; i < nthreads; i++) {
+		if(i > 0 && tids[i])
+			pthread_join(tids[i], NULL);
+		error += sl[i].error;
+		for(j = 0; grad != NULL && j < EVAL_NFEATURES; j++)
+			grad[j] += sl[i].grad[j] / set->n;
+	}
+	return error / set->n;
+}
+
+
+/*****************************************************************************
+ * train_tune: Fits weights (in seeds, starting from the ones passed in) to
+ *		set, see the top of this file.
+ *
+ *		cfg->epochs passes of Adam at cfg->rate, on cfg->nthreads threads.
+ *		cfg->report, if not NULL, gets the error after each epoch.
+ *
+ * Returns: 0 and sets weights, scale (seeds of eval that make e times
+ *			the odds) and loss (final mean squared error), -1 if set is
+ *			empty (errno EINVAL)
+ *****************************************************************************/
+int train_tune(const TrainSet *set, const TrainConfig *cfg, double *weights,
+		double *scale, double *loss)
+{
+	static const double gr = 0.6180339887498949;
+	double grad[EVAL_NFEATURES], m[EVAL_NFEATURES], v[EVAL_NFEATURES];
+	double a, b, c, d, fc, fd, b1t, b2t;
+	int i, j, nthreads;
+
+	if(set->n == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	nthreads = cfg->nthreads < 1 ? 1 : cfg->nthreads;
+	if(nthreads > TRAIN_MAX_THREADS)
+		nthreads = TRAIN_MAX_THREADS;
+
+	/* Golden section search for the scale, in logs as it spans decades */
+	a = log(0.25);
+	b = log(256);
+	c = b - gr * (b - a);
+	d = a + gr * (b - a);
+	fc = sum_set(set, nthreads, weights, exp(c), NULL);
+	fd = sum_set(set, nthreads, weights, exp(d), NULL);
+	for(i = 0; i < SCALE_STEPS; i++) {
+		if(fc < fd) {
+			b = d;
+			d = c;
+			fd = fc;
+			c = b - gr * (b - a);
+			fc = sum_set(set, nthreads, weights, exp(c), NULL);
+		} else {
+			a = c;
+			c = d;
+			fc = fd;
+			d = a + gr * (b - a);
+			fd = sum_set(set, nthreads, weights, exp(d), NULL);
+		}
+	}
+	*scale = exp((a + b) / 2);
+
+	memset(m, 0, sizeof(m));
+	memset(v, 0, sizeof(v));
+	b1t = b2t = 1;
+	for(i = 0; i < cfg->epochs; i++) {
+		*loss = sum_set(set, nthreads, weights, *scale, grad);
+		b1t *= 0.9;
+		b2t *= 0.999;
+		for(j = 0; j < EVAL_NFEATURES; j++) {
+			m[j] = 0.9 * m[j] + 0.1 * grad[j];
+			v[j] = 0.999 * v[j] + 0.001 * grad[j] * grad[j];
+			weights[j] -= cfg->rate * (m[j] / (1 - b1t))
+				/ (sqrt(v[j] / (1 - b2t)) + 1e-12);
+		}
+		if(cfg->report != NULL)
+			cfg->report(i, *loss, cfg->arg);
+	}
+	*loss = sum_set(set, nthreads, weights, *scale, NULL);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * train_emit: Writes weights (in seeds) to path as an eval_weights.h, note
+ *		going in its top comment. Goes through path.tmp like train_save().
+ *
+ * Returns: 0 on success else -1 (errno set)
+ *****************************************************************************/
+int train_emit(const char *path, const double *weights, const char *note)
+{
+	static const char *rows[] = {
+		"Own holes, store last",
+		"Opponent's holes, store last",
+		"Nyumba (own, opponent's), takata, trap, namua, tempo"
+	};
+	static const int starts[] = {
+		EF_OWN_HOLES, EF_OPP_HOLES, EF_OWN_NYUMBA, EVAL_NFEATURES
+	};
+	char tmp[PATH_SIZE];
+	FILE *f;
+	long w;
+	int i, r;
+
+	if(snprintf(tmp, PATH_SIZE, "%s.tmp", path) >= PATH_SIZE) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((f = fopen(tmp, "w")) == NULL)
+		return -1;
+	fprintf(f, "/*****************************************************"
+			"*************************\n"
+			" *\teval_weights.h: Weights of eval_features() (see enum "
+			"EvalFeature)\n"
+			" *\n"
+			" *\t\tWritten by \"baotrain tune\" (see train.c) from\n"
+			" *\t\t%s.\n"
+			" *\t\tWeights are in 1/EVAL_WEIGHT_SCALE seeds.\n"
+			" *****************************************************"
+			"************************/\n\n"
+			"#ifndef BAOEVAL_WEIGHTS_H\n"
+			"#define BAOEVAL_WEIGHTS_H\n\n"
+			"#include \"eval.h\"\n\n\n"
+			"static const int16_t eval_weights[EVAL_NFEATURES] = {\n", note);
+	for(r = 0; r < 3; r++) {
+		fprintf(f, "\t/* %s */\n", rows[r]);
+		for(i = starts[r]; i < starts[r + 1]; i++) {
+			w = lround(weights[i] * EVAL_WEIGHT_SCALE);
+			w = w > INT16_MAX ? INT16_MAX : w < INT16_MIN ? INT16_MIN : w;
+			fprintf(f, "%s%ld%s", (i - starts[r]) % ROW ? " " : "\t", w,
+					i + 1 == EVAL_NFEATURES ? "\n" : i + 1 == starts[r + 1]
+					|| (i - starts[r]) % ROW == ROW - 1 ? ",\n" : ",");
+		}
+	}
+	fprintf(f, "};\n\n\n#endif /* BAOEVAL_WEIGHTS_H */\n");
+	if(fclose(f) == EOF) {
+		unlink(tmp);
+		return -1;
+	}
+	return rename(tmp, path);
+}
@@ -0,0 +1,103 @@
+#ifndef BAOTRAIN_H
+#define BAOTRAIN_H
+
+#include "eval.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum {
+	TRAIN_RECORD_SIZE = EVAL_NFEATURES + 1,
+	/* Bytes per position in a TrainSet: eval_features() then the result */
+	TRAIN_MAX_THREADS = 64
+};
+
+
+enum TrainResult {
+	/* Last byte of a record: how the game went for the side to move */
+	TR_LOSS,
+	TR_DRAW,	/* Cut short by max_plies, or an unfinished archived game */
+	TR_WIN
+};
+
+
+struct TrainConfig {
+	/* How a TrainSet is made and tuned on */
+
+	int nthreads;
+	/* Threads playing, replaying or tuning, at most TRAIN_MAX_THREADS.
+	 * The results do not depend on it. */
+
+	uint64_t seed;
+	/* Self-play game g uses seed + g. */
+
+	int depth;
+	/* Self-play: plies best_branch() searches for each move, 0 to play
+	 * at random. */
+
+	int explore;
+	/* Self-play: percent of moves played at random whatever depth. */
+
+	int max_plies;
+	/* Self-play: plies after which a game stops as a draw. */
+
+	int skip_plies;
+	/* Plies at the start of each game left out of the set. */
+
+	int epochs;
+	/* Tuning: passes over the whole set. */
+
+	double rate;
+	/* Tuning: step size, in seeds. */
+
+	void (*report)(int epoch, double loss, void *arg);
+	void *arg;
+	/* Tuning: called after each epoch if not NULL */
+};
+
+
+struct TrainSet {
+	/* Positions, TRAIN_RECORD_SIZE bytes each */
+	unsigned char *records;
+	size_t n;
+	size_t size;		/* Bytes allocated, 0 if mapped by train_load() */
+	size_t map_size;	/* Bytes mapped, header included */
+};
+
+
+typedef struct TrainConfig TrainConfig;
+
+typedef struct TrainSet TrainSet;
+
+typedef enum TrainResult TrainResult;
+
+
+extern const TrainConfig default_train_config;
+
+
+int train_selfplay(TrainSet *set, const BaoRules *rules, int ngames,
+		const TrainConfig *cfg);
+
+
+int train_replay(TrainSet *set, const char *dir, const char *variant,
+		const BaoRules *rules, const TrainConfig *cfg);
+
+
+int train_save(const TrainSet *set, const char *path);
+
+
+int train_load(TrainSet *set, const char *path);
+
+
+void train_free(TrainSet *set);
+
+
+int train_tune(const TrainSet *set, const TrainConfig *cfg, double *weights,
+		double *scale, double *loss);
+
+
+int train_emit(const char *path, const double *weights, const char *note);
+
+
+#endif /* BAOTRAIN_H */
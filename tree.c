@@ -31,13 +31,26 @@
  *****************************************************************************/
 
 #include "error.h"
+#include "stats.h"
+#include "trace.h"
 #include "tree.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 
+#define ENGINE_INLINE static inline __attribute__((always_inline))
+
+/* Counts into a MoveTrace, folded away where trace is a constant NULL */
+#define TRACE_ADD(trace, field, n) do { \
+	if(trace) \
+		(trace)->field += (n); \
+} while(0)
+
+
 /*****************************************************************************
  * 								PRIVATE DATA								 *
  *****************************************************************************/
@@ -66,9 +79,9 @@ static Player get_opponent(Player p)
 
 
 /* An interface for the following test_*_capture functions */
-static int can_capture(const BaoState *s, const BaoRules *r, Hole h)
+ENGINE_INLINE int can_capture(const BaoState *s, const BaoRules *r, Hole h)
 {
-	Player p = GET_PLAYER(s->flags);
+	Player p = s->player;
 
 	if(!IN_CAPTURE_RANGE(h) || s->board[p][h] == 0
 	|| s->board[get_opponent(p)][get_opposing_hole(h)] == 0)
@@ -92,8 +105,8 @@ typedef int (*MoveTestFunc)(const BaoState *, const BaoRules *,
  *
  * NOTE: Function assumes state is in NAMUA
  **************************************************************************/
-static int test_namua_capture(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_namua_capture(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	return can_capture(state, rules, h);
 }
@@ -108,8 +121,8 @@ static int test_namua_capture(const BaoState *state, const BaoRules *rules,
  *
  * Returns: Non-zero if move is defined else 0
  ***************************************************************************/
-static int test_namua_takata(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_namua_takata(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	/* NOTE: During normal game play, a takata on NYUMBA is not allowed */
 	if(state->board[state->player][h] == 0
@@ -120,7 +133,7 @@ static int test_namua_takata(const BaoState *state, const BaoRules *rules,
 
 
 
-static int test_namua_takata_singleton(const BaoState *state,
+ENGINE_INLINE int test_namua_takata_singleton(const BaoState *state,
 		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	if(state->board[state->player][h] == 0 || h == H_NYUMBA)
@@ -140,8 +153,8 @@ static int test_namua_takata_singleton(const BaoState *state,
  *
  * Returns:	0 if move is not found else 1
  ****************************************************************************/
-static int test_namua_special(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_namua_special(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	if(state->nyumba[state->player] && state->board[state->player][H_NYUMBA])
 		return 1;
@@ -154,8 +167,8 @@ static int test_namua_special(const BaoState *state, const BaoRules *rules,
  *
  * Returns: Non-zero if successful else 0
  *****************************************************************************/
-static int test_mtaji_capture(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_mtaji_capture(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	if(!IN_CAPTURE_RANGE(h) || state->board[state->player][h] == 0
 	|| state->board[state->player][h] > rules->max_nkhomo_for_mtaji_capture)
@@ -176,8 +189,8 @@ static int test_mtaji_capture(const BaoState *state, const BaoRules *rules,
  *
  * Returns: Non-zero on success else 0
  *****************************************************************************/
-static int test_mtaji_takata(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_mtaji_takata(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	if(state->board[state->player][h] <= 1) {
 		return 0;
@@ -201,12 +214,12 @@ static int test_mtaji_takata(const BaoState *state, const BaoRules *rules,
  *
  * NOTE: h and d are not used, state->trapped_hole is used
  ***************************************************************************/
-static int test_mtaji_special(const BaoState *state, const BaoRules *rules,
-		Hole h, MoveExecDir d)
+ENGINE_INLINE int test_mtaji_special(const BaoState *state,
+		const BaoRules *rules, Hole h, MoveExecDir d)
 {
 	Hole i;
 
-	if(state->trapped_hole < H_RFKICHWA
+	if(!IN_CAPTURE_RANGE(state->trapped_hole)
 	|| state->board[state->player][state->trapped_hole] <= 1)
 		return 0;
 	for(i = H_LFKICHWA; i <= H_RFKICHWA; i++) {
@@ -231,7 +244,7 @@ static int test_mtaji_special(const BaoState *state, const BaoRules *rules,
  *
  * Returns: Number of moves found.
  ***************************************************************************/
-static int get_moves_bak(Move *buf, int bufsz, const BaoState *state,
+ENGINE_INLINE int get_moves_bak(Move *buf, int bufsz, const BaoState *state,
 		const BaoRules *rules, Hole start, Hole stop, MoveTestFunc test_move)
 {
 	int nmoves = 0;
@@ -257,82 +270,6 @@ static int get_moves_bak(Move *buf, int bufsz, const BaoState *state,
 }
 
 
-/*****************************************************************************
- * get_moves: Fill buf with up to n possible moves if available.
- *
- *		Function probes for moves acceptable to state. It determines the type
- *		of possible moves (takata or capture) and sets the takata flag if
- *		the moves found are takata else unsets it if only mtaji moves or
- *		no moves(imples gameOver) are found.
- *
- * Returns: Number of moves found
- ****************************************************************************/
-static int get_moves(Move *buf, int bufsz, BaoState *state,
-		const BaoRules *rules)
-{
-	int nmoves;
-
-	if(IN_NAMUA(state, state->player)) {
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
-				H_RFKICHWA, test_namua_capture);
-		if(nmoves)
-			return nmoves;
-		state->takata = 1;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
-				H_RFKICHWA, test_namua_takata);
-		if(nmoves)
-			return nmoves;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
-				H_RFKICHWA, test_namua_takata_singleton);
-		if(nmoves)
-			return nmoves;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_NYUMBA, H_NYUMBA,
-				test_namua_special);
-		if(nmoves == 0)
-			state->takata = 0;
-		return nmoves;
-	} else {
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
-				H_LBKICHWA, test_mtaji_capture);
-		if(nmoves)
-			return nmoves;
-		state->takata = 1;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
-				H_RFKICHWA, test_mtaji_takata);
-		if(nmoves)
-			return nmoves;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, state->trapped_hole,
-				state->trapped_hole, test_mtaji_special);
-		if(nmoves)
-			return nmoves;
-		nmoves = get_moves_bak(buf, bufsz, state, rules, H_RBKICHWA,
-				H_LBKICHWA, test_mtaji_takata);
-		if(nmoves == 0)
-			state->takata = 0;
-		return nmoves;
-	}
-}
-
-
-/******************************************************************************
- * dup_node: Duplicates node's state and move.
- *
- *		The function creates a new tree and copies state and move from node.
- *
- * Returns: A node with the copied state on success else NULL
- *****************************************************************************/
-static BaoTree *dup_node(const BaoTree *node)
-{
-	BaoTree *new_node;
-
-	if((new_node = (BaoTree *) malloc(sizeof(BaoTree))) == NULL)
-		return NULL;
-	memcpy(&new_node->move, &node->move, sizeof(Move));
-	memcpy(&new_node->state, &node->state, sizeof(BaoState));
-	memset(new_node->children, 0, sizeof(BaoTree *) * MAXTRANS);
-	return new_node;
-}
-
 /*****************************************************************************
  * get_mtaji_moja_trap: Probe for a mtaji moja trap on state
  *
@@ -340,14 +277,15 @@ static BaoTree *dup_node(const BaoTree *node)
  *
  * NOTE: Trapping H_STORE is baologically impossible
  *****************************************************************************/
-static Hole get_mtaji_moja_trap(const BaoState *state, const BaoRules *rules)
+ENGINE_INLINE Hole get_mtaji_moja_trap(const BaoState *state,
+		const BaoRules *rules)
 {
-	Move buf[MAXTRANS];
+	Move buf[MAXMOVES];
 	int nmoves, i;
 
 	/* NYAXI... NYAXI.. NYAXI... NYAXI... */
 	/* NOTE: Multiple moves may trap the same hole */
-	nmoves = get_moves_bak(buf, MAXTRANS, state, rules, H_LFKICHWA, H_LBKICHWA,
+	nmoves = get_moves_bak(buf, MAXMOVES, state, rules, H_LFKICHWA, H_LBKICHWA,
 					test_mtaji_capture);
 	if(nmoves == 0)
 		return -1;
@@ -366,7 +304,7 @@ static Hole get_mtaji_moja_trap(const BaoState *state, const BaoRules *rules)
  *		switching of players. trapped_hole is set if it's sane to do so,
  *		takata in unset and player is alternated (switched).
  *****************************************************************************/
-static void prep_state(BaoState *state, const BaoRules *rules)
+ENGINE_INLINE void prep_state(BaoState *state, const BaoRules *rules)
 {
 	if(IN_MTAJI(state, state->player) && state->takata
 	&& rules->has_mtaji_moja_trap)
@@ -378,7 +316,7 @@ static void prep_state(BaoState *state, const BaoRules *rules)
 }
 
 
-static void update_node(BaoTree *node, const Move *move,
+ENGINE_INLINE void update_node(BaoTree *node, const Move *move,
 		const BaoRules *rules, int nyumba_sown)
 {
 	prep_state(&node->state,  rules);
@@ -388,7 +326,7 @@ static void update_node(BaoTree *node, const Move *move,
 }
 
 
-static int can_play_namua_special(const BaoState *s, const BaoRules *r,
+ENGINE_INLINE int can_play_namua_special(const BaoState *s, const BaoRules *r,
 		Hole h)
 {
 	return (s->takata && h == H_NYUMBA && s->nyumba[s->player]
@@ -403,13 +341,13 @@ static void Hand_lift(Hand *h)
 }
 
 
-static int Hand_can_lift(const Hand *h, const BaoRules *r)
+ENGINE_INLINE int Hand_can_lift(const Hand *h, const BaoRules *r)
 {
 	return (h->state->board[h->side][h->hole] > 1);
 }
 
 
-static int Hand_can_switch_side(const Hand *h, const BaoRules *r)
+ENGINE_INLINE int Hand_can_switch_side(const Hand *h, const BaoRules *r)
 {
 	/* cmp 'can_capture', FIX THIS! */
 	if(h->hole > H_RFKICHWA || h->state->takata
@@ -449,6 +387,27 @@ static void Hand_step(Hand *h)
 }
 
 
+/* Same as nkhomo rounds of Hand_step() and Hand_sow() on the hand's side */
+static void Hand_sow_all(Hand *h)
+{
+	unsigned char *row = h->state->board[h->side];
+	unsigned int laps;
+	Hole i;
+
+	laps = h->nkhomo / (H_LBKICHWA + 1);
+	if(laps) {
+		for(i = H_LFKICHWA; i <= H_LBKICHWA; i++)
+			row[i] += laps;
+		h->nkhomo -= laps * (H_LBKICHWA + 1);
+	}
+	while(h->nkhomo) {
+		Hand_step(h);
+		row[h->hole]++;
+		h->nkhomo--;
+	}
+}
+
+
 static void Hand_reset(Hand *h)
 {
 	if(h->hole <=H_LFKIMBI) {
@@ -465,150 +424,70 @@ static void Hand_reset(Hand *h)
 }
 
 /*****************************************************************************
- *								PUBLIC DATA									 *
- *****************************************************************************/
-
-
-BaoTree *new_tree(const BaoRules *rules)
-{
-	BaoTree *top;
-	Hole h;
-
-	if((top = (BaoTree *) malloc(sizeof(BaoTree))) == NULL)
-		return NULL;
-
-	top->move.hole = H_STORE;
-	top->move.dir = 0;
-	top->move.nyumba_sown = 0;
-
-	for(h =H_LFKICHWA; h <= H_STORE; h++) {
-		top->state.board[P_NORTH][h] = rules->board_setting[h];
-		top->state.board[P_SOUTH][h] = rules->board_setting[h];
-	}
-	top->state.nyumba[P_NORTH] = rules->has_nyumba;
-	top->state.nyumba[P_SOUTH] = rules->has_nyumba;
-	top->state.takata = 0;
-	top->state.trapped_hole = H_STORE;
-	top->state.player = P_SOUTH;
-
-	top->parent = NULL;
-
-	memset(top->children, 0, sizeof(BaoTree *) * MAXTRANS);
-
-	top->nchildren = 0;
-
-	return top;
-}
-
-
-void free_tree(BaoTree *top)
-{
-	BaoTree **p;
-
-	for(p = top->children; *p != NULL; p++)
-		free_tree(*p);
-	free(top);
-}
-
-
-
-/*****************************************************************************
- *	grow_tree: Branch parent into the next possible states.
+ * get_moves: Fill buf with up to n possible moves if available.
  *
- *		Function identifies possible (and acceptable) moves on parent's state
- * 		(parent->state), which it uses to populate parent->children with the
- * 		next possible sub trees (branches). All contents of parent->children
- * 		are overwritten with the new sub trees and a NULL marker in the end.
+ *		Function probes for moves acceptable to state. It determines the type
+ *		of possible moves (takata or capture) and sets the takata flag if
+ *		the moves found are takata else unsets it if only mtaji moves or
+ *		no moves(imples gameOver) are found.
  *
- *	Returns: Number of sub trees generated else a negative value  on error.
- *****************************************************************************/
-int grow_tree(BaoTree *parent, const BaoRules *rules)
+ * Returns: Number of moves found
+ ****************************************************************************/
+ENGINE_INLINE int get_moves_impl(Move *buf, int bufsz, BaoState *state,
+		const BaoRules *rules)
 {
-	Move buf[MAXTRANS];		/* possible moves */
-	Hand *hand;
-	BaoTree *child;
-	int i, nmoves;
-	MoveExecSts exec_sts;
+	int nmoves;
 
-	if(parent->nchildren)
-		return parent->nchildren;
-	nmoves = get_moves(buf, MAXTRANS, &parent->state, rules);
-	for(i = 0; i < nmoves; i++) {
-		if((child = dup_node(parent)) == NULL)
-			return -1;
-		hand = start_move(&child->state, rules, &buf[i]);
-		exec_sts = exec_move(hand, rules, rules->max_move_exec_depth);
-		if(exec_sts == MXS_HAULTED) {
-			if((parent->children[parent->nchildren] = dup_node(child)) == NULL)
-				return -1;
-			update_node(parent->children[parent->nchildren],
-					&buf[i], rules, 1);
-			parent->nchildren++;
-			continue_move(hand);
-			exec_sts = exec_move(hand, rules, rules->max_move_exec_depth);
-		}
-		if(exec_sts == MXS_NOTDONE) {
-			/* Possible never ending move */
-			end_move(hand);
-			free_tree(child);
-		} else {
-			parent->children[parent->nchildren] = child;
-			update_node(child, &buf[i], rules, 0);
-			parent->nchildren++;
-			end_move(hand);
+	if(IN_NAMUA(state, state->player)) {
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
+				H_RFKICHWA, test_namua_capture);
+		if(nmoves)
+			return nmoves;
+		state->takata = 1;
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
+				H_RFKICHWA, test_namua_takata);
+		if(nmoves)
+			return nmoves;
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
+				H_RFKICHWA, test_namua_takata_singleton);
+		if(nmoves)
+			return nmoves;
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_NYUMBA, H_NYUMBA,
+				test_namua_special);
+		if(nmoves == 0)
+			state->takata = 0;
+		return nmoves;
+	} else {
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
+				H_LBKICHWA, test_mtaji_capture);
+		if(nmoves)
+			return nmoves;
+		state->takata = 1;
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_LFKICHWA,
+				H_RFKICHWA, test_mtaji_takata);
+		if(nmoves)
+			return nmoves;
+		if(IN_CAPTURE_RANGE(state->trapped_hole)) {
+			nmoves = get_moves_bak(buf, bufsz, state, rules,
+					state->trapped_hole, state->trapped_hole,
+					test_mtaji_special);
+			if(nmoves)
+				return nmoves;
 		}
+		nmoves = get_moves_bak(buf, bufsz, state, rules, H_RBKICHWA,
+				H_LBKICHWA, test_mtaji_takata);
+		if(nmoves == 0)
+			state->takata = 0;
+		return nmoves;
 	}
-	return parent->nchildren;
-}
-
-
-#define CMP_MOVE(m, n) \
-	(((m).hole == (n).hole) && ((m).dir == (n).dir) \
-	 && ((m).nyumba_sown == (n).nyumba_sown))
-
-/*****************************************************************************
- * find_branch: Finds the branch move on node leads to
- *
- * 		Functions searchs node->children and to match them to move
- * 		(see BaoTree.move), if a possible match is found, it's path/index is
- * 		returned else -1 is returned.
- *
- * Returns:	Returns path/index of matching child else -1.
- ****************************************************************************/
-int find_branch(BaoTree *node, const Move *move)
-{
-	int i;
-
-	for(i = 0; i < node->nchildren; i++)
-		if(CMP_MOVE(node->children[i]->move, *move))
-			return i;
-	return -1;
-}
-
-int shift_tree(BaoTree **node_p, unsigned int path)
-{
-	if(path > (unsigned int) (*node_p)->nchildren)
-		return -1;
-	*node_p = (*node_p)->children[path];
-	return 0;
-}
-
-
-int unshift_tree(BaoTree **node_p)
-{
-	if((*node_p)->parent == NULL)
-		return -1;
-	*node_p = (*node_p)->parent;
-	return 0;
 }
 
 
-Hand *start_move(BaoState *state, const BaoRules *rules, const Move *move)
+/* Places hand at the start of move, see start_move */
+ENGINE_INLINE void Hand_start(Hand *hand, BaoState *state,
+		const BaoRules *rules, const Move *move)
 {
-	Hand *hand;
-
-	if((hand = (Hand *) malloc(sizeof(Hand))) == NULL)
-		return NULL;
+	STATS_INC(moves_executed);
 
 	hand->state = state;
 	hand->side = state->player;
@@ -633,18 +512,32 @@ Hand *start_move(BaoState *state, const BaoRules *rules, const Move *move)
 		}
 		Hand_lift(hand);
 	}
+}
+
+
+ENGINE_INLINE Hand *start_move_impl(BaoState *state, const BaoRules *rules,
+		const Move *move)
+{
+	Hand *hand;
 
+	if((hand = (Hand *) malloc(sizeof(Hand))) == NULL)
+		return NULL;
+	Hand_start(hand, state, rules, move);
 	return hand;
 }
 
 
-int exec_move(Hand *hand, const BaoRules *rules, int steps)
+ENGINE_INLINE MoveExecSts Hand_exec(Hand *hand, const BaoRules *rules,
+		int *steps, MoveTrace *trace)
 {
-	while(steps > 0) {
+	while(*steps > 0) {
 		if(hand->nkhomo == 0) {
 			if(Hand_can_switch_side(hand, rules)) {	/* can capture */
 				Hand_switch_side(hand);
 				Hand_lift(hand);
+				TRACE_ADD(trace, switches, 1);
+				TRACE_ADD(trace, captures, 1);
+				TRACE_ADD(trace, lifts, 1);
 				if(hand->hole == H_NYUMBA && hand->state->nyumba[hand->side])
 					hand->state->nyumba[hand->side] = 0;
 			} else if(Hand_can_lift(hand, rules)) {
@@ -656,6 +549,7 @@ int exec_move(Hand *hand, const BaoRules *rules, int steps)
 					} else {
 						Hand_lift(hand);
 						hand->state->nyumba[hand->side] = 0;
+						TRACE_ADD(trace, lifts, 1);
 						/* continue execution */
 					}
 				} else if(hand->state->board[hand->side][H_STORE] == 0
@@ -665,6 +559,7 @@ int exec_move(Hand *hand, const BaoRules *rules, int steps)
 					return MXS_DONE;
 				} else {
 					Hand_lift(hand);
+					TRACE_ADD(trace, lifts, 1);
 					/* continue execution */
 				}
 			} else {
@@ -676,17 +571,1334 @@ int exec_move(Hand *hand, const BaoRules *rules, int steps)
 				Hand_switch_side(hand);
 				Hand_reset(hand);
 				Hand_sow(hand);
+				TRACE_ADD(trace, switches, 1);
 			} else {
 				Hand_step(hand);
 				Hand_sow(hand);
 			}
+			TRACE_ADD(trace, sows, 1);
 		}
-		steps--;
+		(*steps)--;
 	}
 	return MXS_NOTDONE;
 }
 
 
+ENGINE_INLINE int exec_move_impl(Hand *hand, const BaoRules *rules,
+		int steps)
+{
+	MoveExecSts sts;
+	int left = steps;
+
+	sts = Hand_exec(hand, rules, &left, NULL);
+	STATS_ADD(exec_steps, steps - left);
+	return sts;
+}
+
+
+struct LiftPoint {
+	/* Everything the rest of a move depends on when the hand is empty */
+	unsigned char board[NPLAYERS][NHOLES];
+	unsigned char side;
+	unsigned char hole;
+	unsigned char dir;
+	unsigned char nyumba;
+};
+
+
+typedef struct LiftPoint LiftPoint;
+
+
+enum {
+	CANCEL_TICK = 4096	/* Lift points between looks at cancel_flag */
+};
+
+
+static __thread const int *cancel_flag;
+
+
+static void LiftPoint_get(LiftPoint *p, const Hand *hand)
+{
+	memcpy(p->board, hand->state->board, sizeof(p->board));
+	p->side = hand->side;
+	p->hole = hand->hole;
+	p->dir = hand->dir == MXD_RIGHT;
+	p->nyumba = (hand->state->nyumba[P_NORTH] != 0)
+		| (hand->state->nyumba[P_SOUTH] != 0) << 1;
+}
+
+
+/*****************************************************************************
+ * run_move_loop: Executes hand's move until it ends.
+ *
+ *		There is no step limit. Execution is deterministic, so a move that
+ *		gets back to a lift point (empty hand) it went through before goes
+ *		round the same loop forever. Loops are found with Brent's method:
+ *		one lift point is kept as a mark and every later one is compared
+ *		to it, the mark moving up to the current lift point after 1, 2, 4,
+ *		8... lifts. Some loops run through millions of lift points, this
+ *		finds them in constant space.
+ *
+ * Returns: MXS_DONE, MXS_HAULTED, MXS_PERPETUAL or MXS_ERROR (errno is
+ *			ECANCELED) if the thread's cancel flag got set, see set_cancel_flag.
+ *****************************************************************************/
+ENGINE_INLINE int run_move_loop(Hand *hand, const BaoRules *rules,
+		MoveTrace *trace)
+{
+	LiftPoint mark, point;
+	MoveExecSts sts;
+	int step, marked;
+	unsigned long long nsteps, power, lifts, nlifts;
+	const int *cancel = cancel_flag;
+
+	sts = MXS_NOTDONE;
+	nlifts = 0;
+	marked = 0;
+	nsteps = 0;
+	power = 1;
+	lifts = 0;
+	do {
+		if(hand->nkhomo == 0) {
+			if(cancel != NULL && (++nlifts & (CANCEL_TICK - 1)) == 0
+			&& __atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+				errno = ECANCELED;
+				sts = MXS_ERROR;
+				break;
+			}
+			LiftPoint_get(&point, hand);
+			if(marked && memcmp(&point, &mark, sizeof(LiftPoint)) == 0) {
+				sts = MXS_PERPETUAL;
+				break;
+			}
+			if(!marked || lifts == power) {
+				mark = point;
+				marked = 1;
+				power *= 2;
+				lifts = 0;
+			}
+			lifts++;
+		}
+		if(hand->nkhomo && hand->side == hand->state->player) {
+			/* Nothing is checked until the hand is empty again */
+			nsteps += hand->nkhomo;
+			TRACE_ADD(trace, sows, hand->nkhomo);
+			Hand_sow_all(hand);
+			continue;
+		}
+		step = 1;
+		sts = Hand_exec(hand, rules, &step, trace);
+		nsteps += 1 - step;
+	} while(sts == MXS_NOTDONE);
+	STATS_ADD(exec_steps, nsteps);
+	TRACE_ADD(trace, steps, nsteps);
+	return sts;
+}
+
+
+/* run_move_loop() on a counting copy, the MoveTrace goes to trace_push() */
+ENGINE_INLINE int run_move_traced(Hand *hand, const BaoRules *rules)
+{
+	MoveTrace trace;
+	unsigned long long t0;
+	int sts;
+
+	memset(&trace, 0, sizeof(trace));
+	trace.engine = get_engine(rules)->name;
+	trace.hole = hand->hole;
+	trace.side = hand->side;
+	t0 = stats_now_ns();
+	sts = run_move_loop(hand, rules, &trace);
+	trace.ns = stats_now_ns() - t0;
+	trace.status = sts;
+	trace_push(&trace);
+	return sts;
+}
+
+
+/*****************************************************************************
+ * run_move_impl: Executes hand's move until it ends, see run_move_loop.
+ *
+ *		Moves picked by trace_sample() are traced, the rest take one
+ *		untaken branch more.
+ *****************************************************************************/
+ENGINE_INLINE int run_move_impl(Hand *hand, const BaoRules *rules)
+{
+	if(__builtin_expect(trace_sample(), 0))
+		return run_move_traced(hand, rules);
+	return run_move_loop(hand, rules, NULL);
+}
+
+
+struct Block {
+	/* Header in front of every children block. Blocks allocated while a
+	 * tree budget is set are kept on a list from least to most recently
+	 * visited, for set_tree_budget. */
+	BaoTree *owner;			/* Node the children belong to */
+	struct Block *prev;		/* NULL if the block is not on the list */
+	struct Block *next;
+	size_t size;			/* Bytes, header included */
+	struct Stage *stage;	/* Moves left to execute if owner is staged,
+							 * kept at the end of the block */
+};
+
+
+struct Stage {
+	/* Moves of a staged node not executed yet, see stage_tree */
+	uint8_t nmoves;
+	uint8_t moves[MAXMOVES];	/* STAGE_CODE() of each, in get_moves() order */
+};
+
+
+typedef struct Block Block;
+
+typedef struct Stage Stage;
+
+
+#define NODE_BLOCK(node) ((Block *) (node)->children - 1)
+
+
+/* Guards the list, the budget and tree_sharers. Without a budget blocks
+ * stay off the list and the lock is only taken to free blocks still on it. */
+static pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Block lru = {NULL, &lru, &lru, 0};	/* List head, lru.next is oldest */
+
+static unsigned long lru_blocks;	/* Blocks on the list, atomic */
+
+static size_t tree_memory;			/* Atomic */
+
+static size_t tree_budget;			/* Written under lru_lock, read atomic */
+
+static unsigned int tree_sharers;	/* See tree_share_begin */
+
+
+#define HAS_BUDGET() (__atomic_load_n(&tree_budget, __ATOMIC_RELAXED) != 0)
+
+
+static void Block_unlink(Block *b)
+{
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+}
+
+
+static void Block_push(Block *b)
+{
+	b->prev = lru.prev;
+	b->next = &lru;
+	lru.prev->next = b;
+	lru.prev = b;
+}
+
+
+/* Marks node's children as just visited */
+static void touch_node(BaoTree *node)
+{
+	Block *b = NODE_BLOCK(node);
+
+	if(b->prev == NULL || !HAS_BUDGET())
+		return;
+	pthread_mutex_lock(&lru_lock);
+	Block_unlink(b);
+	Block_push(b);
+	pthread_mutex_unlock(&lru_lock);
+}
+
+
+/* prune_tree() for callers holding lru_lock, or sure that no block under
+ * node is on the list. Returns: Nodes freed */
+static unsigned long long prune_locked(BaoTree *node)
+{
+	Block *b;
+	unsigned long long n;
+	unsigned int i;
+
+	if(node->children == NULL)
+		return 0;
+	n = node->nchildren;
+	for(i = 0; i < node->nchildren; i++)
+		n += prune_locked(&node->children[i]);
+	b = NODE_BLOCK(node);
+	if(b->prev != NULL) {
+		Block_unlink(b);
+		__atomic_sub_fetch(&lru_blocks, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_sub_fetch(&tree_memory, b->size, __ATOMIC_RELAXED);
+	free(b);
+	node->children = NULL;
+	node->nchildren = 0;
+	node->naliases = 0;
+	return n;
+}
+
+
+/*****************************************************************************
+ * evict_lru: Frees the subtree visited least recently.
+ *
+ *		Subtrees holding keep (a node that is being grown) are left alone,
+ *		keep and every node a caller walked down through to get to it stay
+ *		where they are. The evicted subtree's top node is kept, with its
+ *		score and best path.
+ *
+ * Returns: 1 if some subtree was evicted, 0 if there was none to evict.
+ *****************************************************************************/
+static int evict_lru(const BaoTree *keep)
+{
+	const BaoTree *up;
+	Block *b;
+	unsigned long long n;
+
+	for(b = lru.next; b != &lru; b = b->next) {
+		for(up = keep; up != NULL && up != b->owner; up = up->parent)
+			;
+		if(up == NULL)
+			break;
+	}
+	if(b == &lru)
+		return 0;
+	/* Not inside STATS_ADD(), which compiles its argument out */
+	n = prune_locked(b->owner);
+	STATS_INC(evictions);
+	STATS_ADD(evicted_nodes, n);
+	return 1;
+}
+
+
+/*****************************************************************************
+ * alloc_block: Allocates a block of size bytes for parent's children.
+ *
+ *		Without a budget that is a malloc(). With one the block goes on the
+ *		list and old subtrees are evicted to stay within the budget, and
+ *		to make room if malloc() fails. When nothing can be evicted the
+ *		budget is overrun rather than failing.
+ *
+ * Returns: Space for the children or NULL.
+ *****************************************************************************/
+static BaoTree *alloc_block(BaoTree *parent, size_t size)
+{
+	Block *b;
+
+	if(!HAS_BUDGET() && (b = (Block *) malloc(size)) != NULL) {
+		b->prev = NULL;
+		b->next = NULL;
+	} else {
+		pthread_mutex_lock(&lru_lock);
+		while(tree_budget && tree_memory + size > tree_budget
+		&& evict_lru(parent))
+			;
+		while((b = (Block *) malloc(size)) == NULL && evict_lru(parent))
+			;
+		if(b != NULL) {
+			Block_push(b);
+			__atomic_add_fetch(&lru_blocks, 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&lru_lock);
+		if(b == NULL)
+			return NULL;
+	}
+	b->owner = parent;
+	b->size = size;
+	b->stage = NULL;
+	__atomic_add_fetch(&tree_memory, size, __ATOMIC_RELAXED);
+	return (BaoTree *) (b + 1);
+}
+
+
+/* Returns: Space for parent's children (aliases follow them) or NULL */
+static BaoTree *alloc_children(BaoTree *parent, unsigned int nchildren,
+		unsigned int naliases)
+{
+	return alloc_block(parent, sizeof(Block) + nchildren * sizeof(BaoTree)
+			+ naliases * sizeof(MoveAlias));
+}
+
+
+/* Bytes a staged block takes with nchildren children and naliases aliases */
+#define STAGED_SIZE(nchildren, naliases) (sizeof(Block) \
+		+ (nchildren) * sizeof(BaoTree) + (naliases) * sizeof(MoveAlias) \
+		+ sizeof(Stage))
+
+#define STAGE_CODE(move) ((move).hole << 1 | ((move).dir == MXD_RIGHT))
+
+
+/*****************************************************************************
+ * reserve_block: Makes a staged node's block at least need bytes big.
+ *
+ *		The block grows by doubling and may move. Pointers into it are
+ *		fixed up: node->children, the stage, the parent of each
+ *		grandchild and the owner of each child's block.
+ *
+ * Returns: 0 or -1 if out of memory.
+ *****************************************************************************/
+static int reserve_block(BaoTree *node, size_t need)
+{
+	Block *b = NODE_BLOCK(node), *grown;
+	BaoTree *child;
+	size_t size;
+	unsigned int i, j;
+	int listed;
+
+	if(need <= b->size)
+		return 0;
+	size = b->size * 2 > need ? b->size * 2 : need;
+	listed = b->prev != NULL;
+	if(listed || HAS_BUDGET()
+	|| (grown = (Block *) realloc(b, size)) == NULL) {
+		pthread_mutex_lock(&lru_lock);
+		while(tree_budget && tree_memory + size - b->size > tree_budget
+		&& evict_lru(node))
+			;
+		if(listed)
+			Block_unlink(b);
+		while((grown = (Block *) realloc(b, size)) == NULL
+		&& evict_lru(node))
+			;
+		if(grown == NULL) {
+			if(listed)
+				Block_push(b);
+			pthread_mutex_unlock(&lru_lock);
+			return -1;
+		}
+		if(listed)
+			Block_push(grown);
+		pthread_mutex_unlock(&lru_lock);
+	}
+	__atomic_add_fetch(&tree_memory, size - grown->size, __ATOMIC_RELAXED);
+	if(grown->stage != NULL) {
+		grown->stage = (Stage *) ((char *) grown + size - sizeof(Stage));
+		memmove(grown->stage, (char *) grown + grown->size - sizeof(Stage),
+				sizeof(Stage));
+	}
+	grown->size = size;
+	node->children = (BaoTree *) (grown + 1);
+	for(i = 0; i < node->nchildren; i++) {
+		child = &node->children[i];
+		if(child->children == NULL)
+			continue;
+		NODE_BLOCK(child)->owner = child;
+		for(j = 0; j < child->nchildren; j++)
+			child->children[j].parent = child;
+	}
+	return 0;
+}
+
+
+struct Expansion {
+	/* Scratch space for grow_tree */
+	BaoTree child[MAXTRANS];
+	uint64_t hash[MAXTRANS];		/* hash_state() of each child's state */
+	MoveAlias alias[MAXTRANS];
+	unsigned int nchildren;
+	unsigned int naliases;
+};
+
+
+typedef struct Expansion Expansion;
+
+
+/*****************************************************************************
+ * add_branch: Adds the position state reached after move to x.
+ *
+ *		If an earlier move in x already reached the same position, move is
+ *		only recorded as another way to get to that child (see MoveAlias).
+ *****************************************************************************/
+ENGINE_INLINE void add_branch(Expansion *x, const BaoState *state,
+		const Move *move, const BaoRules *rules, int nyumba_sown)
+{
+	BaoTree *child = &x->child[x->nchildren];
+	unsigned int i;
+	uint64_t hash;
+
+	child->state = *state;
+	update_node(child, move, rules, nyumba_sown);
+	hash = hash_state(&child->state);
+	for(i = 0; i < x->nchildren; i++) {
+		if(x->hash[i] == hash && cmp_state(&x->child[i].state,
+					&child->state) == 0) {
+			STATS_INC(transpositions);
+			x->alias[x->naliases].move = child->move;
+			x->alias[x->naliases].path = i;
+			x->naliases++;
+			return;
+		}
+	}
+	x->hash[x->nchildren++] = hash;
+}
+
+
+#define STAGE_MOVE(move, code) ((move)->hole = (code) >> 1, \
+		(move)->dir = (code) & 1 ? MXD_RIGHT : MXD_LEFT, \
+		(move)->nyumba_sown = 0)
+
+
+/*****************************************************************************
+ * add_staged: add_branch() for a staged parent.
+ *
+ *		The child goes straight into parent's block, aliases are moved up
+ *		to make room for it.
+ *
+ * Returns: 1 if a child was added, 0 if move was merged into an existing
+ *			one, -1 if out of memory.
+ *****************************************************************************/
+static int add_staged(BaoTree *parent, const BaoState *state,
+		const Move *move, const BaoRules *rules, int nyumba_sown)
+{
+	BaoTree child;
+	MoveAlias *alias;
+	unsigned int i;
+
+	child.state = *state;
+	update_node(&child, move, rules, nyumba_sown);
+	for(i = 0; i < parent->nchildren; i++) {
+		if(cmp_state(&parent->children[i].state, &child.state) != 0)
+			continue;
+		if(reserve_block(parent, STAGED_SIZE(parent->nchildren,
+						parent->naliases + 1)) == -1)
+			return -1;
+		STATS_INC(transpositions);
+		alias = NODE_ALIASES(parent) + parent->naliases++;
+		alias->move = child.move;
+		alias->path = i;
+		return 0;
+	}
+	if(reserve_block(parent, STAGED_SIZE(parent->nchildren + 1,
+					parent->naliases)) == -1)
+		return -1;
+	alias = NODE_ALIASES(parent);
+	memmove((char *) alias + sizeof(BaoTree), alias,
+			parent->naliases * sizeof(MoveAlias));
+	child.parent = parent;
+	child.children = NULL;
+	child.nchildren = 0;
+	child.naliases = 0;
+	child.best = NO_PATH;
+	child.score = 0;
+	parent->children[parent->nchildren++] = child;
+	return 1;
+}
+
+
+/*****************************************************************************
+ * grow_branch: Executes one of the moves a staged node has left.
+ *
+ *		The children move leads to are appended to parent's, a haulted
+ *		move's two being added in the order grow_tree() would add them.
+ *		Once the last move is executed the node is as grown as if by
+ *		grow_tree(), only with its children in the order they were
+ *		executed. parent's children block may move (see reserve_block).
+ *
+ * Returns: The number of children added (the last ones), 0 if move led
+ *			to none new or is not one parent has left, -1 on error (the
+ *			move is still left unless out of memory).
+ *****************************************************************************/
+ENGINE_INLINE int grow_branch_impl(BaoTree *parent, const BaoRules *rules,
+		const Move *move)
+{
+	BaoState work, haulted;
+	Stage *stage;
+	Hand hand;
+	Move m;
+	MoveExecSts exec_sts;
+	int i, n, added, was_haulted;
+
+	if(parent->children == NULL
+	|| (stage = NODE_BLOCK(parent)->stage) == NULL)
+		return 0;
+	for(i = 0; i < stage->nmoves; i++)
+		if(stage->moves[i] == STAGE_CODE(*move))
+			break;
+	if(i == stage->nmoves)
+		return 0;
+	STAGE_MOVE(&m, stage->moves[i]);
+	work = parent->state;
+	Hand_start(&hand, &work, rules, &m);
+	exec_sts = run_move_impl(&hand, rules);
+	was_haulted = exec_sts == MXS_HAULTED;
+	if(was_haulted) {
+		STATS_INC(moves_haulted);
+		haulted = work;
+		continue_move(&hand);
+		exec_sts = run_move_impl(&hand, rules);
+	}
+	if(exec_sts == MXS_ERROR)
+		return -1;
+	/* Executed, the stage may move as children get added */
+	stage->nmoves--;
+	memmove(stage->moves + i, stage->moves + i + 1, stage->nmoves - i);
+	if(stage->nmoves == 0)
+		NODE_BLOCK(parent)->stage = NULL;
+	added = 0;
+	if(was_haulted) {
+		if((n = add_staged(parent, &haulted, &m, rules, 1)) == -1)
+			return -1;
+		added += n;
+	}
+	if(exec_sts == MXS_PERPETUAL) {
+		STATS_INC(moves_perpetual);
+	} else {
+		if((n = add_staged(parent, &work, &m, rules, 0)) == -1)
+			return -1;
+		added += n;
+	}
+	return added;
+}
+
+
+/*****************************************************************************
+ *	grow_tree: Branch parent into the next possible states.
+ *
+ *		Function identifies possible (and acceptable) moves on parent's state
+ * 		(parent->state), which it uses to populate parent->children with the
+ * 		next possible sub trees (branches). Moves that end up in the same
+ *		state share one child, the extra moves are kept as MoveAliases right
+ *		after the children. Children and aliases are built on the stack and
+ *		then moved into a single block, so each expansion costs one
+ *		allocation.
+ *
+ *	Returns: Number of sub trees generated else a negative value  on error.
+ *****************************************************************************/
+ENGINE_INLINE int grow_tree_impl(BaoTree *parent, const BaoRules *rules)
+{
+	Move buf[MAXMOVES];		/* possible moves */
+	Expansion x;
+	BaoState work;
+	Hand hand;
+	int i, nmoves;
+	MoveExecSts exec_sts;
+
+	STATS_INC(grow_calls);
+	if(parent->children != NULL) {
+		touch_node(parent);
+		while(NODE_BLOCK(parent)->stage != NULL) {
+			/* Staged, execute what the search did not get to */
+			STAGE_MOVE(&buf[0], NODE_BLOCK(parent)->stage->moves[0]);
+			if(grow_branch_impl(parent, rules, &buf[0]) == -1)
+				return -1;
+		}
+		return parent->nchildren;
+	}
+	nmoves = get_moves_impl(buf, MAXMOVES, &parent->state, rules);
+	STATS_INC(expansions);
+	STATS_INC(get_moves_calls);
+	STATS_ADD(moves_generated, nmoves);
+	x.nchildren = 0;
+	x.naliases = 0;
+	for(i = 0; i < nmoves; i++) {
+		work = parent->state;
+		Hand_start(&hand, &work, rules, &buf[i]);
+		exec_sts = run_move_impl(&hand, rules);
+		if(exec_sts == MXS_HAULTED) {
+			STATS_INC(moves_haulted);
+			add_branch(&x, &work, &buf[i], rules, 1);
+			continue_move(&hand);
+			exec_sts = run_move_impl(&hand, rules);
+		}
+		if(exec_sts == MXS_ERROR)
+			return -1;
+		if(exec_sts == MXS_PERPETUAL)
+			STATS_INC(moves_perpetual);		/* Never ending move */
+		else
+			add_branch(&x, &work, &buf[i], rules, 0);
+	}
+	if(x.nchildren == 0)
+		return 0;
+	parent->children = alloc_children(parent, x.nchildren, x.naliases);
+	if(parent->children == NULL)
+		return -1;
+	for(i = 0; i < x.nchildren; i++) {
+		x.child[i].parent = parent;
+		x.child[i].children = NULL;
+		x.child[i].nchildren = 0;
+		x.child[i].naliases = 0;
+		x.child[i].best = NO_PATH;
+		x.child[i].score = 0;
+	}
+	parent->nchildren = x.nchildren;
+	parent->naliases = x.naliases;
+	memcpy(parent->children, x.child, x.nchildren * sizeof(BaoTree));
+	memcpy(NODE_ALIASES(parent), x.alias, x.naliases * sizeof(MoveAlias));
+	return parent->nchildren;
+}
+
+
+/*****************************************************************************
+ * 								ENGINES										 *
+ *****************************************************************************
+ *	The *_impl functions above are always inlined. Each rule set listed in
+ *	rules.def gets its own copy of them with the rules pointer bound to a
+ *	compile time constant, so every test on the rules gets folded away.
+ *	Anything else runs on the generic copy, which reads the rules at run
+ *	time.
+ *****************************************************************************/
+#define UNPAREN(...) __VA_ARGS__
+
+#define BAO_RULESET(name, board, ...) \
+static const BaoRules engine_rules_##name = {{UNPAREN board}, __VA_ARGS__}; \
+\
+static int get_moves_##name(Move *buf, int bufsz, BaoState *state, \
+		const BaoRules *rules) \
+{ \
+	return get_moves_impl(buf, bufsz, state, &engine_rules_##name); \
+} \
+\
+static int grow_tree_##name(BaoTree *parent, const BaoRules *rules) \
+{ \
+	return grow_tree_impl(parent, &engine_rules_##name); \
+} \
+\
+static int grow_branch_##name(BaoTree *parent, const BaoRules *rules, \
+		const Move *move) \
+{ \
+	return grow_branch_impl(parent, &engine_rules_##name, move); \
+} \
+\
+static Hand *start_move_##name(BaoState *state, const BaoRules *rules, \
+		const Move *move) \
+{ \
+	return start_move_impl(state, &engine_rules_##name, move); \
+} \
+\
+static int exec_move_##name(Hand *hand, const BaoRules *rules, int steps) \
+{ \
+	return exec_move_impl(hand, &engine_rules_##name, steps); \
+} \
+\
+static int run_move_##name(Hand *hand, const BaoRules *rules) \
+{ \
+	return run_move_impl(hand, &engine_rules_##name); \
+}
+#include "rules.def"
+#undef BAO_RULESET
+
+
+static int get_moves_generic(Move *buf, int bufsz, BaoState *state,
+		const BaoRules *rules)
+{
+	return get_moves_impl(buf, bufsz, state, rules);
+}
+
+
+static int grow_tree_generic(BaoTree *parent, const BaoRules *rules)
+{
+	return grow_tree_impl(parent, rules);
+}
+
+
+static int grow_branch_generic(BaoTree *parent, const BaoRules *rules,
+		const Move *move)
+{
+	return grow_branch_impl(parent, rules, move);
+}
+
+
+static Hand *start_move_generic(BaoState *state, const BaoRules *rules,
+		const Move *move)
+{
+	return start_move_impl(state, rules, move);
+}
+
+
+static int exec_move_generic(Hand *hand, const BaoRules *rules, int steps)
+{
+	return exec_move_impl(hand, rules, steps);
+}
+
+
+static int run_move_generic(Hand *hand, const BaoRules *rules)
+{
+	return run_move_impl(hand, rules);
+}
+
+
+static const BaoEngine engines[] = {
+#define BAO_RULESET(name, ...) \
+	{#name, &engine_rules_##name, get_moves_##name, grow_tree_##name, \
+	 grow_branch_##name, start_move_##name, exec_move_##name, \
+	 run_move_##name},
+#include "rules.def"
+#undef BAO_RULESET
+	{"generic", NULL, get_moves_generic, grow_tree_generic,
+	 grow_branch_generic, start_move_generic, exec_move_generic,
+	 run_move_generic}
+};
+
+
+enum {
+	NENGINES = sizeof(engines) / sizeof(engines[0])
+};
+
+
+static __thread BaoRules last_rules;
+/* Copy of the rules last_engine was picked for, a caller may change its
+ * own in place */
+
+static __thread const BaoEngine *last_engine;
+
+
+/*****************************************************************************
+ *								PUBLIC DATA									 *
+ *****************************************************************************/
+
+
+
+
+BaoTree *new_tree(const BaoRules *rules)
+{
+	BaoTree *top;
+	Hole h;
+
+	if((top = (BaoTree *) malloc(sizeof(BaoTree))) == NULL)
+		return NULL;
+
+	top->move.hole = H_STORE;
+	top->move.dir = 0;
+	top->move.nyumba_sown = 0;
+
+	for(h =H_LFKICHWA; h <= H_STORE; h++) {
+		top->state.board[P_NORTH][h] = rules->board_setting[h];
+		top->state.board[P_SOUTH][h] = rules->board_setting[h];
+	}
+	top->state.nyumba[P_NORTH] = rules->has_nyumba;
+	top->state.nyumba[P_SOUTH] = rules->has_nyumba;
+	top->state.flags = 0;
+	top->state.takata = 0;
+	top->state.trapped_hole = H_STORE;
+	top->state.player = P_SOUTH;
+
+	top->parent = NULL;
+	top->children = NULL;
+	top->nchildren = 0;
+	top->naliases = 0;
+	top->best = NO_PATH;
+	top->score = 0;
+
+	return top;
+}
+
+
+/*****************************************************************************
+ * hash_state: 64 bit FNV-1a hash of everything that sets state's future.
+ *****************************************************************************/
+uint64_t hash_state(const BaoState *state)
+{
+	const unsigned char *p = &state->board[0][0];
+	uint64_t h = 14695981039346656037ULL;
+	int i;
+
+	for(i = 0; i < NPLAYERS * NHOLES; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	h = (h ^ (state->nyumba[P_NORTH] != 0)) * 1099511628211ULL;
+	h = (h ^ (state->nyumba[P_SOUTH] != 0)) * 1099511628211ULL;
+	h = (h ^ (state->takata != 0)) * 1099511628211ULL;
+	h = (h ^ (unsigned char) state->trapped_hole) * 1099511628211ULL;
+	h = (h ^ state->player) * 1099511628211ULL;
+	return h;
+}
+
+
+/* Returns: 0 if a and b are the same position else non-zero */
+int cmp_state(const BaoState *a, const BaoState *b)
+{
+	return memcmp(a->board, b->board, sizeof(a->board))
+		|| (a->nyumba[P_NORTH] != 0) != (b->nyumba[P_NORTH] != 0)
+		|| (a->nyumba[P_SOUTH] != 0) != (b->nyumba[P_SOUTH] != 0)
+		|| (a->takata != 0) != (b->takata != 0)
+		|| a->trapped_hole != b->trapped_hole
+		|| a->player != b->player;
+}
+
+
+/*****************************************************************************
+ * pack_state: Writes state out as PACKED_STATE_SIZE bytes.
+ *
+ *		Layout: the board (north then south, a1 to the store), a flags byte
+ *		(bit 0 north nyumba, 1 south nyumba, 2 takata, 3 player) and the
+ *		trapped hole, 0xFF for none. Nothing depends on the host's byte
+ *		order or struct padding.
+ *****************************************************************************/
+void pack_state(unsigned char *buf, const BaoState *state)
+{
+	memcpy(buf, state->board, NPLAYERS * NHOLES);
+	buf += NPLAYERS * NHOLES;
+	buf[0] = (state->nyumba[P_NORTH] != 0) | (state->nyumba[P_SOUTH] != 0) << 1
+		| (state->takata != 0) << 2 | (state->player == P_SOUTH) << 3;
+	buf[1] = state->trapped_hole <= H_STORE ? state->trapped_hole : 0xFF;
+}
+
+
+void unpack_state(BaoState *state, const unsigned char *buf)
+{
+	memcpy(state->board, buf, NPLAYERS * NHOLES);
+	buf += NPLAYERS * NHOLES;
+	state->flags = 0;
+	state->nyumba[P_NORTH] = buf[0] & 1;
+	state->nyumba[P_SOUTH] = (buf[0] >> 1) & 1;
+	state->takata = (buf[0] >> 2) & 1;
+	state->player = buf[0] & 8 ? P_SOUTH : P_NORTH;
+	state->trapped_hole = buf[1] == 0xFF ? (Hole) -1 : (Hole) buf[1];
+}
+
+
+/* Maps a hole to its mirror image, holes off the sowing track stay put */
+static Hole mirror_hole(Hole h)
+{
+	if(h <= H_RFKICHWA)
+		return H_RFKICHWA - h;
+	if(h <= H_LBKICHWA)
+		return H_RBKICHWA + H_LBKICHWA - h;
+	return h;
+}
+
+
+/*****************************************************************************
+ * mirror_state: Reflects state left to right.
+ *
+ *		Every hole h on either side swaps with its mirror (a1 <-> a8,
+ *		b1 <-> b8 etc.), the store and the nyumba flags are left alone.
+ *		Play on the mirror is the mirror image of play on state only when
+ *		canon_state() says so.
+ *****************************************************************************/
+void mirror_state(BaoState *mirror, const BaoState *state)
+{
+	Hole h;
+
+	*mirror = *state;
+	for(h = H_LFKICHWA; h <= H_LBKICHWA; h++) {
+		mirror->board[P_NORTH][mirror_hole(h)] = state->board[P_NORTH][h];
+		mirror->board[P_SOUTH][mirror_hole(h)] = state->board[P_SOUTH][h];
+	}
+	mirror->trapped_hole = mirror_hole(state->trapped_hole);
+}
+
+
+/*****************************************************************************
+ * canon_state: Picks the representative of state and its mirror image.
+ *
+ *		With both stores empty and no nyumba left the rules treat both
+ *		halves of the board alike, so a position and its mirror have the
+ *		same value and mirrored moves (see mirror_move). Of the two, the one
+ *		with the smaller board (memcmp order) is the representative. Any
+ *		other position is its own representative.
+ *
+ *		takata is cleared in canon, get_moves() works it out again.
+ *
+ * Returns: 1 if canon is the mirror of state else 0
+ *****************************************************************************/
+int canon_state(BaoState *canon, const BaoState *state)
+{
+	BaoState mirror;
+	int cmp;
+
+	*canon = *state;
+	canon->takata = 0;
+	if(state->board[P_NORTH][H_STORE] || state->board[P_SOUTH][H_STORE]
+	|| state->nyumba[P_NORTH] || state->nyumba[P_SOUTH])
+		return 0;
+	mirror_state(&mirror, canon);
+	cmp = memcmp(mirror.board, canon->board, sizeof(canon->board));
+	if(cmp > 0 || (cmp == 0 && mirror.trapped_hole >= canon->trapped_hole))
+		return 0;
+	*canon = mirror;
+	return 1;
+}
+
+
+/* Returns: hash_state() of state's representative, see canon_state */
+uint64_t canon_hash(const BaoState *state, int *mirrored)
+{
+	BaoState canon;
+	int m;
+
+	m = canon_state(&canon, state);
+	if(mirrored != NULL)
+		*mirrored = m;
+	return hash_state(&canon);
+}
+
+
+/* Turns a move on some state into the same move on its mirror, and back */
+void mirror_move(Move *move)
+{
+	move->hole = mirror_hole(move->hole);
+	move->dir = -move->dir;
+}
+
+
+/* NOTE: Only for roots (from new_tree), other nodes live in their parent's
+ * children block, see prune_tree */
+void free_tree(BaoTree *top)
+{
+	prune_tree(top);
+	free(top);
+}
+
+
+/* Frees node's branches but keeps node itself */
+void prune_tree(BaoTree *node)
+{
+	if(node->children == NULL)
+		return;
+	if(__atomic_load_n(&lru_blocks, __ATOMIC_RELAXED) == 0) {
+		prune_locked(node);		/* None of node's blocks is listed */
+		return;
+	}
+	pthread_mutex_lock(&lru_lock);
+	prune_locked(node);
+	pthread_mutex_unlock(&lru_lock);
+}
+
+
+#define CMP_MOVE(m, n) \
+	(((m).hole == (n).hole) && ((m).dir == (n).dir) \
+	 && ((m).nyumba_sown == (n).nyumba_sown))
+
+/*****************************************************************************
+ * find_branch: Finds the branch move on node leads to
+ *
+ * 		Functions searchs node->children and to match them to move
+ * 		(see BaoTree.move) and then the moves that were merged into some
+ *		other child (see MoveAlias), if a possible match is found, it's
+ *		path/index is returned else -1 is returned.
+ *
+ * Returns:	Returns path/index of matching child else -1.
+ ****************************************************************************/
+int find_branch(BaoTree *node, const Move *move)
+{
+	const MoveAlias *alias = NODE_ALIASES(node);
+	int i;
+
+	for(i = 0; i < node->nchildren; i++)
+		if(CMP_MOVE(node->children[i].move, *move))
+			return i;
+	for(i = 0; i < node->naliases; i++)
+		if(CMP_MOVE(alias[i].move, *move))
+			return alias[i].path;
+	return -1;
+}
+
+
+/*****************************************************************************
+ * branch_moves: Lists every move from node that leads to child path.
+ *
+ * Returns: Number of moves put in buf (at most bufsz)
+ *****************************************************************************/
+int branch_moves(const BaoTree *node, unsigned int path, Move *buf,
+		int bufsz)
+{
+	const MoveAlias *alias = NODE_ALIASES(node);
+	int i, n;
+
+	if(path >= node->nchildren || bufsz < 1)
+		return 0;
+	buf[0] = node->children[path].move;
+	n = 1;
+	for(i = 0; i < node->naliases && n < bufsz; i++)
+		if(alias[i].path == path)
+			buf[n++] = alias[i].move;
+	return n;
+}
+
+int shift_tree(BaoTree **node_p, unsigned int path)
+{
+	if(path >= (*node_p)->nchildren)
+		return -1;
+	touch_node(*node_p);
+	*node_p = &(*node_p)->children[path];
+	return 0;
+}
+
+
+int unshift_tree(BaoTree **node_p)
+{
+	if((*node_p)->parent == NULL)
+		return -1;
+	*node_p = (*node_p)->parent;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * get_engine: Picks the move generator/executor specialised for rules.
+ *
+ *		Rules are matched by value so a copy of one of the rule sets in
+ *		rules.def still gets its specialised engine. Passing NULL asks for
+ *		the generic engine.
+ *
+ * Returns: The matching engine, else the generic one (never NULL).
+ *****************************************************************************/
+const BaoEngine *get_engine(const BaoRules *rules)
+{
+	int i;
+
+	if(rules == NULL)
+		return &engines[NENGINES - 1];
+	if(last_engine != NULL
+	&& memcmp(&last_rules, rules, sizeof(BaoRules)) == 0)
+		return last_engine;
+	for(i = 0; i < NENGINES - 1; i++)
+		if(memcmp(engines[i].rules, rules, sizeof(BaoRules)) == 0)
+			break;
+	memcpy(&last_rules, rules, sizeof(BaoRules));
+	last_engine = &engines[i];
+	return last_engine;
+}
+
+
+/*****************************************************************************
+ * get_moves: Fill buf with up to n possible moves if available.
+ *
+ *		Function probes for moves acceptable to state. It determines the type
+ *		of possible moves (takata or capture) and sets the takata flag if
+ *		the moves found are takata else unsets it if only mtaji moves or
+ *		no moves(imples gameOver) are found.
+ *
+ * Returns: Number of moves found
+ ****************************************************************************/
+int get_moves(Move *buf, int bufsz, BaoState *state, const BaoRules *rules)
+{
+	return get_engine(rules)->get_moves(buf, bufsz, state, rules);
+}
+
+
+/*****************************************************************************
+ *	grow_tree: Branch parent into the next possible states.
+ *
+ *		Fills parent->children with one child per state parent's moves
+ *		lead to, never ending moves left out. A grown node is left as it
+ *		is, a staged one (see stage_tree) gets the moves it has left
+ *		executed.
+ *
+ *	Returns: Number of children, -1 on error.
+ *****************************************************************************/
+int grow_tree(BaoTree *parent, const BaoRules *rules)
+{
+	return get_engine(rules)->grow_tree(parent, rules);
+}
+
+
+/*****************************************************************************
+ * stage_tree: Lists node's moves without executing any of them.
+ *
+ *		A cheaper alternative to grow_tree() for searches that may not get
+ *		to every child: the moves are only executed one by one with
+ *		grow_branch(), and no space is taken for children not executed.
+ *		While moves are left node->nchildren (and so find_branch() and
+ *		branch_moves()) only cover the children executed so far. Calling
+ *		grow_tree() on a staged node executes the moves left.
+ *
+ * Returns: Number of moves left to execute, put in buf (MAXMOVES long), 0
+ *			if node has no moves or none left, -1 if out of memory.
+ *****************************************************************************/
+int stage_tree(BaoTree *node, const BaoRules *rules, Move *buf)
+{
+	Stage *stage;
+	Block *b;
+	size_t size;
+	int i, nmoves;
+
+	if(node->children != NULL) {
+		touch_node(node);
+		if((stage = NODE_BLOCK(node)->stage) == NULL)
+			return 0;
+		for(i = 0; i < stage->nmoves; i++)
+			STAGE_MOVE(&buf[i], stage->moves[i]);
+		return stage->nmoves;
+	}
+	nmoves = get_engine(rules)->get_moves(buf, MAXMOVES, &node->state,
+			rules);
+	STATS_INC(get_moves_calls);
+	STATS_ADD(moves_generated, nmoves);
+	if(nmoves == 0)
+		return 0;
+	STATS_INC(stages);
+	/* Room for a couple of children to begin with */
+	size = STAGED_SIZE(2, 0);
+	if((node->children = alloc_block(node, size)) == NULL)
+		return -1;
+	b = NODE_BLOCK(node);
+	b->stage = stage = (Stage *) ((char *) b + size - sizeof(Stage));
+	stage->nmoves = nmoves;
+	for(i = 0; i < nmoves; i++)
+		stage->moves[i] = STAGE_CODE(buf[i]);
+	node->nchildren = 0;
+	node->naliases = 0;
+	return nmoves;
+}
+
+
+int grow_branch(BaoTree *node, const BaoRules *rules, const Move *move)
+{
+	return get_engine(rules)->grow_branch(node, rules, move);
+}
+
+
+/* Returns: Moves a staged node has left to execute, 0 for any other node */
+int staged_moves(const BaoTree *node)
+{
+	const Stage *stage;
+
+	if(node->children == NULL || (stage = NODE_BLOCK(node)->stage) == NULL)
+		return 0;
+	return stage->nmoves;
+}
+
+
+/*****************************************************************************
+ * attach_children: Gives an unexpanded node a block of children to fill in.
+ *
+ *		For callers rebuilding a tree they saved (see snapshot.c). The
+ *		children get node as parent and no children, the rest of each
+ *		child and the naliases aliases (NODE_ALIASES) are left to the
+ *		caller. The block counts against the tree budget as any other.
+ *
+ * Returns: 0 or -1 if out of memory (errno set) or node already has
+ *			children (EINVAL).
+ *****************************************************************************/
+int attach_children(BaoTree *node, unsigned int nchildren,
+		unsigned int naliases)
+{
+	unsigned int i;
+
+	if(node->children != NULL || nchildren == 0 || nchildren > MAXTRANS
+	|| naliases > MAXTRANS) {
+		errno = EINVAL;
+		return -1;
+	}
+	if((node->children = alloc_children(node, nchildren, naliases)) == NULL)
+		return -1;
+	for(i = 0; i < nchildren; i++) {
+		node->children[i].parent = node;
+		node->children[i].children = NULL;
+		node->children[i].nchildren = 0;
+		node->children[i].naliases = 0;
+	}
+	node->nchildren = nchildren;
+	node->naliases = naliases;
+	return 0;
+}
+
+
+Hand *start_move(BaoState *state, const BaoRules *rules, const Move *move)
+{
+	return get_engine(rules)->start_move(state, rules, move);
+}
+
+
+/*****************************************************************************
+ * init_move: start_move() into a hand the caller provides.
+ *
+ *		For callers that execute many moves and would rather not allocate a
+ *		hand for each (see playout.c). There is nothing to end_move().
+ *****************************************************************************/
+void init_move(Hand *hand, BaoState *state, const BaoRules *rules,
+		const Move *move)
+{
+	Hand_start(hand, state, rules, move);
+}
+
+
+/*****************************************************************************
+ * next_turn: Hands state over to the other player once a move is done.
+ *
+ *		What grow_tree() does to the state a move (run to MXS_DONE or
+ *		MXS_HAULTED) leaves behind before it becomes a child's.
+ *****************************************************************************/
+void next_turn(BaoState *state, const BaoRules *rules)
+{
+	prep_state(state, rules);
+}
+
+
+int exec_move(Hand *hand, const BaoRules *rules, int steps)
+{
+	return get_engine(rules)->exec_move(hand, rules, steps);
+}
+
+
+int run_move(Hand *hand, const BaoRules *rules)
+{
+	return get_engine(rules)->run_move(hand, rules);
+}
+
+
+/*****************************************************************************
+ * set_cancel_flag: Lets the calling thread give up on long moves.
+ *
+ *		Once *flag is non-zero, run_move() (and so grow_tree()) on this
+ *		thread fails with errno set to ECANCELED. NULL turns this off.
+ *****************************************************************************/
+void set_cancel_flag(const int *flag)
+{
+	cancel_flag = flag;
+}
+
+
+/*****************************************************************************
+ * set_tree_budget: Caps the memory all children blocks may take together.
+ *
+ *		Once it is reached grow_tree() frees the subtrees visited (grown or
+ *		shifted into) least recently to make room, see evict_lru. A node
+ *		outside the path to the node being grown may so lose its children,
+ *		and with them any pointer into them. Only subtrees grown while the
+ *		budget is set get evicted. 0, the default, means no cap.
+ *
+ *		Eviction knows nothing of other threads: with a budget set only
+ *		one thread at a time may use trees. Code that works on trees from
+ *		several threads at once brackets that with tree_share_begin() and
+ *		tree_share_end(), and the two exclude each other.
+ *
+ * Returns: 0, or -1 (errno EBUSY) if bytes is not 0 and trees are shared.
+ *****************************************************************************/
+int set_tree_budget(size_t bytes)
+{
+	pthread_mutex_lock(&lru_lock);
+	if(bytes && tree_sharers) {
+		pthread_mutex_unlock(&lru_lock);
+		errno = EBUSY;
+		return -1;
+	}
+	__atomic_store_n(&tree_budget, bytes, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&lru_lock);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * tree_share_begin: Announces trees used from several threads at once.
+ *
+ *		Calls nest, each to be matched by a tree_share_end().
+ *
+ * Returns: 0, or -1 (errno EBUSY) if a tree budget is set.
+ *****************************************************************************/
+int tree_share_begin(void)
+{
+	pthread_mutex_lock(&lru_lock);
+	if(tree_budget) {
+		pthread_mutex_unlock(&lru_lock);
+		errno = EBUSY;
+		return -1;
+	}
+	tree_sharers++;
+	pthread_mutex_unlock(&lru_lock);
+	return 0;
+}
+
+
+void tree_share_end(void)
+{
+	pthread_mutex_lock(&lru_lock);
+	tree_sharers--;
+	pthread_mutex_unlock(&lru_lock);
+}
+
+
+/* Returns: Bytes taken by all children blocks */
+size_t get_tree_memory(void)
+{
+	return __atomic_load_n(&tree_memory, __ATOMIC_RELAXED);
+}
+
+
 void continue_move(Hand *hand)
 {
 	hand->state->nyumba[hand->side] = 0;
@@ -1,11 +1,17 @@
 #ifndef BAOTREE_H
 #define BAOTREE_H
 
+#include <stddef.h>
+#include <stdint.h>
 
 enum {
 	NPLAYERS = 2,	/* Number of player's per game */
 	NHOLES   = 17,	/* Number of holes owned by each player */
-	MAXTRANS = 20	/* Max. # of transitions allowed per BaoState */
+	MAXMOVES = 32,	/* Max. # of moves per BaoState (16 holes x 2 dirs) */
+	MAXTRANS = 64,	/* Max. # of transitions per BaoState, a haulted move
+					 * gives two */
+	PACKED_STATE_SIZE = 36,	/* Bytes pack_state() writes */
+	NO_PATH = 0xFF	/* BaoTree.best of a node with no search result */
 };
 
 
@@ -81,7 +87,10 @@ enum MoveExecSts{
 	/* Hault's on first attempt to lift nyumba in a capture move */
 	MXS_DONE,
 	/* DONE EXECUTING THE MOVE! */
-	MXS_NOTDONE
+	MXS_NOTDONE,
+	/* Ran out of steps before the move ended */
+	MXS_PERPETUAL
+	/* The move never ends, see run_move */
 };
 
 
@@ -97,7 +106,7 @@ typedef enum Player Player;
 
 
 struct BaoState {
-	unsigned int board[NPLAYERS][NHOLES];
+	unsigned char board[NPLAYERS][NHOLES];	/* 64 nkhomo all told */
 	unsigned char flags;
 	int takata;
 	int nyumba[NPLAYERS];
@@ -127,13 +136,47 @@ struct BaoTree {
 
 	struct BaoTree *parent;
 
-	struct BaoTree *children[MAXTRANS];
+	struct BaoTree *children;
+	/* Block of nchildren nodes allocated in one go by grow_tree, NULL if
+	 * the node has not been expanded (or has no moves). A node staged by
+	 * stage_tree has a block as soon as it is staged, children are added
+	 * to it as their moves get executed (see grow_branch). */
+
+	uint32_t nchildren;
+
+	uint8_t naliases;
+	/* Number of MoveAliases stored right after the children block. */
+
+	uint8_t best;
+	int16_t score;
+	/* Path of the best child and the node's score for its side to move,
+	 * as found by the last search through it, NO_PATH and 0 if none has.
+	 * Both survive when the node's subtree gets evicted (see
+	 * set_tree_budget), the path still holds once the node is grown
+	 * again (unless it was staged, which orders children as they are
+	 * visited). */
+};
+
+
+
+
+struct MoveAlias {
+	/* A move that leads to the same state as some other move from the same
+	 * node. grow_tree keeps a single child for such moves. */
 
-	unsigned int nchildren;
+	struct Move move;
+
+	uint32_t path;
+	/* Index of the child move leads to */
 };
 
 
 
+#define NODE_ALIASES(node) \
+	((struct MoveAlias *) ((node)->children + (node)->nchildren))
+
+
+
 
 struct BaoRules {
 	/*  This defines a sub set of the bao rules that define the differences
@@ -159,10 +202,6 @@ struct BaoRules {
 	/* This is the minimum number of nkhomo that must be on nyumba to perform
 	 * the special nyumba takata (sow one on nyumba, lift two from nyumba then
 	 * takata) in namua stage. */
-
-	int max_move_exec_depth;
-	/* This is the maximum number of steps allowed in a move. Any move that
-	 * exceeds this is assumed to be a perpertual move hence deemed illegal. */
 };
 
 
@@ -194,6 +233,35 @@ struct Hand {
 
 
 
+struct BaoEngine {
+	/* Move generator and executor for one rule set. See get_engine. */
+
+	const char *name;
+
+	const struct BaoRules *rules;
+	/* Rule set the functions below are specialised for, NULL for the
+	 * generic engine that reads the rules passed to it at run time. */
+
+	int (*get_moves)(struct Move *, int, struct BaoState *,
+			const struct BaoRules *);
+
+	int (*grow_tree)(struct BaoTree *, const struct BaoRules *);
+
+	int (*grow_branch)(struct BaoTree *, const struct BaoRules *,
+			const struct Move *);
+
+	struct Hand *(*start_move)(struct BaoState *, const struct BaoRules *,
+			const struct Move *);
+
+	int (*exec_move)(struct Hand *, const struct BaoRules *, int);
+
+	int (*run_move)(struct Hand *, const struct BaoRules *);
+};
+
+
+
+typedef struct BaoEngine BaoEngine;
+
 typedef struct BaoRules BaoRules;
 
 typedef struct BaoState BaoState;
@@ -204,6 +272,35 @@ typedef struct Hand Hand;
 
 typedef struct Move Move;
 
+typedef struct MoveAlias MoveAlias;
+
+
+
+const BaoEngine *get_engine(const BaoRules *rules);
+
+
+uint64_t hash_state(const BaoState *state);
+
+
+int cmp_state(const BaoState *a, const BaoState *b);
+
+
+void pack_state(unsigned char *buf, const BaoState *state);
+
+
+void unpack_state(BaoState *state, const unsigned char *buf);
+
+
+void mirror_state(BaoState *mirror, const BaoState *state);
+
+
+int canon_state(BaoState *canon, const BaoState *state);
+
+
+uint64_t canon_hash(const BaoState *state, int *mirrored);
+
+
+void mirror_move(Move *move);
 
 
 BaoTree *new_tree(const BaoRules *rules);
@@ -212,12 +309,35 @@ BaoTree *new_tree(const BaoRules *rules);
 void free_tree(BaoTree *tree);
 
 
+void prune_tree(BaoTree *node);
+
+
+int get_moves(Move *buf, int bufsz, BaoState *state, const BaoRules *rules);
+
+
 int grow_tree(BaoTree *node, const BaoRules *rules);
 
 
+int stage_tree(BaoTree *node, const BaoRules *rules, Move *buf);
+
+
+int grow_branch(BaoTree *node, const BaoRules *rules, const Move *move);
+
+
+int staged_moves(const BaoTree *node);
+
+
+int attach_children(BaoTree *node, unsigned int nchildren,
+		unsigned int naliases);
+
+
 int find_branch(BaoTree *node, const Move *move);
 
 
+int branch_moves(const BaoTree *node, unsigned int path, Move *buf,
+		int bufsz);
+
+
 int shift_tree(BaoTree **node_p, unsigned int path);
 
 
@@ -227,9 +347,34 @@ int unshift_tree(BaoTree **node_p);
 Hand *start_move(BaoState *state, const BaoRules *rules, const Move *move);
 
 
+void init_move(Hand *hand, BaoState *state, const BaoRules *rules,
+		const Move *move);
+
+
 int exec_move(Hand *hand, const BaoRules *rules, int steps);
 
 
+void next_turn(BaoState *state, const BaoRules *rules);
+
+
+int run_move(Hand *hand, const BaoRules *rules);
+
+
+void set_cancel_flag(const int *flag);
+
+
+int set_tree_budget(size_t bytes);
+
+
+int tree_share_begin(void);
+
+
+void tree_share_end(void);
+
+
+size_t get_tree_memory(void);
+
+
 void continue_move(Hand *hand);
 
 
@@ -0,0 +1,570 @@
+/******************************************************************************
+ *	treeTest.c: Lazy against eager tree growth, batched against single
+ *		playouts
+ *
+ *		Plays pseudo-random games from a fixed seed per rules[] variant
+ *		and checks every position on them:
+ *			- staging the node (stage_tree), executing its moves one by
+ *			  one in reverse order (grow_branch) and then the rest
+ *			  (grow_tree) gives the same children, with the same moves,
+ *			  as grow_tree() on its own,
+ *			- the moves of its children are the moves get_moves() finds,
+ *			  each run with run_move(), less those that never end (and
+ *			  the same holds for a position with such a move, kept below
+ *			  as random games seldom reach one),
+ *			- where the rules treat both halves of the board alike, the
+ *			  position and its mirror image have one key, every move
+ *			  mirrored leads to the mirror of its child and a move kept
+ *			  in the transposition table comes back mirrored,
+ *			- at one ply of each game, a searched tree saved with
+ *			  snapshot_save() comes back from snapshot_load() node for
+ *			  node, with the transposition and history tables it was
+ *			  saved with,
+ *			- every move recorded with replay_children() and played back
+ *			  to its last step (replay_seek) leaves the child's state,
+ *			  and played back to step 0 the state it started from,
+ *			- in the last plies of each game that ends, solve() proves
+ *			  every win or loss a plain search of a few plies finds.
+ *			- every few plies, search_score() gives the same score with
+ *			  lazy staging on and off, with and without keeping the tree
+ *			  and with the tree kept under a budget small enough to evict,
+ *			- at the same plies of the first few games, playouts() gives
+ *			  what playout() gives game for game, as playout.c is a
+ *			  second copy of the rules.
+ *
+ *		LMR and the transposition table are off for the searches: the
+ *		first depends on the order children are found in, the second on
+ *		what earlier searches left in it.
+ *
+ *		Exits with EXIT_FAILURE after listing the mismatches, if any, or
+ *		if the budget never made a search evict (with statistics on).
+ *****************************************************************************/
+
+#include "eval.h"
+#include "error.h"
+#include "playout.h"
+#include "replay.h"
+#include "rules.h"
+#include "snapshot.h"
+#include "solve.h"
+#include "stats.h"
+#include "tree.h"
+#include "tt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+enum {
+	GAMES        = 8,		/* Games played per variant */
+	MAX_PLIES    = 120,		/* Plies played per game */
+	SEARCH_EVERY = 10,		/* Plies between search checks */
+	SEARCH_DEPTH = 4,
+	BUDGET       = 64 << 10,	/* Tree budget of the evicting searches */
+	SNAPSHOT_PLY = 20,		/* Ply check_snapshot() is run at */
+	SOLVE_PLIES  = 6,		/* Last plies of a game check_solve() is run on */
+	SOLVE_DEPTH  = 4,		/* Plies proven_outcome() looks ahead */
+	TT_BYTES     = TT_SLOT_SIZE << TT_BITS,
+	PLAYOUT_GAMES = 4,		/* Games with playout checks, see main() */
+	PLAYOUTS     = PLAYOUT_LANES + 3,	/* Last batch left short */
+	PLAYOUT_PLIES = 100		/* Plies a playout may last */
+};
+
+
+/* Positions random games reached with a move that never ends, one per
+ * rules[] variant */
+static const BaoState perpetual_states[NRULES] = {
+	{{{1, 0, 1, 0, 0, 2, 1, 0, 1, 1, 6, 0, 1, 3, 0, 6, 0},
+	  {0, 3, 0, 1, 2, 0, 10, 1, 4, 1, 8, 1, 0, 1, 2, 3, 0}},
+	 0, 0, {0, 0}, (Hole) -1, P_SOUTH},
+	{{{0, 1, 0, 1, 0, 3, 4, 0, 5, 7, 2, 3, 4, 1, 0, 1, 0},
+	  {0, 1, 0, 1, 0, 3, 0, 1, 0, 0, 2, 12, 6, 2, 3, 1, 0}},
+	 0, 0, {0, 0}, (Hole) -1, P_NORTH},
+	{{{0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 1, 1, 5, 2, 0, 0, 0},
+	  {0, 4, 0, 2, 3, 0, 8, 3, 1, 7, 6, 5, 1, 5, 4, 3, 0}},
+	 0, 0, {0, 0}, (Hole) -1, P_SOUTH}
+};
+
+
+static int failures;
+static int nperpetual;		/* Moves that never end seen by check_moves() */
+static int nmirrored;		/* Positions check_mirror() could mirror */
+static int nproven;			/* Positions proven_outcome() decided */
+
+
+static void fail(const char *variant, int ply, const char *what)
+{
+	printf("FAIL %s ply %d: %s\n", variant, ply, what);
+	failures++;
+}
+
+
+static int cmp_moves(const void *a, const void *b)
+{
+	const Move *x = a, *y = b;
+
+	if(x->hole != y->hole)
+		return x->hole - y->hole;
+	if(x->dir != y->dir)
+		return x->dir - y->dir;
+	return x->nyumba_sown - y->nyumba_sown;
+}
+
+
+/* Moves to child path of node, sorted. Returns: how many */
+static int sorted_moves(const BaoTree *node, unsigned int path, Move *buf)
+{
+	int n = branch_moves(node, path, buf, MAXMOVES);
+
+	qsort(buf, n, sizeof(Move), cmp_moves);
+	return n;
+}
+
+
+/* Whether both nodes have the same children, in any order */
+static int same_children(const BaoTree *a, const BaoTree *b)
+{
+	Move ma[MAXMOVES], mb[MAXMOVES];
+	unsigned int i, j;
+	int na, nb;
+
+	if(a->nchildren != b->nchildren || a->naliases != b->naliases)
+		return 0;
+	for(i = 0; i < a->nchildren; i++) {
+		for(j = 0; j < b->nchildren; j++)
+			if(cmp_state(&a->children[i].state, &b->children[j].state) == 0)
+				break;
+		if(j == b->nchildren)
+			return 0;
+		na = sorted_moves(a, i, ma);
+		nb = sorted_moves(b, j, mb);
+		if(na != nb || memcmp(ma, mb, na * sizeof(Move)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+
+static void check_growth(const char *variant, int ply, const BaoState *state,
+		const BaoRules *r)
+{
+	BaoTree eager, lazy;
+	Move buf[MAXMOVES];
+	int i, n;
+
+	memset(&eager, 0, sizeof(eager));
+	eager.state = *state;
+	eager.best = NO_PATH;
+	lazy = eager;
+	if(grow_tree(&eager, r) == -1 || (n = stage_tree(&lazy, r, buf)) == -1)
+		choke("Could not grow the tree");
+	/* Half of them one by one, last first, so children move around */
+	for(i = n - 1; i >= n / 2; i--)
+		if(grow_branch(&lazy, r, &buf[i]) == -1)
+			choke("Could not grow a branch");
+	if(staged_moves(&lazy) != n / 2)
+		fail(variant, ply, "moves left to stage");
+	if(grow_tree(&lazy, r) == -1)
+		choke("Could not grow the rest");
+	if(staged_moves(&lazy) != 0)
+		fail(variant, ply, "moves left after grow_tree()");
+	if(!same_children(&eager, &lazy))
+		fail(variant, ply, "lazy and eager children differ");
+	prune_tree(&eager);
+	prune_tree(&lazy);
+}
+
+
+/* Children of a grown node hold every move get_moves() finds except the
+ * ones that never end; a haulted move also gives the child it stops at */
+static void check_moves(const char *variant, int ply, const BaoState *state,
+		const BaoRules *r)
+{
+	Move moves[MAXMOVES], want[MAXTRANS], got[MAXTRANS];
+	BaoState start, work;
+	BaoTree node;
+	Hand hand;
+	MoveExecSts sts;
+	unsigned int path;
+	int i, nmoves, nwant, ngot;
+
+	/* get_moves() marks the state up for the moves it found */
+	start = *state;
+	nmoves = get_moves(moves, MAXMOVES, &start, r);
+	nwant = 0;
+	for(i = 0; i < nmoves; i++) {
+		work = start;
+		init_move(&hand, &work, r, &moves[i]);
+		if((sts = run_move(&hand, r)) == MXS_HAULTED) {
+			want[nwant] = moves[i];
+			want[nwant++].nyumba_sown = 1;
+			continue_move(&hand);
+			sts = run_move(&hand, r);
+		}
+		if(sts == MXS_ERROR)
+			choke("Could not run a move");
+		if(sts == MXS_PERPETUAL) {
+			nperpetual++;
+			continue;
+		}
+		want[nwant] = moves[i];
+		want[nwant++].nyumba_sown = 0;
+	}
+	memset(&node, 0, sizeof(node));
+	node.state = *state;
+	node.best = NO_PATH;
+	if(grow_tree(&node, r) == -1)
+		choke("Could not grow the tree");
+	ngot = 0;
+	for(path = 0; path < node.nchildren; path++)
+		ngot += branch_moves(&node, path, got + ngot, MAXTRANS - ngot);
+	prune_tree(&node);
+	qsort(want, nwant, sizeof(Move), cmp_moves);
+	qsort(got, ngot, sizeof(Move), cmp_moves);
+	if(nwant != ngot || memcmp(want, got, nwant * sizeof(Move)) != 0)
+		fail(variant, ply, "children's moves are not the moves that end");
+}
+
+
+static void check_mirror(const char *variant, int ply, const BaoState *state,
+		const BaoRules *r)
+{
+	BaoTree node, mirror;
+	BaoState want;
+	TTEntry e;
+	Move m, best;
+	uint64_t key, mkey;
+	uint32_t generation;
+	int i, path, mirrored, mmirrored;
+
+	if(state->board[P_NORTH][H_STORE] || state->board[P_SOUTH][H_STORE]
+	|| state->nyumba[P_NORTH] || state->nyumba[P_SOUTH])
+		return;
+	nmirrored++;
+	memset(&node, 0, sizeof(node));
+	node.state = *state;
+	node.best = NO_PATH;
+	mirror = node;
+	mirror_state(&mirror.state, state);
+	key = canon_hash(&node.state, &mirrored);
+	mkey = canon_hash(&mirror.state, &mmirrored);
+	if(key != mkey)
+		fail(variant, ply, "mirror image has another key");
+	if(cmp_state(&node.state, &mirror.state) != 0 && mirrored == mmirrored)
+		fail(variant, ply, "both images claim to be the representative");
+	if(grow_tree(&node, r) == -1 || grow_tree(&mirror, r) == -1)
+		choke("Could not grow the tree");
+	if(node.nchildren != mirror.nchildren)
+		fail(variant, ply, "mirror image has another number of children");
+	for(i = 0; i < node.nchildren; i++) {
+		m = node.children[i].move;
+		mirror_move(&m);
+		mirror_state(&want, &node.children[i].state);
+		if((path = find_branch(&mirror, &m)) == -1
+		|| cmp_state(&mirror.children[path].state, &want) != 0) {
+			fail(variant, ply, "mirrored move leads elsewhere");
+			break;
+		}
+	}
+	if(node.nchildren) {
+		generation = tt_new_search();
+		tt_store(key, mirrored, generation, 1, 0, TT_EXACT,
+				&node.children[0].move);
+		/* The same move if the position is its own mirror image */
+		m = node.children[0].move;
+		if(mirrored != mmirrored)
+			mirror_move(&m);
+		if(!tt_probe(mkey, mmirrored, generation, &e, &best)
+		|| best.hole != m.hole || best.dir != m.dir
+		|| best.nyumba_sown != m.nyumba_sown)
+			fail(variant, ply, "table move does not come back mirrored");
+	}
+	prune_tree(&node);
+	prune_tree(&mirror);
+}
+
+
+/* Whether both trees hold the same nodes, children in the same order */
+static int same_tree(const BaoTree *a, const BaoTree *b)
+{
+	Move ma[MAXTRANS], mb[MAXTRANS];
+	unsigned int i;
+	int na, nb;
+
+	if(cmp_state(&a->state, &b->state) != 0 || a->best != b->best
+	|| a->score != b->score || a->nchildren != b->nchildren
+	|| a->naliases != b->naliases)
+		return 0;
+	for(i = 0; i < a->nchildren; i++) {
+		na = branch_moves(a, i, ma, MAXTRANS);
+		nb = branch_moves(b, i, mb, MAXTRANS);
+		if(na != nb || memcmp(ma, mb, na * sizeof(Move)) != 0
+		|| !same_tree(&a->children[i], &b->children[i]))
+			return 0;
+	}
+	return 1;
+}
+
+
+/* Saves a kept search tree and loads it back over cleared tables. Eager
+ * growth, as staged nodes are saved without their children. */
+static void check_snapshot(const char *variant, int ply,
+		const BaoState *state, const BaoRules *r)
+{
+	SearchParams params = default_search_params;
+	unsigned int history[SEARCH_HISTORY_SIZE], loaded[SEARCH_HISTORY_SIZE];
+	char path[64];
+	BaoTree *root, *back;
+	uint32_t generation, g;
+	void *table;
+
+	params.keep_tree = 1;
+	params.lazy = 0;
+	if((root = new_tree(r)) == NULL || (table = malloc(TT_BYTES)) == NULL)
+		choke("Could not allocate");
+	root->state = *state;
+	search_score(root, r, SEARCH_DEPTH, &params);
+	memcpy(table, tt_export(&generation), TT_BYTES);
+	search_get_history(history);
+	snprintf(path, sizeof(path), "/tmp/treeTest%d.snap", (int) getpid());
+	if(snapshot_save(path, root, r) == -1)
+		choke("Could not save snapshot");
+	tt_clear();
+	memset(loaded, 0, sizeof(loaded));
+	search_set_history(loaded);
+	back = snapshot_load(path, r);
+	unlink(path);
+	if(back == NULL)
+		choke("Could not load snapshot");
+	if(!same_tree(root, back))
+		fail(variant, ply, "snapshot tree differs");
+	if(memcmp(tt_export(&g), table, TT_BYTES) != 0
+	|| tt_new_search() != generation)
+		fail(variant, ply, "snapshot transposition table differs");
+	search_get_history(loaded);
+	if(memcmp(loaded, history, sizeof(history)) != 0)
+		fail(variant, ply, "snapshot history table differs");
+	free_tree(root);
+	free_tree(back);
+	free(table);
+	tt_clear();
+}
+
+
+static void check_replay(const char *variant, int ply, const BaoTree *node,
+		const BaoRules *r)
+{
+	MoveReplay *replays, *rp;
+	BaoState start, end;
+	unsigned int i;
+
+	if((replays = replay_children(node, r)) == NULL)
+		choke("Could not record the moves");
+	for(i = 0; i < node->nchildren; i++) {
+		rp = &replays[i];
+		start = rp->state;
+		if(replay_seek(rp, rp->nsteps) == -1)
+			choke("Could not play a move back");
+		end = rp->state;
+		next_turn(&end, r);
+		if(cmp_state(&end, &node->children[i].state) != 0)
+			fail(variant, ply, "replayed move does not reach its child");
+		if(replay_seek(rp, 0) == -1)
+			choke("Could not play a move back");
+		if(cmp_state(&rp->state, &start) != 0)
+			fail(variant, ply, "replayed move does not seek back to start");
+		if(replay_seek(rp, rp->nsteps + 1) != -1)
+			fail(variant, ply, "replay seeks past its last step");
+		replay_free(rp);
+	}
+	free(replays);
+}
+
+
+/* Whether the side to move on state can make the other side run out of
+ * moves within depth plies. Returns: 1 if so, -1 if the other side can,
+ * else 0 */
+static int proven_outcome(const BaoState *state, const BaoRules *r,
+		int depth)
+{
+	BaoTree node;
+	unsigned int i;
+	int v, best;
+
+	memset(&node, 0, sizeof(node));
+	node.state = *state;
+	node.best = NO_PATH;
+	if(grow_tree(&node, r) == -1)
+		choke("Could not grow the tree");
+	best = -1;
+	if(node.nchildren != 0 && depth == 0)
+		best = 0;
+	for(i = 0; depth > 0 && i < node.nchildren && best < 1; i++) {
+		v = -proven_outcome(&node.children[i].state, r, depth - 1);
+		if(v > best)
+			best = v;
+	}
+	prune_tree(&node);
+	return best;
+}
+
+
+/* A win or loss within SOLVE_DEPTH plies is one within the solver's
+ * limits too, and the shortest line to it never repeats a position */
+static void check_solve(const char *variant, int ply, const BaoState *state,
+		const BaoRules *r)
+{
+	SolveResult result;
+	BaoTree *root;
+	int want;
+
+	if((want = proven_outcome(state, r, SOLVE_DEPTH)) == 0)
+		return;
+	nproven++;
+	if((root = new_tree(r)) == NULL)
+		choke("Could not initialise a new game");
+	root->state = *state;
+	if(solve(root, r, &default_solve_config, &result) == -1)
+		choke("Could not solve");
+	if(result.outcome != (want == 1 ? SOLVE_WIN : SOLVE_LOSS))
+		fail(variant, ply, "solve() disagrees with a plain search");
+	else if(result.proof_nodes == 0
+	|| (root->nchildren != 0 && root->best >= root->nchildren))
+		fail(variant, ply, "solve() left no proof");
+	free_tree(root);
+}
+
+
+static int score_with(const BaoState *state, const BaoRules *r, int lazy,
+		int keep_tree, size_t budget)
+{
+	SearchParams params = default_search_params;
+	BaoTree *root;
+	int score;
+
+	params.lmr = 0;
+	params.tt = 0;
+	params.lazy = lazy;
+	params.keep_tree = keep_tree;
+	if(set_tree_budget(budget) == -1)
+		choke("Could not set tree budget");
+	if((root = new_tree(r)) == NULL)
+		choke("Could not initialise a new game");
+	root->state = *state;
+	score = search_score(root, r, SEARCH_DEPTH, &params);
+	free_tree(root);
+	set_tree_budget(0);
+	return score;
+}
+
+
+static void check_search(const char *variant, int ply, const BaoState *state,
+		const BaoRules *r)
+{
+	int eager;
+
+	eager = score_with(state, r, 0, 0, 0);
+	if(score_with(state, r, 1, 0, 0) != eager)
+		fail(variant, ply, "lazy search scores differently");
+	if(score_with(state, r, 0, 1, 0) != eager
+	|| score_with(state, r, 1, 1, 0) != eager)
+		fail(variant, ply, "search keeping the tree scores differently");
+	if(score_with(state, r, 1, 1, BUDGET) != eager)
+		fail(variant, ply, "search under a budget scores differently");
+	if(get_tree_memory() != 0)
+		fail(variant, ply, "tree memory left after free_tree()");
+}
+
+
+static void check_playouts(const char *variant, int ply,
+		const BaoState *state, const BaoRules *r)
+{
+	PlayoutResult batch[PLAYOUTS], one;
+	int g;
+
+	if(playouts(state, r, ply, PLAYOUTS, PLAYOUT_PLIES, batch) == -1)
+		choke("Could not play out");
+	for(g = 0; g < PLAYOUTS; g++) {
+		if(playout(state, r, ply + g, PLAYOUT_PLIES, &one) == -1)
+			choke("Could not play out");
+		if(one.winner != batch[g].winner || one.plies != batch[g].plies) {
+			fail(variant, ply, "playouts() disagrees with playout()");
+			break;
+		}
+	}
+}
+
+
+int main(void)
+{
+	const BaoRules *r;
+	BaoTree *root;
+	BaoState start, next, line[MAX_PLIES];
+	BaoStats st;
+	int variant, game, ply, nplies, n;
+
+	for(variant = 0; variant < NRULES; variant++) {
+		r = &rules[variant];
+		srand(variant + 1);
+		if((root = new_tree(r)) == NULL)
+			choke("Could not initialise a new game");
+		start = root->state;
+		nplies = 0;
+		for(game = 0; game < GAMES; game++) {
+			root->state = start;
+			for(ply = 0; ply < MAX_PLIES; ply++, nplies++) {
+				line[ply] = root->state;
+				check_growth(rules_names[variant], ply, &root->state, r);
+				check_moves(rules_names[variant], ply, &root->state, r);
+				check_mirror(rules_names[variant], ply, &root->state, r);
+				if(ply % SEARCH_EVERY == 0)
+					check_search(rules_names[variant], ply, &root->state, r);
+				if(ply == SNAPSHOT_PLY)
+					check_snapshot(rules_names[variant], ply, &root->state,
+							r);
+				/* Later games reach a playout with a move millions of lift
+				 * points long, which takes over a minute */
+				if(ply % SEARCH_EVERY == 0 && game < PLAYOUT_GAMES)
+					check_playouts(rules_names[variant], ply, &root->state, r);
+				if(grow_tree(root, r) == -1)
+					choke("Could not update tree");
+				if(root->nchildren == 0) {
+					for(n = ply; n >= 0 && n > ply - SOLVE_PLIES; n--)
+						check_solve(rules_names[variant], n, &line[n], r);
+					break;
+				}
+				check_replay(rules_names[variant], ply, root, r);
+				next = root->children[rand() % root->nchildren].state;
+				prune_tree(root);
+				root->state = next;
+			}
+			prune_tree(root);
+		}
+		n = nperpetual;
+		check_moves(rules_names[variant], 0, &perpetual_states[variant], r);
+		if(nperpetual == n)
+			fail(rules_names[variant], 0, "no move that never ends found");
+		printf("%s: %d positions checked\n", rules_names[variant], nplies);
+		free_tree(root);
+	}
+	if(nmirrored == 0) {
+		printf("FAIL: no position could be mirrored\n");
+		failures++;
+	}
+	if(nproven == 0) {
+		printf("FAIL: no game ended in a position left to prove\n");
+		failures++;
+	}
+	stats_collect(&st);
+	if(stats_enabled() && st.evictions == 0) {
+		printf("FAIL: the budget never evicted\n");
+		failures++;
+	}
+	if(failures) {
+		printf("%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/******************************************************************************
+ *	tt.c: Transposition table for the search
+ *
+ *		A fixed size, always in memory table of searched positions. Keys
+ *		come from canon_hash() so a mtaji position and its mirror image
+ *		share one entry, the best move is stored as played on the
+ *		canonical position and mirrored back on the way out.
+ *
+ *		Entries belong to the search (tt_new_search) that stored them,
+ *		searches only see their own entries, even with other searches
+ *		running at the same time, so no search takes another's scores for
+ *		its own. Move ordering still learns from earlier searches on the
+ *		same thread (see history in eval.c). A shared table
+ *		(tt_set_shared) lets every search use every entry, for searches
+ *		running side by side on the same table (see server.c).
+ *
+ *		Slots are written and read without locks, as two words: the entry
+ *		packed into data and key ^ data. A slot torn by two threads writing
+ *		it at once no longer matches its key and so reads as a miss.
+ *****************************************************************************/
+
+#include "stats.h"
+#include "tt.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+
+#define TT_SIZE (1U << TT_BITS)
+
+#define TT_GEN_MASK ((1U << TT_GEN_BITS) - 1)
+
+
+struct TTSlot {
+	uint64_t check;		/* key ^ data */
+	uint64_t data;		/* See pack_entry */
+};
+
+
+static struct TTSlot tt_memory[TT_SIZE];
+
+static struct TTSlot *tt_table = tt_memory;	/* Else a tt_import() mapping */
+
+static uint32_t tt_generation;	/* Counts tt_new_search() calls, its low
+								 * TT_GEN_BITS are the last generation */
+
+static int tt_shared;
+
+
+/* score 16 bits, depth 8, bound 2, dir 1, nyumba_sown 1, hole 5 and the
+ * generation in the top TT_GEN_BITS */
+static uint64_t pack_entry(const TTEntry *e)
+{
+	return (uint64_t) (uint16_t) e->score
+		| (uint64_t) e->depth << 16
+		| (uint64_t) (e->bound & 3) << 24
+		| (uint64_t) (e->dir == MXD_RIGHT) << 26
+		| (uint64_t) (e->nyumba_sown != 0) << 27
+		| (uint64_t) (e->hole & 0x1F) << 28
+		| (uint64_t) (e->generation & TT_GEN_MASK) << 33;
+}
+
+
+static void unpack_entry(TTEntry *e, uint64_t key, uint64_t data)
+{
+	e->key = key;
+	e->score = (int16_t) (data & 0xFFFF);
+	e->depth = data >> 16;
+	e->bound = data >> 24 & 3;
+	e->dir = data >> 26 & 1 ? MXD_RIGHT : MXD_LEFT;
+	e->nyumba_sown = data >> 27 & 1;
+	e->hole = data >> 28 & 0x1F;
+	e->generation = data >> 33;
+}
+
+
+/* Returns: 1 and fills e if slot holds a whole entry, else 0 */
+static int load_slot(const struct TTSlot *slot, TTEntry *e)
+{
+	uint64_t check, data;
+
+	check = __atomic_load_n(&slot->check, __ATOMIC_RELAXED);
+	data = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+	if(data == 0)
+		return 0;	/* Never stored, stored entries have depth > 0 */
+	unpack_entry(e, check ^ data, data);
+	return 1;
+}
+
+
+void tt_clear(void)
+{
+	if(tt_table != tt_memory)
+		munmap(tt_table, sizeof(tt_memory));
+	tt_table = tt_memory;
+	memset(tt_memory, 0, sizeof(tt_memory));
+	tt_generation = 0;
+}
+
+
+/*****************************************************************************
+ * tt_export: The table as it is in memory, TT_SIZE slots of TT_SLOT_SIZE
+ *		bytes, for saving (see snapshot.c).
+ *
+ *		Slots hold no pointers and do not depend on where they are loaded.
+ *		generation gets the current search's generation.
+ *****************************************************************************/
+const void *tt_export(uint32_t *generation)
+{
+	*generation = __atomic_load_n(&tt_generation, __ATOMIC_RELAXED)
+		& TT_GEN_MASK;
+	return tt_table;
+}
+
+
+/*****************************************************************************
+ * tt_import: Takes over table, as saved from tt_export().
+ *
+ *		table is a private, writable mmap() of TT_SIZE * TT_SLOT_SIZE bytes,
+ *		its pages are only read in as they get probed. The table owns the
+ *		mapping from now on, until tt_clear() or the next tt_import(). The
+ *		next search carries on generation, so it hits the entries the
+ *		saved table's last search stored. No search may be running.
+ *****************************************************************************/
+void tt_import(void *table, uint32_t generation)
+{
+	if(tt_table != tt_memory)
+		munmap(tt_table, sizeof(tt_memory));
+	tt_table = table;
+	generation &= TT_GEN_MASK;
+	tt_generation = generation ? generation - 1 : 0;
+}
+
+
+/*****************************************************************************
+ * tt_new_search: Hands a search the generation it stores and probes with.
+ *
+ *		Every call gets a new one, so searches running side by side do not
+ *		age out each other's entries. Generations are TT_GEN_BITS wide and
+ *		never 0; when they run out the table is cleared before they start
+ *		over, so an entry is never taken for one of a later search.
+ *****************************************************************************/
+uint32_t tt_new_search(void)
+{
+	uint32_t generation;
+
+	while((generation = __atomic_add_fetch(&tt_generation, 1,
+					__ATOMIC_RELAXED) & TT_GEN_MASK) == 0) {
+		/* Slots torn by searches still storing read as misses */
+		memset(tt_table, 0, sizeof(tt_memory));
+	}
+	return generation;
+}
+
+
+/*****************************************************************************
+ * tt_set_shared: Lets searches hit entries stored by other searches.
+ *
+ *		Off by default. On, the generation only decides which entry gives
+ *		way when two positions share a slot.
+ *****************************************************************************/
+void tt_set_shared(int shared)
+{
+	tt_shared = shared;
+}
+
+
+/*****************************************************************************
+ * tt_probe: Looks key up.
+ *
+ *		mirrored is what canon_hash() said when key was made, best then gets
+ *		the stored move as played on the caller's (not the canonical)
+ *		position.
+ *
+ * Returns: 1 and fills entry and best if key was found else 0
+ *****************************************************************************/
+int tt_probe(uint64_t key, int mirrored, uint32_t generation, TTEntry *entry,
+		Move *best)
+{
+	TTEntry e;
+
+	STATS_INC(tt_probes);
+	if(!load_slot(&tt_table[key & (TT_SIZE - 1)], &e) || e.key != key
+	|| (!tt_shared && e.generation != generation))
+		return 0;
+	STATS_INC(tt_hits);
+	*entry = e;
+	best->hole = e.hole;
+	best->dir = e.dir;
+	best->nyumba_sown = e.nyumba_sown;
+	if(mirrored)
+		mirror_move(best);
+	return 1;
+}
+
+
+/* Keeps the deeper of the two searches when two positions share a slot */
+void tt_store(uint64_t key, int mirrored, uint32_t generation, int depth,
+		int score, TTBound bound, const Move *best)
+{
+	struct TTSlot *slot = &tt_table[key & (TT_SIZE - 1)];
+	TTEntry e;
+	Move m = *best;
+	uint64_t data;
+
+	if(load_slot(slot, &e) && e.generation == generation && e.key != key
+	&& e.depth > depth)
+		return;
+	if(mirrored)
+		mirror_move(&m);
+	e.score = score;
+	e.depth = depth;
+	e.bound = bound;
+	e.generation = generation;
+	e.hole = m.hole;
+	e.dir = m.dir;
+	e.nyumba_sown = m.nyumba_sown;
+	data = pack_entry(&e);
+	__atomic_store_n(&slot->check, key ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,78 @@
+#ifndef BAOTT_H
+#define BAOTT_H
+
+#include "tree.h"
+
+#include <stdint.h>
+
+
+enum {
+	TT_BITS = 16,		/* The table holds 1 << TT_BITS entries */
+	TT_SLOT_SIZE = 16,	/* Bytes per entry in tt_export() */
+	TT_GEN_BITS = 31	/* Of a generation, see tt_new_search() */
+};
+
+
+enum TTBound {
+	/* What an entry's score says about the position's real score */
+	TT_EXACT,
+	TT_LOWER,		/* Search failed high, real score >= score */
+	TT_UPPER		/* Search failed low, real score <= score */
+};
+
+
+struct TTEntry {
+	/* One searched position, keyed on canon_hash() so a position and its
+	 * mirror image share an entry. */
+
+	uint64_t key;
+
+	int16_t score;
+	/* Score for the side to move */
+
+	uint8_t depth;
+	/* Remaining depth score was searched to */
+
+	uint8_t bound;
+	/* See enum TTBound */
+
+	uint32_t generation;
+	/* What tt_new_search() gave the search that stored it, entries of
+	 * other searches never hit (unless the table is shared) */
+
+	uint8_t hole;
+	int8_t dir;
+	uint8_t nyumba_sown;
+	/* Best move found, as played on the canonical position */
+};
+
+
+typedef enum TTBound TTBound;
+
+typedef struct TTEntry TTEntry;
+
+
+void tt_clear(void);
+
+
+uint32_t tt_new_search(void);
+
+
+const void *tt_export(uint32_t *generation);
+
+
+void tt_import(void *table, uint32_t generation);
+
+
+void tt_set_shared(int shared);
+
+
+int tt_probe(uint64_t key, int mirrored, uint32_t generation, TTEntry *entry,
+		Move *best);
+
+
+void tt_store(uint64_t key, int mirrored, uint32_t generation, int depth,
+		int score, TTBound bound, const Move *best);
+
+
+#endif /* BAOTT_H */